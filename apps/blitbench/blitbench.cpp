@@ -0,0 +1,118 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include "../syscall.h"
+
+#define STBI_NO_THREAD_LOCALS
+#define STB_IMAGE_IMPLEMENTATION
+#define STBI_NO_STDIO
+#include "../gview/stb_image.h"
+
+uint32_t GetColor(const unsigned char* p, int bytes_per_pixel) {
+  if (bytes_per_pixel <= 2) {
+    return uint32_t{p[0]} * 0x010101u;
+  }
+  return uint32_t{p[0]} << 16 | uint32_t{p[1]} << 8 | p[2];
+}
+
+uint64_t ElapsedMs(uint64_t tick_start) {
+  auto [tick_end, timer_freq] = SyscallGetCurrentTick();
+  return (tick_end - tick_start) * 1000 / timer_freq;
+}
+
+extern "C" void main(int argc, char** argv) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <image file>\n", argv[0]);
+    exit(1);
+  }
+
+  SyscallResult res = SyscallOpenFile(argv[1], O_RDONLY);
+
+  if (res.error) {
+    fprintf(stderr, "%s: %s\n", strerror(res.error), argv[1]);
+    exit(1);
+  }
+
+  size_t filesize;
+  res = SyscallMapFile(res.value, &filesize, MAPFILE_SEQUENTIAL);
+
+  if (res.error) {
+    fprintf(stderr, "%s\n", strerror(res.error));
+    exit(1);
+  }
+
+  int width, height, bytes_per_pixel;
+  unsigned char* image_data = stbi_load_from_memory(
+    reinterpret_cast<uint8_t*>(res.value),
+    filesize,
+    &width,
+    &height,
+    &bytes_per_pixel,
+    0
+  );
+
+  if (image_data == nullptr) {
+    fprintf(stderr, "failed to load image: %s\n", stbi_failure_reason());
+    exit(1);
+  }
+
+  auto [layer_id, err_openwin] = SyscallOpenWindow(
+    8 + width,
+    28 + height,
+    10,
+    10,
+    "blitbench"
+  );
+
+  if (err_openwin) {
+    exit(err_openwin);
+  }
+
+  // 1画素ずつWinFillRectangleで描く
+  auto tick_start = SyscallGetCurrentTick().value;
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      const auto p = &image_data[bytes_per_pixel * (y * width + x)];
+      SyscallWinFillRectangle(
+        layer_id | LAYER_NO_REDRAW,
+        4 + x,
+        24 + y,
+        1,
+        1,
+        GetColor(p, bytes_per_pixel)
+      );
+    }
+  }
+  SyscallWinRedraw(layer_id);
+  const uint64_t fill_ms = ElapsedMs(tick_start);
+
+  // 画像全体をWinBlitで1回で描く
+  const BlitImage image{
+    image_data,
+    width,
+    height,
+    width * bytes_per_pixel,
+    static_cast<BlitImage::BlitImageFormat>(bytes_per_pixel)
+  };
+  tick_start = SyscallGetCurrentTick().value;
+  res = SyscallWinBlit(layer_id, &image, 4, 24, 0, 0);
+  const uint64_t blit_ms = ElapsedMs(tick_start);
+
+  if (res.error) {
+    fprintf(stderr, "WinBlit failed: %s\n", strerror(res.error));
+    exit(1);
+  }
+
+  // 半分の大きさへ縮小して描く
+  tick_start = SyscallGetCurrentTick().value;
+  SyscallWinBlit(layer_id, &image, 4, 24, width / 2, height / 2);
+  const uint64_t scaled_ms = ElapsedMs(tick_start);
+
+  printf("%s: %dx%d, %d bytes/pixel\n", argv[1], width, height, bytes_per_pixel);
+  printf("per-pixel fill %lu ms, blit %lu ms, half-size blit %lu ms\n",
+         fill_ms, blit_ms, scaled_ms);
+
+  SyscallCloseWindow(layer_id);
+  exit(0);
+}
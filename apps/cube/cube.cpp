@@ -15,9 +15,11 @@ struct Vector2D {
   T x, y;
 };
 
-void DrawObj(uint64_t layer_id);
+void DrawObj();
 
-void DrawSurface(uint64_t layer_id, int sur);
+void DrawSurface(int sur);
+
+void FillSpan(int x0, int x1, int y, uint32_t color);
 
 bool Sleep(unsigned long ms);
 
@@ -44,6 +46,8 @@ array<double, kSurface.size()> centerz4;
 
 array<Vector2D<int>, kCube.size()> scr;
 
+WindowBufferInfo canvas;
+
 
 
 extern "C" void main(int argc, char** argv) {
@@ -59,6 +63,11 @@ extern "C" void main(int argc, char** argv) {
     exit(err_openwin);
   }
 
+  // ウィンドウの画素を直接書き換え, 1フレームにつき1回の通知で済ませる
+  if (auto [addr, err] = SyscallMapWindowBuffer(layer_id, &canvas); err) {
+    exit(err);
+  }
+
   int thx = 0, thy = 0, thz = 0;
   const double to_rad = 3.14159265358979323 / 0x8000;
 
@@ -90,17 +99,12 @@ extern "C" void main(int argc, char** argv) {
     }
 
     // 画面を一旦クリアし，立方体を描画
-    SyscallWinFillRectangle(
-      layer_id | LAYER_NO_REDRAW,
-      4,
-      24,
-      kCanvasSize,
-      kCanvasSize,
-      0
-    );
+    for (int y = 0; y < kCanvasSize; y++) {
+      FillSpan(0, kCanvasSize - 1, y, 0);
+    }
 
-    DrawObj(layer_id | LAYER_NO_REDRAW);
-    SyscallWinRedraw(layer_id);
+    DrawObj();
+    SyscallWinDamage(layer_id, 4, 24, kCanvasSize, kCanvasSize);
 
     if (Sleep(50)) {
       break;
@@ -111,7 +115,7 @@ extern "C" void main(int argc, char** argv) {
   exit(0);
 }
 
-void DrawObj(uint64_t layer_id) {
+void DrawObj() {
   // オブジェクト座標vertをスクリーン座標scrに変換（画面奥がZ+）
   for (int i = 0; i < kCube.size(); i++) {
     const double t = 6 * kScale / (vert[i].z + 8 * kScale);
@@ -138,12 +142,12 @@ void DrawObj(uint64_t layer_id) {
                e1x = v2.x - v1.x, e1y = v2.y - v1.y; // v1 --> v2
 
     if (e0x * e1y <= e0y * e1x) {
-      DrawSurface(layer_id, sur);
+      DrawSurface(sur);
     }
   }
 }
 
-void DrawSurface(uint64_t layer_id, int sur) {
+void DrawSurface(int sur) {
   const auto& surface = kSurface[sur]; // 描画する面
   int ymin = kCanvasSize, ymax = 0; // 画面の描画範囲 [ymin, ymax]
   int y2x_up[kCanvasSize], y2x_down[kCanvasSize]; // Y, X座標の組
@@ -181,14 +185,20 @@ void DrawSurface(uint64_t layer_id, int sur) {
   for (int y = ymin; y <= ymax; y++) {
     int p0x = min(y2x_up[y], y2x_down[y]);
     int p1x = max(y2x_up[y], y2x_down[y]);
-    SyscallWinFillRectangle(
-      layer_id,
-      4 + p0x,
-      24 + y,
-      p1x - p0x + 1,
-      1,
-      kColor[sur]
-    );
+    FillSpan(p0x, p1x, y, kColor[sur]);
+  }
+}
+
+void FillSpan(int x0, int x1, int y, uint32_t color) {
+  if (canvas.pixel_layout == WindowBufferInfo::kRGBResv8BitPerColor) {
+    color = (color & 0x00ff00) | (color >> 16 & 0xff) | (color & 0xff) << 16;
+  }
+
+  auto line = reinterpret_cast<uint32_t*>(canvas.pixels)
+    + canvas.pixels_per_scan_line * (24 + y);
+
+  for (int x = x0; x <= x1; x++) {
+    line[4 + x] = color;
   }
 }
 
@@ -0,0 +1,127 @@
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+#include "../syscall.h"
+
+static constexpr int kWidth = 200, kHeight = 150;
+static constexpr const char* kText = "batch";
+
+class CommandBuffer {
+  public:
+    void Fill(int x, int y, int w, int h, uint32_t color) {
+      auto& cmd = Append(DrawCommand::kFill, 0);
+      cmd.arg.fill = { x, y, w, h, color };
+    }
+
+    void Line(int x0, int y0, int x1, int y1, uint32_t color) {
+      auto& cmd = Append(DrawCommand::kLine, 0);
+      cmd.arg.line = { x0, y0, x1, y1, color };
+    }
+
+    void Text(int x, int y, uint32_t color, const char* s) {
+      const int len = strlen(s);
+      auto& cmd = Append(DrawCommand::kText, len);
+      cmd.arg.text = { x, y, color, len };
+      memcpy(&cmd + 1, s, len);
+    }
+
+    const void* Data() const {
+      return buf_.data();
+    }
+
+    size_t Bytes() const {
+      return buf_.size();
+    }
+
+  private:
+    std::vector<char> buf_;
+
+    DrawCommand& Append(DrawCommand::DrawCommandType type, size_t data_bytes) {
+      const size_t size = (sizeof(DrawCommand) + data_bytes + 3) & ~size_t(3);
+      const size_t offset = buf_.size();
+      buf_.resize(offset + size);
+      auto& cmd = *reinterpret_cast<DrawCommand*>(&buf_[offset]);
+      cmd.type = type;
+      cmd.size = size;
+      return cmd;
+    }
+};
+
+struct Primitive {
+  int kind;
+  int x, y;
+  uint32_t color;
+};
+
+uint64_t ElapsedMs(uint64_t tick_start) {
+  auto [tick_end, timer_freq] = SyscallGetCurrentTick();
+  return (tick_end - tick_start) * 1000 / timer_freq;
+}
+
+extern "C" void main(int argc, char** argv) {
+  auto [layer_id, err_openwin] = SyscallOpenWindow(
+    kWidth + 8,
+    kHeight + 28,
+    10,
+    10,
+    "drawbench"
+  );
+
+  if (err_openwin) {
+    exit(err_openwin);
+  }
+
+  int num_prims = 10000;
+
+  if (argc >= 2) {
+    num_prims = atoi(argv[1]);
+  }
+
+  std::default_random_engine rand_engine;
+  std::uniform_int_distribution kind_dist(0, 2);
+  std::uniform_int_distribution x_dist(0, kWidth - 48), y_dist(0, kHeight - 16);
+  std::uniform_int_distribution<uint32_t> color_dist(0, 0xffffff);
+
+  std::vector<Primitive> prims(num_prims);
+  for (auto& p : prims) {
+    p = { kind_dist(rand_engine), x_dist(rand_engine), y_dist(rand_engine),
+          color_dist(rand_engine) };
+  }
+
+  const uint64_t layer = layer_id | LAYER_NO_REDRAW;
+
+  auto tick_start = SyscallGetCurrentTick().value;
+  for (const auto& p : prims) {
+    const int x = 4 + p.x, y = 24 + p.y;
+    switch (p.kind) {
+    case 0: SyscallWinFillRectangle(layer, x, y, 8, 8, p.color); break;
+    case 1: SyscallWinDrawLine(layer, x, y, x + 40, y + 12, p.color); break;
+    case 2: SyscallWinWriteString(layer, x, y, p.color, kText); break;
+    }
+  }
+  SyscallWinRedraw(layer_id);
+  const uint64_t single_ms = ElapsedMs(tick_start);
+
+  tick_start = SyscallGetCurrentTick().value;
+  CommandBuffer cmds;
+  for (const auto& p : prims) {
+    const int x = 4 + p.x, y = 24 + p.y;
+    switch (p.kind) {
+    case 0: cmds.Fill(x, y, 8, 8, p.color); break;
+    case 1: cmds.Line(x, y, x + 40, y + 12, p.color); break;
+    case 2: cmds.Text(x, y, p.color, kText); break;
+    }
+  }
+  auto res = SyscallWinDrawBatch(layer_id, cmds.Data(), cmds.Bytes());
+  const uint64_t batch_ms = ElapsedMs(tick_start);
+
+  if (res.error) {
+    printf("batch failed after %lu commands: %d\n", res.value, res.error);
+    exit(1);
+  }
+
+  printf("%d primitives: single calls %lu ms, batch %lu ms (%lu bytes)\n",
+         num_prims, single_ms, batch_ms, cmds.Bytes());
+  exit(0);
+}
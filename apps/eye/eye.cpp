@@ -2,6 +2,7 @@
 #include <cmath>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include "../syscall.h"
 
 static const int kCanvasSize = 100, kEyeSize = 10;
@@ -54,20 +55,37 @@ extern "C" void main(int argc, char** argv) {
     0xffffff
   );
 
-  AppEvent events[1];
+  AppEvent events[32];
 
-  while (true) {
-    auto [ n, err ] = SyscallReadEvent(events, 1);
+  // ReadEventExの外で使ったサイクル数をイベントループのCPU使用量とみなす
+  uint64_t num_events = 0, num_reads = 0, busy_cycles = 0;
+  const uint64_t loop_start = __builtin_ia32_rdtsc();
+  bool quit = false;
+
+  while (!quit) {
+    auto [ n, err ] = SyscallReadEventEx(
+      events, 32, 0, 0, APP_EVENT_MASK(AppEvent::kMouseMove));
+    const uint64_t busy_start = __builtin_ia32_rdtsc();
 
     if (err) {
       printf("ReadEvent failed: %s\n", strerror(err));
       break;
     }
+    num_events += n;
+    num_reads++;
 
-    if (events[0].type == AppEvent::kQuit) {
-      break;
-    } else if (events[0].type == AppEvent::kMouseMove) {
-      auto& arg = events[0].arg.mouse_move;
+    // 目は最後のマウス位置だけを向けばよいので, 溜まった移動は1回の描画にまとめる
+    const AppEvent* last_move = nullptr;
+    for (int i = 0; i < n; ++i) {
+      if (events[i].type == AppEvent::kQuit) {
+        quit = true;
+      } else if (events[i].type == AppEvent::kMouseMove) {
+        last_move = &events[i];
+      }
+    }
+
+    if (!quit && last_move) {
+      auto& arg = last_move->arg.mouse_move;
       SyscallWinFillRectangle(
         layer_id | LAYER_NO_REDRAW,
         4,
@@ -82,11 +100,16 @@ extern "C" void main(int argc, char** argv) {
         arg.y,
         0x000000
       );
-    } else {
-      printf("unknown event: type = %d\n", events[0].type);
     }
+    busy_cycles += __builtin_ia32_rdtsc() - busy_start;
   }
 
+  const uint64_t total_cycles = __builtin_ia32_rdtsc() - loop_start;
+  printf("%lu events in %lu reads, event loop busy %lu.%lu%%\n",
+         num_events, num_reads,
+         busy_cycles * 100 / total_cycles,
+         busy_cycles * 1000 / total_cycles % 10);
+
   SyscallCloseWindow(layer_id);
   exit(0);
 }
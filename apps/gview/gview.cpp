@@ -20,7 +20,7 @@ std::tuple<int, uint8_t*, size_t> MapFile(const char* filepath) {
 
   const int fd = res.value;
   size_t filesize;
-  res = SyscallMapFile(fd, &filesize, 0);
+  res = SyscallMapFile(fd, &filesize, MAPFILE_SEQUENTIAL);
 
   if (res.error) {
     fprintf(stderr, "%s\n", strerror(res.error));
@@ -33,8 +33,10 @@ std::tuple<int, uint8_t*, size_t> MapFile(const char* filepath) {
 void WaitEvent() {
   AppEvent events[1];
 
+  // 終了以外のイベントは要らないので, カーネルに捨ててもらう
   while (true) {
-    auto [ n, err ] = SyscallReadEvent(events, 1);
+    auto [ n, err ] = SyscallReadEventEx(
+      events, 1, 0, 0, APP_EVENT_MASK(AppEvent::kQuit));
 
     if (err) {
       fprintf(
@@ -51,17 +53,6 @@ void WaitEvent() {
   }
 }
 
-uint32_t GetColorRGB(unsigned char* image_data) {
-  return static_cast<uint32_t>(image_data[0]) << 16 |
-         static_cast<uint32_t>(image_data[1]) << 8 |
-         static_cast<uint32_t>(image_data[2]);
-}
-
-uint32_t GetColorGray(unsigned char* image_data) {
-  const uint32_t gray = image_data[0];
-  return gray << 16 | gray << 8 | gray;
-}
-
 extern "C" void main(int argc, char** argv) {
   if (argc < 2) {
     fprintf(
@@ -102,12 +93,6 @@ extern "C" void main(int argc, char** argv) {
     bytes_per_pixel
   );
 
-  auto get_color = GetColorRGB;
-
-  if (bytes_per_pixel <= 2) {
-    get_color = GetColorGray;
-  }
-
   const char* last_slash = strrchr(filepath, '/');
   const char* filename = last_slash ? &last_slash[1] : filepath;
   SyscallResult window = SyscallOpenWindow(
@@ -129,21 +114,25 @@ extern "C" void main(int argc, char** argv) {
 
   const uint64_t layer_id = window.value;
 
-  for (int y = 0; y < height; y++) {
-    for (int x = 0; x < width; x++) {
-      uint32_t c = get_color(&image_data[bytes_per_pixel * (y * width + x)]);
-      SyscallWinFillRectangle(
-        layer_id | LAYER_NO_REDRAW,
-        4 + x,
-        24 + y,
-        1,
-        1,
-        c
-      );
-    }
+  const BlitImage image{
+    image_data,
+    width,
+    height,
+    width * bytes_per_pixel,
+    static_cast<BlitImage::BlitImageFormat>(bytes_per_pixel)
+  };
+  auto [tick_start, timer_freq] = SyscallGetCurrentTick();
+
+  if (auto [ n, err ] = SyscallWinBlit(layer_id, &image, 4, 24, 0, 0); err) {
+    fprintf(stderr, "WinBlit failed: %s\n", strerror(err));
   }
 
-  SyscallWinRedraw(layer_id);
+  auto tick_end = SyscallGetCurrentTick();
+  fprintf(
+    stderr,
+    "drawn in %lu ms\n",
+    (tick_end.value - tick_start) * 1000 / timer_freq
+  );
   WaitEvent();
 
   SyscallCloseWindow(layer_id);
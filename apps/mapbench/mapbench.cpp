@@ -0,0 +1,65 @@
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include "../syscall.h"
+
+int ParseAdvice(const char* s) {
+  if (strcmp(s, "seq") == 0) {
+    return MAPFILE_SEQUENTIAL;
+  } else if (strcmp(s, "rand") == 0) {
+    return MAPFILE_RANDOM;
+  } else if (strcmp(s, "willneed") == 0) {
+    return MAPFILE_WILLNEED;
+  }
+  return 0;
+}
+
+extern "C" void main(int argc, char** argv) {
+  if (argc < 2) {
+    printf("Usage: %s <file> [normal|seq|rand|willneed]\n", argv[0]);
+    exit(1);
+  }
+
+  const int flags = argc >= 3 ? ParseAdvice(argv[2]) : 0;
+
+  SyscallResult res = SyscallOpenFile(argv[1], O_RDONLY);
+
+  if (res.error) {
+    fprintf(stderr, "failed to open %s: %d\n", argv[1], res.error);
+    exit(1);
+  }
+
+  const int fd = res.value;
+  const uint64_t faults_start = SyscallGetPageFaultCount().value;
+  auto [tick_start, timer_freq] = SyscallGetCurrentTick();
+
+  size_t file_size;
+  res = SyscallMapFile(fd, &file_size, flags);
+
+  if (res.error) {
+    fprintf(stderr, "failed to map %s: %d\n", argv[1], res.error);
+    exit(1);
+  }
+
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(res.value);
+  uint64_t sum = 0;
+
+  for (size_t i = 0; i < file_size; i++) {
+    sum += p[i];
+  }
+
+  auto tick_end = SyscallGetCurrentTick();
+  const uint64_t faults = SyscallGetPageFaultCount().value - faults_start;
+  const uint64_t elapsed_ms = (tick_end.value - tick_start) * 1000 / timer_freq;
+
+  printf("sum = %lu (%lu bytes)\n", sum, file_size);
+  printf(
+    "%lu faults, %lu ms, %lu KiB/s\n",
+    faults,
+    elapsed_ms,
+    elapsed_ms ? file_size * 1000 / 1024 / elapsed_ms : 0
+  );
+
+  exit(0);
+}
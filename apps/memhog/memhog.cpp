@@ -0,0 +1,30 @@
+#include <cstdio>
+#include <cstdlib>
+#include "../syscall.h"
+
+extern "C" void main(int argc, char** argv) {
+  size_t mib = 64;
+
+  if (argc >= 2) {
+    mib = atoi(argv[1]);
+  }
+
+  const size_t num_pages = mib * 256;
+  SyscallResult res = SyscallDemandPages(num_pages, 0);
+
+  if (res.error) {
+    printf("failed to demand %lu pages\n", num_pages);
+    exit(1);
+  }
+
+  // 全ページに書き込み, 実際にフレームを割り当てさせる
+  char* buf = reinterpret_cast<char*>(res.value);
+
+  for (size_t i = 0; i < num_pages; i++) {
+    buf[i * 4096] = i;
+  }
+
+  printf("touched %lu MiB (%lu page faults)\n",
+         mib, SyscallGetPageFaultCount().value);
+  exit(0);
+}
@@ -1,8 +1,10 @@
 #include <errno.h>
 #include <signal.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include "sync.h"
 #include "syscall.h"
 
 int close(int fd) {
@@ -73,22 +75,171 @@ caddr_t sbrk(int incr) {
   static uint64_t dpage_end = 0;
   static uint64_t program_break = 0;
 
-  if (dpage_end == 0 || dpage_end < program_break + incr) {
-    int num_pages = (incr + 4095) / 4096;
+  if (dpage_end == 0) {
+    struct SyscallResult res = SyscallDemandPages(0, 0);
+    if (res.error) {
+      errno = ENOMEM;
+      return (caddr_t) -1;
+    }
+    program_break = dpage_end = res.value;
+  }
+
+  const uint64_t new_break = program_break + incr;
+
+  if (dpage_end < new_break) {
+    int num_pages = (new_break - dpage_end + 4095) / 4096;
     struct SyscallResult res = SyscallDemandPages(num_pages, 0);
     if (res.error) {
       errno = ENOMEM;
       return (caddr_t) -1;
     }
-    program_break = res.value;
-    dpage_end = res.value + 4096 * num_pages;
+    dpage_end += 4096 * num_pages;
+  } else if (new_break + 4096 <= dpage_end) {
+    // 不要になったページをカーネルへ返す
+    const uint64_t new_end = (new_break + 4095) & ~(uint64_t)4095;
+    SyscallMunmap((void*) new_end, dpage_end - new_end);
+    dpage_end = new_end;
   }
 
   const uint64_t prev_break = program_break;
-  program_break += incr;
+  program_break = new_break;
   return (caddr_t) prev_break;
 }
 
+void MutexLock(struct Mutex* m) {
+  uint32_t c = 0;
+  if (__atomic_compare_exchange_n(&m->state, &c, 1, 0,
+                                  __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+    return;
+  }
+
+  // 待つものがいることを解放側に知らせてから待つ
+  if (c != 2) {
+    c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+  }
+  while (c != 0) {
+    SyscallFutexWait(&m->state, 2, 0);
+    c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+  }
+}
+
+int MutexTryLock(struct Mutex* m) {
+  uint32_t c = 0;
+  return __atomic_compare_exchange_n(&m->state, &c, 1, 0,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+void MutexUnlock(struct Mutex* m) {
+  if (__atomic_fetch_sub(&m->state, 1, __ATOMIC_RELEASE) != 1) {
+    __atomic_store_n(&m->state, 0, __ATOMIC_RELEASE);
+    SyscallFutexWake(&m->state, 1);
+  }
+}
+
+int CondTimedWait(struct CondVar* cv, struct Mutex* m, unsigned long timeout_ms) {
+  const uint32_t seq = __atomic_load_n(&cv->seq, __ATOMIC_ACQUIRE);
+  MutexUnlock(m);
+
+  struct SyscallResult res = SyscallFutexWait(&cv->seq, seq, timeout_ms);
+
+  // 一斉に起こされた他のタスクを取りこぼさないよう, 待つものがいる印を付けて確保する
+  while (__atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE) != 0) {
+    SyscallFutexWait(&m->state, 2, 0);
+  }
+
+  return res.error == ETIMEDOUT ? ETIMEDOUT : 0;
+}
+
+void CondWait(struct CondVar* cv, struct Mutex* m) {
+  CondTimedWait(cv, m, 0);
+}
+
+void CondSignal(struct CondVar* cv) {
+  __atomic_fetch_add(&cv->seq, 1, __ATOMIC_RELEASE);
+  SyscallFutexWake(&cv->seq, 1);
+}
+
+void CondBroadcast(struct CondVar* cv) {
+  __atomic_fetch_add(&cv->seq, 1, __ATOMIC_RELEASE);
+  SyscallFutexWake(&cv->seq, SIZE_MAX);
+}
+
+struct ThreadStart {
+  int (*func)(void*);
+  void* arg;
+};
+
+static int multi_threaded = 0;
+
+static void ThreadEntry(int unused, void* p) {
+  struct ThreadStart start = *(struct ThreadStart*) p;
+  free(p);
+  SyscallThreadExit(start.func(start.arg));
+}
+
+int ThreadCreate(uint64_t* thread_id, int (*func)(void*), void* arg) {
+  struct ThreadStart* start = malloc(sizeof(struct ThreadStart));
+  if (!start) {
+    return ENOMEM;
+  }
+  start->func = func;
+  start->arg = arg;
+
+  multi_threaded = 1;
+  struct SyscallResult res = SyscallThreadCreate(ThreadEntry, start, 0);
+  if (res.error) {
+    free(start);
+    return res.error;
+  }
+
+  *thread_id = res.value;
+  return 0;
+}
+
+int ThreadJoin(uint64_t thread_id, int* exit_code) {
+  struct SyscallResult res = SyscallThreadJoin(thread_id);
+  if (res.error) {
+    return res.error;
+  }
+
+  if (exit_code) {
+    *exit_code = res.value;
+  }
+  return 0;
+}
+
+// newlibのmallocが呼ぶ. mallocの中から再帰的に呼ばれることがある
+static struct Mutex malloc_mutex;
+static uint64_t malloc_owner = 0;
+static int malloc_depth = 0;
+
+void __malloc_lock(struct _reent* r) {
+  if (!multi_threaded) {
+    return;
+  }
+
+  const uint64_t self = SyscallThreadSelf().value;
+  if (__atomic_load_n(&malloc_owner, __ATOMIC_RELAXED) == self) {
+    ++malloc_depth;
+    return;
+  }
+
+  MutexLock(&malloc_mutex);
+  __atomic_store_n(&malloc_owner, self, __ATOMIC_RELAXED);
+  malloc_depth = 1;
+}
+
+void __malloc_unlock(struct _reent* r) {
+  if (!multi_threaded) {
+    return;
+  }
+
+  if (--malloc_depth == 0) {
+    __atomic_store_n(&malloc_owner, 0, __ATOMIC_RELAXED);
+    MutexUnlock(&malloc_mutex);
+  }
+}
+
 ssize_t write(int fd,
               const void* buf,
               size_t count) {
@@ -0,0 +1,28 @@
+#include <cstdio>
+#include <cstdlib>
+#include "../syscall.h"
+
+extern "C" void main(int argc, char** argv) {
+  int num_calls = 1000000;
+
+  if (argc >= 2) {
+    num_calls = atoi(argv[1]);
+  }
+
+  // GetCurrentTickはカウンタを読むだけなので, 時間のほぼ全てが出入りの処理になる
+  auto [tick_start, timer_freq] = SyscallGetCurrentTick();
+  for (int i = 0; i < num_calls; i++) {
+    SyscallGetCurrentTick();
+  }
+  auto tick_end = SyscallGetCurrentTick();
+
+  const uint64_t elapsed_ms = (tick_end.value - tick_start) * 1000 / timer_freq;
+  printf("%d round trips in %lu ms", num_calls, elapsed_ms);
+
+  if (elapsed_ms > 0) {
+    printf(", %lu calls/s", static_cast<uint64_t>(num_calls) * 1000 / elapsed_ms);
+  }
+
+  printf("\n");
+  exit(0);
+}
@@ -0,0 +1,55 @@
+#include <cstdlib>
+#include <cstdio>
+#include <fcntl.h>
+#include "../syscall.h"
+
+// 使い方:
+//   openbench [rounds] [path...]
+//
+// 各パスをrounds回ずつ開き, 1回あたりの時間を表示する.
+// カーネル内のパス解決（ディレクトリの探索）の速さを比べるためのもの.
+//
+// closeが無くFDが増え続けるので, 既定のパスは存在するファイルの後ろに "/x" を付けている.
+// こうするとパスは最後まで解決されるが, ファイルがディレクトリではないのでFDは作られない.
+// 解決の統計はターミナルのfatstatで見られる.
+static const char* const kDefaultPaths[] = {
+  "/apps/cube/x",
+  "/memmap/x",
+  "/apps/nosuch",
+  "/nosuch",
+};
+
+extern "C" void main(int argc, char** argv) {
+  const int rounds = argc >= 2 ? atoi(argv[1]) : 1000;
+  const char* const* paths = kDefaultPaths;
+  int num_paths = sizeof(kDefaultPaths) / sizeof(kDefaultPaths[0]);
+
+  if (argc >= 3) {
+    paths = &argv[2];
+    num_paths = argc - 2;
+  }
+
+  if (rounds <= 0) {
+    printf("Usage: %s [rounds] [path...]\n", argv[0]);
+    exit(1);
+  }
+
+  int found = 0;
+  auto [tick_start, timer_freq] = SyscallGetCurrentTick();
+
+  for (int r = 0; r < rounds; r++) {
+    for (int i = 0; i < num_paths; i++) {
+      if (SyscallOpenFile(paths[i], O_RDONLY).error == 0) {
+        found++;
+      }
+    }
+  }
+
+  auto tick_end = SyscallGetCurrentTick();
+  const uint64_t elapsed_ms = (tick_end.value - tick_start) * 1000 / timer_freq;
+  const uint64_t opens = static_cast<uint64_t>(rounds) * num_paths;
+
+  printf("%lu opens (%d found), %lu ms, %lu ns/open\n",
+         opens, found, elapsed_ms, elapsed_ms * 1000000 / opens);
+  exit(0);
+}
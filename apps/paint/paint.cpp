@@ -22,52 +22,73 @@ extern "C" void main(int argc, char** argv) {
     exit(err_openwin);
   }
 
-  AppEvent events[1];
+  AppEvent events[32];
   bool press = false;
+  const uint32_t type_mask = APP_EVENT_MASK(AppEvent::kMouseMove)
+                           | APP_EVENT_MASK(AppEvent::kMouseButton);
 
-  while (true) {
-    auto [ n, err ] = SyscallReadEvent(events, 1);
+  // ReadEventExの外で使ったサイクル数をイベントループのCPU使用量とみなす
+  uint64_t num_events = 0, num_reads = 0, busy_cycles = 0;
+  const uint64_t loop_start = __builtin_ia32_rdtsc();
+  bool quit = false;
+
+  while (!quit) {
+    auto [ n, err ] = SyscallReadEventEx(events, 32, 0, 0, type_mask);
+    const uint64_t busy_start = __builtin_ia32_rdtsc();
 
     if (err) {
       printf("ReadEvent failed: %s\n", strerror(err));
       break;
     }
+    num_events += n;
+    num_reads++;
 
-    if (events[0].type == AppEvent::kQuit) {
-      break;
-    } else if (events[0].type == AppEvent::kMouseMove) {
-      auto& arg = events[0].arg.mouse_move;
-      const auto prev_x = arg.x - arg.dx, prev_y = arg.y - arg.dy;
+    for (int i = 0; i < n && !quit; ++i) {
+      if (events[i].type == AppEvent::kQuit) {
+        quit = true;
+      } else if (events[i].type == AppEvent::kMouseMove) {
+        auto& arg = events[i].arg.mouse_move;
+        const auto prev_x = arg.x - arg.dx, prev_y = arg.y - arg.dy;
 
-      if (press && IsInside(prev_x, prev_y) && IsInside(arg.x, arg.y)) {
-        SyscallWinDrawLine(
-          layer_id,
-          prev_x,
-          prev_y,
-          arg.x,
-          arg.y,
-          0x000000
-        );
-      }
-    } else if (events[0].type == AppEvent::kMouseButton) {
-      auto& arg = events[0].arg.mouse_button;
+        if (press && IsInside(prev_x, prev_y) && IsInside(arg.x, arg.y)) {
+          SyscallWinDrawLine(
+            layer_id | LAYER_NO_REDRAW,
+            prev_x,
+            prev_y,
+            arg.x,
+            arg.y,
+            0x000000
+          );
+        }
+      } else if (events[i].type == AppEvent::kMouseButton) {
+        auto& arg = events[i].arg.mouse_button;
 
-      if (arg.button == 0) {
-        press = arg.press;
-        SyscallWinFillRectangle(
-          layer_id,
-          arg.x,
-          arg.y,
-          1,
-          1,
-          0x000000
-        );
+        if (arg.button == 0) {
+          press = arg.press;
+          SyscallWinFillRectangle(
+            layer_id | LAYER_NO_REDRAW,
+            arg.x,
+            arg.y,
+            1,
+            1,
+            0x000000
+          );
+        }
+      } else {
+        printf("unknown event: type = %d\n", events[i].type);
       }
-    } else {
-      printf("unknown event: type = %d\n", events[0].type);
     }
+    // 1回の読み込みで得たイベントをまとめて画面へ反映する
+    SyscallWinRedraw(layer_id);
+    busy_cycles += __builtin_ia32_rdtsc() - busy_start;
   }
 
+  const uint64_t total_cycles = __builtin_ia32_rdtsc() - loop_start;
+  printf("%lu events in %lu reads, event loop busy %lu.%lu%%\n",
+         num_events, num_reads,
+         busy_cycles * 100 / total_cycles,
+         busy_cycles * 1000 / total_cycles % 10);
+
   SyscallCloseWindow(layer_id);
   exit(0);
 }
@@ -0,0 +1,120 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include "../syscall.h"
+
+// 使い方:
+//   pipebench write <MiB> [copy] | pipebench read
+//   pipebench text <MiB> | sort > sorted.txt
+//
+// 多段パイプの性能はターミナルのtimeで測る:
+//   pipebench text <MiB> > big.txt
+//   time cat big.txt | grep line | sort > sorted.txt
+//
+// 4KiB境界に揃った大きな書き込みはページごと受け渡される. copyを付けると
+// わざと境界をずらし, 複製による受け渡しと比べられるようにする.
+static const size_t kBufBytes = 1024 * 1024;
+alignas(4096) static char buf[kBufBytes + 4096];
+
+uint64_t ElapsedMs(uint64_t tick_start, uint64_t timer_freq) {
+  return (SyscallGetCurrentTick().value - tick_start) * 1000 / timer_freq;
+}
+
+void PrintThroughput(const char* what, size_t bytes, uint64_t elapsed_ms) {
+  fprintf(stderr, "%s %lu bytes in %lu ms", what, bytes, elapsed_ms);
+
+  if (elapsed_ms > 0) {
+    const uint64_t kib_per_s = bytes / 1024 * 1000 / elapsed_ms;
+    fprintf(stderr, ", %lu.%lu MiB/s",
+            kib_per_s / 1024, kib_per_s * 10 / 1024 % 10);
+  }
+
+  fprintf(stderr, "\n");
+}
+
+size_t WriteAll(const char* p, size_t bytes) {
+  size_t sent = 0;
+  while (sent < bytes) {
+    const ssize_t n = write(1, p + sent, bytes - sent);
+    if (n <= 0) {
+      break;
+    }
+    sent += n;
+  }
+  return sent;
+}
+
+void Write(size_t total_bytes, bool copy) {
+  char* p = copy ? buf + 1 : buf;
+  memset(p, 'x', kBufBytes);
+
+  auto [ tick_start, timer_freq ] = SyscallGetCurrentTick();
+  size_t sent = 0;
+  while (sent < total_bytes) {
+    const size_t n = WriteAll(p, std::min(kBufBytes, total_bytes - sent));
+    if (n == 0) {
+      break;
+    }
+    sent += n;
+  }
+  PrintThroughput("wrote", sent, ElapsedMs(tick_start, timer_freq));
+}
+
+void Read() {
+  size_t received = 0;
+  uint64_t tick_start = 0, timer_freq = 1;
+
+  while (true) {
+    const ssize_t n = read(0, buf, kBufBytes);
+    if (n <= 0) {
+      break;
+    }
+    if (received == 0) {
+      const auto tick = SyscallGetCurrentTick();
+      tick_start = tick.value;
+      timer_freq = tick.error;
+    }
+    received += n;
+  }
+
+  PrintThroughput("read", received, ElapsedMs(tick_start, timer_freq));
+}
+
+// sortへ流し込むための行を作り, 一度のwriteで書き込む
+void Text(size_t total_bytes) {
+  void* p;
+  if (posix_memalign(&p, 4096, total_bytes) != 0) {
+    fprintf(stderr, "failed to allocate %lu bytes\n", total_bytes);
+    exit(1);
+  }
+
+  auto text = reinterpret_cast<char*>(p);
+  size_t len = 0;
+  while (len + 16 <= total_bytes) {
+    len += sprintf(&text[len], "%08x line\n", rand());
+  }
+  memset(&text[len], '\n', total_bytes - len);
+
+  auto [ tick_start, timer_freq ] = SyscallGetCurrentTick();
+  const size_t sent = WriteAll(text, total_bytes);
+  PrintThroughput("wrote", sent, ElapsedMs(tick_start, timer_freq));
+}
+
+extern "C" void main(int argc, char** argv) {
+  const size_t mib = argc >= 3 ? atoi(argv[2]) : 16;
+
+  if (argc >= 2 && strcmp(argv[1], "write") == 0) {
+    Write(mib * 1024 * 1024, argc >= 4 && strcmp(argv[3], "copy") == 0);
+  } else if (argc >= 2 && strcmp(argv[1], "read") == 0) {
+    Read();
+  } else if (argc >= 2 && strcmp(argv[1], "text") == 0) {
+    Text(mib * 1024 * 1024);
+  } else {
+    fprintf(stderr, "Usage: %s write <MiB> [copy] | %s read\n", argv[0], argv[0]);
+    fprintf(stderr, "       %s text <MiB> | sort\n", argv[0]);
+    exit(1);
+  }
+  exit(0);
+}
@@ -0,0 +1,83 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "../sync.h"
+#include "../syscall.h"
+
+// 使い方:
+//   psort <count> [threads]
+//
+// count個の乱数を threads 個のスレッドで分担してソートし, 最後に最初のスレッドが併合する.
+// スレッド数を1にした場合と時間を比べる.
+static const int kMaxThreads = 16;
+
+struct Chunk {
+  int* begin;
+  int* end;
+};
+
+int SortChunk(void* arg) {
+  auto chunk = reinterpret_cast<Chunk*>(arg);
+  std::sort(chunk->begin, chunk->end);
+  return 0;
+}
+
+extern "C" void main(int argc, char** argv) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <count> [threads]\n", argv[0]);
+    exit(1);
+  }
+
+  const size_t count = atol(argv[1]);
+  const int num_threads = std::clamp(argc >= 3 ? atoi(argv[2]) : 4, 1, kMaxThreads);
+
+  auto data = reinterpret_cast<int*>(malloc(sizeof(int) * count));
+  if (data == nullptr) {
+    fprintf(stderr, "failed to allocate %lu ints\n", count);
+    exit(1);
+  }
+  for (size_t i = 0; i < count; ++i) {
+    data[i] = rand();
+  }
+
+  Chunk chunks[kMaxThreads];
+  for (int i = 0; i < num_threads; ++i) {
+    chunks[i] = { data + count * i / num_threads,
+                  data + count * (i + 1) / num_threads };
+  }
+
+  auto [ tick_start, timer_freq ] = SyscallGetCurrentTick();
+
+  // 最初のチャンクは自分でソートする
+  uint64_t thread_ids[kMaxThreads];
+  for (int i = 1; i < num_threads; ++i) {
+    if (int err = ThreadCreate(&thread_ids[i], SortChunk, &chunks[i])) {
+      fprintf(stderr, "ThreadCreate failed: %s\n", strerror(err));
+      exit(1);
+    }
+  }
+  SortChunk(&chunks[0]);
+  for (int i = 1; i < num_threads; ++i) {
+    ThreadJoin(thread_ids[i], nullptr);
+  }
+
+  const uint64_t tick_sorted = SyscallGetCurrentTick().value;
+
+  for (int i = 1; i < num_threads; ++i) {
+    std::inplace_merge(data, chunks[i].begin, chunks[i].end);
+  }
+
+  const uint64_t tick_end = SyscallGetCurrentTick().value;
+
+  printf("sorted %lu ints with %d threads in %lu ms (merge %lu ms)\n",
+         count, num_threads,
+         (tick_end - tick_start) * 1000 / timer_freq,
+         (tick_end - tick_sorted) * 1000 / timer_freq);
+
+  if (!std::is_sorted(data, data + count)) {
+    printf("result is not sorted\n");
+    exit(1);
+  }
+  exit(0);
+}
@@ -0,0 +1,89 @@
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include "../syscall.h"
+
+// 使い方:
+//   pipebench text 8 > big.txt
+//   randread big.txt [seq]
+//
+// ファイルをマップし, 全てのページを1回ずつランダムな順に（seqなら先頭から順に）読む.
+// ページフォルトごとにカーネルがファイル内の位置からクラスタを求めるので,
+// 大きなファイルでの位置からクラスタへの変換の速さを比べられる.
+static const size_t kPageBytes = 4096;
+
+uint64_t xorshift_state = 88172645463325252ul;
+
+uint64_t Random() {
+  xorshift_state ^= xorshift_state << 13;
+  xorshift_state ^= xorshift_state >> 7;
+  xorshift_state ^= xorshift_state << 17;
+  return xorshift_state;
+}
+
+extern "C" void main(int argc, char** argv) {
+  if (argc < 2) {
+    printf("Usage: %s <file> [seq]\n", argv[0]);
+    exit(1);
+  }
+
+  const bool sequential = argc >= 3 && strcmp(argv[2], "seq") == 0;
+
+  SyscallResult res = SyscallOpenFile(argv[1], O_RDONLY);
+
+  if (res.error) {
+    fprintf(stderr, "failed to open %s: %d\n", argv[1], res.error);
+    exit(1);
+  }
+
+  const int fd = res.value;
+  size_t file_size;
+  res = SyscallMapFile(fd, &file_size, MAPFILE_RANDOM);
+
+  if (res.error) {
+    fprintf(stderr, "failed to map %s: %d\n", argv[1], res.error);
+    exit(1);
+  }
+
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(res.value);
+  const size_t num_pages = (file_size + kPageBytes - 1) / kPageBytes;
+
+  // ページ番号の並びをFisher-Yatesで混ぜる
+  auto order = reinterpret_cast<uint32_t*>(malloc(num_pages * sizeof(uint32_t)));
+  for (size_t i = 0; i < num_pages; i++) {
+    order[i] = i;
+  }
+  if (!sequential) {
+    for (size_t i = num_pages; i > 1; i--) {
+      const size_t j = Random() % i;
+      const uint32_t tmp = order[i - 1];
+      order[i - 1] = order[j];
+      order[j] = tmp;
+    }
+  }
+
+  const uint64_t faults_start = SyscallGetPageFaultCount().value;
+  auto [tick_start, timer_freq] = SyscallGetCurrentTick();
+
+  uint64_t sum = 0;
+  for (size_t i = 0; i < num_pages; i++) {
+    sum += p[order[i] * kPageBytes];
+  }
+
+  auto tick_end = SyscallGetCurrentTick();
+  const uint64_t faults = SyscallGetPageFaultCount().value - faults_start;
+  const uint64_t elapsed_ms = (tick_end.value - tick_start) * 1000 / timer_freq;
+
+  printf("sum = %lu (%lu pages, %s)\n",
+         sum, num_pages, sequential ? "sequential" : "random");
+  printf(
+    "%lu faults, %lu ms, %lu us/page\n",
+    faults,
+    elapsed_ms,
+    num_pages ? elapsed_ms * 1000 / num_pages : 0
+  );
+
+  free(order);
+  exit(0);
+}
@@ -0,0 +1,127 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include "../syscall.h"
+
+static constexpr size_t kChunkBytes = 256;
+static constexpr uint32_t kEntries = 64;
+
+uint64_t ElapsedMs(uint64_t tick_start) {
+  auto [tick_end, timer_freq] = SyscallGetCurrentTick();
+  return (tick_end - tick_start) * 1000 / timer_freq;
+}
+
+int OpenOrExit(const char* path) {
+  auto [fd, err] = SyscallOpenFile(path, O_RDONLY);
+  if (err) {
+    fprintf(stderr, "%s: %s\n", strerror(err), path);
+    exit(1);
+  }
+  return fd;
+}
+
+uint64_t Sum(const uint8_t* buf, size_t len) {
+  uint64_t sum = 0;
+  for (size_t i = 0; i < len; i++) {
+    sum += buf[i];
+  }
+  return sum;
+}
+
+// 1回のReadFileで1チャンクずつ読む
+uint64_t ReadBySyscalls(const char* path, size_t& total) {
+  const int fd = OpenOrExit(path);
+  uint8_t buf[kChunkBytes];
+  uint64_t sum = 0;
+  total = 0;
+
+  while (true) {
+    auto [n, err] = SyscallReadFile(fd, buf, sizeof(buf));
+    if (err || n == 0) {
+      break;
+    }
+    sum += Sum(buf, n);
+    total += n;
+  }
+
+  return sum;
+}
+
+// 入出力リングに読み込みを溜めておき, 1回のIoRingEnterでまとめて処理させる
+uint64_t ReadByRing(IoRing* ring, const char* path, size_t& total) {
+  const int fd = OpenOrExit(path);
+  auto sq = reinterpret_cast<IoRingSubmission*>(
+      reinterpret_cast<uint8_t*>(ring) + ring->sq_offset);
+  auto cq = reinterpret_cast<IoRingCompletion*>(
+      reinterpret_cast<uint8_t*>(ring) + ring->cq_offset);
+  static uint8_t bufs[kEntries][kChunkBytes];
+  uint64_t sum = 0;
+  total = 0;
+
+  for (bool eof = false; !eof; ) {
+    uint32_t tail = ring->sq_tail;
+    for (uint32_t i = 0; i < kEntries; i++, tail++) {
+      sq[tail & (ring->sq_entries - 1)] = IoRingSubmission{
+        IoRingSubmission::kRead, 0, {uint64_t(fd), uint64_t(bufs[i]), kChunkBytes}, i
+      };
+    }
+    __atomic_store_n(&ring->sq_tail, tail, __ATOMIC_RELEASE);
+    SyscallIoRingEnter(kEntries, 0);
+
+    uint32_t head = ring->cq_head;
+    const uint32_t cq_tail = __atomic_load_n(&ring->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != cq_tail; head++) {
+      const auto& cqe = cq[head & (ring->cq_entries - 1)];
+      if (cqe.error || cqe.value == 0) {
+        eof = true;
+        continue;
+      }
+      sum += Sum(bufs[cqe.user_data], cqe.value);
+      total += cqe.value;
+    }
+    __atomic_store_n(&ring->cq_head, head, __ATOMIC_RELEASE);
+  }
+
+  return sum;
+}
+
+extern "C" void main(int argc, char** argv) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <file>\n", argv[0]);
+    exit(1);
+  }
+
+  auto [ring_addr, err] = SyscallIoRingSetup(kEntries, kEntries);
+  if (err) {
+    fprintf(stderr, "IoRingSetup failed: %s\n", strerror(err));
+    exit(1);
+  }
+  auto ring = reinterpret_cast<IoRing*>(ring_addr);
+
+  size_t total;
+  auto tick_start = SyscallGetCurrentTick().value;
+  const uint64_t sum_syscall = ReadBySyscalls(argv[1], total);
+  const uint64_t syscall_ms = ElapsedMs(tick_start);
+  printf("ReadFile x %lu: sum = %lu, %lu ms\n",
+         (total + kChunkBytes - 1) / kChunkBytes, sum_syscall, syscall_ms);
+
+  tick_start = SyscallGetCurrentTick().value;
+  const uint64_t sum_ring = ReadByRing(ring, argv[1], total);
+  const uint64_t ring_ms = ElapsedMs(tick_start);
+  printf("io ring (%u per enter): sum = %lu, %lu ms\n",
+         kEntries, sum_ring, ring_ms);
+
+  // タイムアウト操作の完了を待つ
+  auto sq = reinterpret_cast<IoRingSubmission*>(
+      reinterpret_cast<uint8_t*>(ring) + ring->sq_offset);
+  sq[ring->sq_tail & (ring->sq_entries - 1)] = IoRingSubmission{
+    IoRingSubmission::kTimeout, 0, {100, 0, 0}, 0
+  };
+  __atomic_store_n(&ring->sq_tail, ring->sq_tail + 1, __ATOMIC_RELEASE);
+  tick_start = SyscallGetCurrentTick().value;
+  SyscallIoRingEnter(1, 1);
+  printf("100 ms timeout completed after %lu ms\n", ElapsedMs(tick_start));
+
+  exit(sum_syscall == sum_ring ? 0 : 1);
+}
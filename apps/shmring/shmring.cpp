@@ -0,0 +1,132 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "../syscall.h"
+
+// 使い方:
+//   shmring produce <MiB> | shmring consume
+//
+// 2つのアプリが名前付き共有メモリ上のリングバッファでデータを受け渡す.
+// パイプは2つを同時に動かすためだけに使い, データは通さない.
+// 満杯や空のときはFutexWait/FutexWakeで待ち合わせるので, 複製もポーリングもしない.
+static const char kName[] = "shmring";
+static const uint32_t kNumSlots = 16;
+static const size_t kSlotBytes = 64 * 1024;
+
+struct Ring {
+  uint32_t head;      // 書き終えたスロットの累計. 消費側はこれで待つ
+  uint32_t tail;      // 読み終えたスロットの累計. 生産側はこれで待つ
+  uint32_t total;     // 生産側が書くスロットの総数. 最初のスロットより先に設定する
+  alignas(4096) char slots[kNumSlots][kSlotBytes];
+};
+
+uint32_t Load(uint32_t* p) {
+  return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+void Store(uint32_t* p, uint32_t v) {
+  __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+// 先に起動した方が作り, 後の方は開く
+Ring* MapRing() {
+  auto res = SyscallShmCreate(kName, sizeof(Ring));
+  if (res.error == EEXIST) {
+    res = SyscallShmOpen(kName);
+  }
+  if (res.error) {
+    fprintf(stderr, "%s: %s\n", strerror(res.error), kName);
+    exit(1);
+  }
+
+  auto map = SyscallShmMap(res.value, nullptr);
+  if (map.error) {
+    fprintf(stderr, "ShmMap failed: %s\n", strerror(map.error));
+    exit(1);
+  }
+  return reinterpret_cast<Ring*>(map.value);
+}
+
+void PrintThroughput(const char* what, size_t bytes, uint64_t elapsed_ms) {
+  fprintf(stderr, "%s %lu bytes in %lu ms", what, bytes, elapsed_ms);
+
+  if (elapsed_ms > 0) {
+    const uint64_t kib_per_s = bytes / 1024 * 1000 / elapsed_ms;
+    fprintf(stderr, ", %lu.%lu MiB/s",
+            kib_per_s / 1024, kib_per_s * 10 / 1024 % 10);
+  }
+
+  fprintf(stderr, "\n");
+}
+
+void Produce(Ring* ring, uint32_t total) {
+  Store(&ring->total, total);
+
+  auto [ tick_start, timer_freq ] = SyscallGetCurrentTick();
+  for (uint32_t i = 0; i < total; ++i) {
+    uint32_t tail;
+    while (i - (tail = Load(&ring->tail)) == kNumSlots) {
+      SyscallFutexWait(&ring->tail, tail, 0);
+    }
+
+    memset(ring->slots[i % kNumSlots], i & 0xff, kSlotBytes);
+    Store(&ring->head, i + 1);
+    SyscallFutexWake(&ring->head, 1);
+  }
+
+  const uint64_t elapsed_ms =
+    (SyscallGetCurrentTick().value - tick_start) * 1000 / timer_freq;
+  PrintThroughput("produced", total * kSlotBytes, elapsed_ms);
+}
+
+void Consume(Ring* ring) {
+  uint64_t tick_start = 0, timer_freq = 1;
+  uint32_t i = 0, num_corrupted = 0;
+
+  while (true) {
+    uint32_t head;
+    while ((head = Load(&ring->head)) == i) {
+      SyscallFutexWait(&ring->head, head, 0);
+    }
+    if (i == 0) {
+      const auto tick = SyscallGetCurrentTick();
+      tick_start = tick.value;
+      timer_freq = tick.error;
+    }
+
+    const char* slot = ring->slots[i % kNumSlots];
+    const char expected = i & 0xff;
+    if (slot[0] != expected || slot[kSlotBytes - 1] != expected) {
+      ++num_corrupted;
+    }
+
+    Store(&ring->tail, ++i);
+    SyscallFutexWake(&ring->tail, 1);
+
+    if (i == Load(&ring->total)) {
+      break;
+    }
+  }
+
+  const uint64_t elapsed_ms =
+    (SyscallGetCurrentTick().value - tick_start) * 1000 / timer_freq;
+  PrintThroughput("consumed", i * kSlotBytes, elapsed_ms);
+  if (num_corrupted > 0) {
+    fprintf(stderr, "%u corrupted slots\n", num_corrupted);
+  }
+}
+
+extern "C" void main(int argc, char** argv) {
+  const size_t mib = argc >= 3 ? atoi(argv[2]) : 64;
+
+  if (argc >= 2 && strcmp(argv[1], "produce") == 0 && mib > 0) {
+    Produce(MapRing(), mib * 1024 * 1024 / kSlotBytes);
+  } else if (argc >= 2 && strcmp(argv[1], "consume") == 0) {
+    Consume(MapRing());
+  } else {
+    fprintf(stderr, "Usage: %s produce <MiB> | %s consume\n", argv[0], argv[0]);
+    exit(1);
+  }
+  exit(0);
+}
@@ -0,0 +1,45 @@
+// スレッドと, FutexWait/FutexWakeによる待ち合わせの部品. 実体は newlib_support.c にある.
+//
+// Mutex, CondVarは0で初期化すれば使える. 共有メモリに置けば別のアプリとも待ち合わせられる.
+
+#pragma once
+
+#ifdef __cplusplus
+#include <cstdint>
+
+extern "C" {
+#else
+#include <stdint.h>
+#endif
+
+  struct Mutex {
+    uint32_t state; // 0: 空き, 1: 確保中, 2: 確保中で待っているものがいるかもしれない
+  };
+
+  struct CondVar {
+    uint32_t seq; // 起こすたびに増える
+  };
+
+  void MutexLock(struct Mutex* m);
+  // 確保できなければ待たずに0を返す
+  int MutexTryLock(struct Mutex* m);
+  void MutexUnlock(struct Mutex* m);
+
+  // mを手放して起こされるのを待ち, 戻る前にmを確保し直す.
+  // 起こされなくても戻ることがあるので, 呼び出し側は条件を確かめ直すこと
+  void CondWait(struct CondVar* cv, struct Mutex* m);
+  // CondWaitと同じ. timeout_ms経っても起こされなければETIMEDOUTを返す
+  int CondTimedWait(struct CondVar* cv, struct Mutex* m, unsigned long timeout_ms);
+  void CondSignal(struct CondVar* cv);
+  void CondBroadcast(struct CondVar* cv);
+
+  // funcをargを引数として新しいスレッドで実行し, *thread_idにスレッドIDを書く.
+  // funcの戻り値がスレッドの終了コードになる. 成功すれば0, 失敗すればエラー番号を返す.
+  // 最初のスレッドが作られてから, mallocなどのヒープ操作はスレッド間で排他される
+  int ThreadCreate(uint64_t* thread_id, int (*func)(void*), void* arg);
+  // スレッドの終了を待つ. exit_codeがNULLでなければ終了コードを書く
+  int ThreadJoin(uint64_t thread_id, int* exit_code);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -1,3 +1,5 @@
+; tools/makesyscall.py が kernel/syscalls.txt から生成する. 直接編集しないこと
+
 bits 64
 section .text
 
@@ -26,3 +28,23 @@ define_syscall OpenFile,            0x8000000c
 define_syscall ReadFile,            0x8000000d
 define_syscall DemandPages,         0x8000000e
 define_syscall MapFile,             0x8000000f
+define_syscall Munmap,              0x80000010
+define_syscall Mprotect,            0x80000011
+define_syscall GetPageFaultCount,   0x80000012
+define_syscall WinDrawBatch,        0x80000013
+define_syscall MapWindowBuffer,     0x80000014
+define_syscall WinDamage,           0x80000015
+define_syscall WinBlit,             0x80000016
+define_syscall IoRingSetup,         0x80000017
+define_syscall IoRingEnter,         0x80000018
+define_syscall ReadEventEx,         0x80000019
+define_syscall ShmCreate,           0x8000001a
+define_syscall ShmOpen,             0x8000001b
+define_syscall ShmMap,              0x8000001c
+define_syscall ShmUnmap,            0x8000001d
+define_syscall FutexWait,           0x8000001e
+define_syscall FutexWake,           0x8000001f
+define_syscall ThreadCreate,        0x80000020
+define_syscall ThreadExit,          0x80000021
+define_syscall ThreadJoin,          0x80000022
+define_syscall ThreadSelf,          0x80000023
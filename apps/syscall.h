@@ -10,74 +10,33 @@ extern "C" {
 
 #include "../kernel/logger.hpp"
 #include "../kernel/app_event.hpp"
+#include "../kernel/app_io_ring.hpp"
+#include "../kernel/draw_command.hpp"
+#include "../kernel/window_buffer.hpp"
 
   struct SyscallResult {
     uint64_t value;
     int error;
   };
 
-  struct SyscallResult SyscallLogString(enum LogLevel level,
-                                        const char* message);
-
-  struct SyscallResult SyscallPutString(int fd,
-                                        const char* s,
-                                        size_t len);
-
-  void SyscallExit(int exit_code);
-
-  struct SyscallResult SyscallOpenWindow(int w,
-                                         int h,
-                                         int x,
-                                         int y,
-                                         const char* title);
-
   #define LAYER_NO_REDRAW (0x00000001ull << 32)
 
-  struct SyscallResult SyscallWinWriteString(uint64_t layer_id_flags,
-                                             int x,
-                                             int y,
-                                             uint32_t color,
-                                             const char* s);
-
-  struct SyscallResult SyscallWinFillRectangle(uint64_t layer_id_flags,
-                                               int x,
-                                               int y,
-                                               int w,
-                                               int h,
-                                               uint32_t color);
-
-  struct SyscallResult SyscallGetCurrentTick();
-
-  struct SyscallResult SyscallWinRedraw(uint64_t layer_id_flags);
-
-  struct SyscallResult SyscallWinDrawLine(uint64_t layer_id_flags,
-                                          int x0,
-                                          int y0,
-                                          int x1,
-                                          int y1,
-                                          uint32_t color);
-
-  struct SyscallResult SyscallCloseWindow(uint64_t layer_id_flags);
-
-  struct SyscallResult SyscallReadEvent(struct AppEvent* events,
-                                        size_t len);
-
 #define TIMER_ONESHOT_REL 1
 #define TIMER_ONESHOT_ABS 0
 
-  struct SyscallResult SyscallOpenFile(const char* path,
-                                       int flags);
+#define MAPFILE_SEQUENTIAL 1
+#define MAPFILE_RANDOM     2
+#define MAPFILE_WILLNEED   4
 
-  struct SyscallResult SyscallReadFile(int fd,
-                                       void* buf,
-                                       size_t count);
+#ifndef PROT_READ
+#define PROT_READ 1
+#endif
+#ifndef PROT_WRITE
+#define PROT_WRITE 2
+#endif
 
-  struct SyscallResult SyscallDemandPages(size_t num_pages,
-                                          int flags);
+#include "syscall_proto.h"
 
-  struct SyscallResult SyscallMapFile(int fd,
-                                       size_t* file_size,
-                                       int flags);
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -0,0 +1,150 @@
+// tools/makesyscall.py が kernel/syscalls.txt から生成する. 直接編集しないこと
+// syscall.h の extern "C" の中から読み込まれる
+
+#define SYSCALL_ABI_VERSION 1
+
+  struct SyscallResult SyscallLogString(enum LogLevel level,
+                                        const char* message);
+
+  struct SyscallResult SyscallPutString(int fd,
+                                        const char* s,
+                                        size_t len);
+
+  void SyscallExit(int exit_code);
+
+  struct SyscallResult SyscallOpenWindow(int w,
+                                         int h,
+                                         int x,
+                                         int y,
+                                         const char* title);
+
+  struct SyscallResult SyscallWinWriteString(uint64_t layer_id_flags,
+                                             int x,
+                                             int y,
+                                             uint32_t color,
+                                             const char* s);
+
+  struct SyscallResult SyscallWinFillRectangle(uint64_t layer_id_flags,
+                                               int x,
+                                               int y,
+                                               int w,
+                                               int h,
+                                               uint32_t color);
+
+  struct SyscallResult SyscallGetCurrentTick();
+
+  struct SyscallResult SyscallWinRedraw(uint64_t layer_id_flags);
+
+  struct SyscallResult SyscallWinDrawLine(uint64_t layer_id_flags,
+                                          int x0,
+                                          int y0,
+                                          int x1,
+                                          int y1,
+                                          uint32_t color);
+
+  struct SyscallResult SyscallCloseWindow(uint64_t layer_id_flags);
+
+  struct SyscallResult SyscallReadEvent(struct AppEvent* events,
+                                        size_t len);
+
+  struct SyscallResult SyscallCreateTimer(unsigned int type,
+                                          int timer_value,
+                                          unsigned long timeout_ms);
+
+  struct SyscallResult SyscallOpenFile(const char* path,
+                                       int flags);
+
+  struct SyscallResult SyscallReadFile(int fd,
+                                       void* buf,
+                                       size_t count);
+
+  struct SyscallResult SyscallDemandPages(size_t num_pages,
+                                          int flags);
+
+  struct SyscallResult SyscallMapFile(int fd,
+                                      size_t* file_size,
+                                      int flags);
+
+  struct SyscallResult SyscallMunmap(void* addr,
+                                     size_t len);
+
+  // 書き込みの可否だけを変えられる. protにPROT_READが無ければEINVAL（PROT_NONEは未対応）
+  struct SyscallResult SyscallMprotect(void* addr,
+                                       size_t len,
+                                       int prot);
+
+  struct SyscallResult SyscallGetPageFaultCount();
+
+  struct SyscallResult SyscallWinDrawBatch(uint64_t layer_id_flags,
+                                           const void* cmds,
+                                           size_t bytes);
+
+  struct SyscallResult SyscallMapWindowBuffer(uint64_t layer_id_flags,
+                                              struct WindowBufferInfo* info);
+
+  struct SyscallResult SyscallWinDamage(uint64_t layer_id_flags,
+                                        int x,
+                                        int y,
+                                        int w,
+                                        int h);
+
+  struct SyscallResult SyscallWinBlit(uint64_t layer_id_flags,
+                                      const struct BlitImage* image,
+                                      int x,
+                                      int y,
+                                      int w,
+                                      int h);
+
+  struct SyscallResult SyscallIoRingSetup(uint32_t sq_entries,
+                                          uint32_t cq_entries);
+
+  // 完了キューの未読がmin_complete個になるまで待つ. 待つ対象はタイムアウト操作のみ
+  struct SyscallResult SyscallIoRingEnter(uint32_t to_submit,
+                                          uint32_t min_complete);
+
+  // 待ち方と受け取るイベントの種類を指定できるReadEvent. flagsはReadEventFlagsの論理和
+  struct SyscallResult SyscallReadEventEx(struct AppEvent* events,
+                                          size_t len,
+                                          unsigned int flags,
+                                          unsigned long timeout_ms,
+                                          uint32_t type_mask);
+
+  // sizeバイトの名前付き共有メモリを作って開く. 同名のものが残っていればEEXIST
+  struct SyscallResult SyscallShmCreate(const char* name,
+                                        size_t size);
+
+  // 名前付き共有メモリを開く. 開いた記述子とマップが全て無くなると共有メモリは消える
+  struct SyscallResult SyscallShmOpen(const char* name);
+
+  // 共有メモリの記述子fdの全体をマップする. sizeがNULLでなければ大きさを書く
+  struct SyscallResult SyscallShmMap(int fd,
+                                     size_t* size);
+
+  // ShmMapでマップした領域を外す. addrは領域内のどこでもよい
+  struct SyscallResult SyscallShmUnmap(void* addr);
+
+  // *addrがexpectedの間, FutexWakeされるかtimeout_ms（0なら無期限）経つまで待つ.
+  // 待ち合わせは物理アドレスで識別するので, 共有メモリなら別のアプリとも待ち合わせられる
+  struct SyscallResult SyscallFutexWait(uint32_t* addr,
+                                        uint32_t expected,
+                                        unsigned long timeout_ms);
+
+  // addrで待っているタスクを最大count個起こす. 起こした数を返す
+  struct SyscallResult SyscallFutexWake(uint32_t* addr,
+                                        size_t count);
+
+  // 同じアドレス空間, ファイル, メモリ領域を共有するスレッドを作り, スレッドIDを返す.
+  // entryは (0, arg) を引数として呼ばれ, 戻らずにThreadExitすること. stack_bytesが0なら64KiB
+  struct SyscallResult SyscallThreadCreate(void (*entry)(int, void*),
+                                           void* arg,
+                                           size_t stack_bytes);
+
+  // 呼び出したスレッドを終える. 最初のスレッドから呼ぶとExitと同じ.
+  // Exitはどのスレッドから呼んでも, 残りのスレッドも終わらせてアプリ全体を終える
+  void SyscallThreadExit(int exit_code);
+
+  // ThreadCreateで作ったスレッドの終了を待ち, 終了コードを返す. 1つのスレッドに1回だけ呼べる
+  struct SyscallResult SyscallThreadJoin(uint64_t thread_id);
+
+  // 呼び出したスレッドのIDを返す
+  struct SyscallResult SyscallThreadSelf();
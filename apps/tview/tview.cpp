@@ -18,7 +18,7 @@ std::tuple<int, char*, size_t> MapFile(const char* filepath) {
 
   const int fd = res.value;
   size_t filesize;
-  res = SyscallMapFile(fd, &filesize, 0);
+  res = SyscallMapFile(fd, &filesize, MAPFILE_SEQUENTIAL);
 
   if (res.error) {
     fprintf(stderr, "%s\n", strerror(res.error));
@@ -219,24 +219,33 @@ void DrawLines(const LinesType& lines,
 }
 
 std::tuple<bool, int> WaitEvent(int h) {
-  AppEvent events[1];
+  // キー入力はまとめて読み, 読み残しは次の呼び出しで返す
+  static AppEvent events[16];
+  static int num_events = 0, next_event = 0;
 
   while (true) {
-    auto [ n, err ] = SyscallReadEvent(events, 1);
-
-    if (err) {
-      fprintf(
-        stderr,
-        "ReadEvent failed: %s\n",
-        strerror(err)
-      );
-      return { false, 0 };
+    if (next_event == num_events) {
+      auto [ n, err ] = SyscallReadEventEx(
+        events, 16, 0, 0, APP_EVENT_MASK(AppEvent::kKeyPush));
+
+      if (err) {
+        fprintf(
+          stderr,
+          "ReadEvent failed: %s\n",
+          strerror(err)
+        );
+        return { false, 0 };
+      }
+      num_events = n;
+      next_event = 0;
+      continue;
     }
-    if (events[0].type == AppEvent::kQuit) {
+
+    const auto& ev = events[next_event++];
+    if (ev.type == AppEvent::kQuit) {
       return { true, 0 };
-    } else if (events[0].type == AppEvent::kKeyPush
-        && events[0].arg.keypush.press) {
-      return { false, events[0].arg.keypush.keycode };
+    } else if (ev.type == AppEvent::kKeyPush && ev.arg.keypush.press) {
+      return { false, ev.arg.keypush.keycode };
     }
   }
 }
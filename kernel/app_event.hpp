@@ -41,6 +41,20 @@ struct AppEvent {
   } arg;
 };
 
+/** @brief ReadEventExのflags. */
+enum ReadEventFlags {
+  kReadEventNonBlock = 1, // イベントが無ければ待たずに0個で戻る
+  kReadEventTimeout  = 2, // timeout_msミリ秒待ってもイベントが無ければ0個で戻る
+};
+
+/**
+ * @brief ReadEventExのtype_maskに指定するビット.
+ *
+ * 0を指定すると全種類を受け取る. 受け取らない種類のイベントはアプリへコピーせずに捨てる.
+ * kQuitは指定しなくても常に受け取る.
+ */
+#define APP_EVENT_MASK(type) (1u << (type))
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief IoRingSetupでアプリへマップされる入出力リングの先頭.
+ *
+ * 先頭からsq_offsetバイトの位置に投入キュー（IoRingSubmissionの配列）,
+ * cq_offsetバイトの位置に完了キュー（IoRingCompletionの配列）がある.
+ * 添字はいずれも折り返しを気にせず増やし続け, 要素数-1との論理積で配列の位置を得る.
+ *
+ * アプリは投入キューに書いてからsq_tailを, 完了キューを読んでからcq_headを進める.
+ * カーネルはIoRingEnterの中でsq_headとcq_tailを進める.
+ */
+struct IoRing {
+  uint32_t sq_head, sq_tail;
+  uint32_t cq_head, cq_tail;
+  uint32_t sq_entries, cq_entries; // いずれも2のべき乗
+  uint32_t sq_offset, cq_offset;
+};
+
+struct IoRingSubmission {
+  enum IoRingOp {
+    kNop,
+    kOpen,      // args: path, flags                  -> ファイルディスクリプタ
+    kRead,      // args: fd, buf, count               -> 読んだバイト数
+    kWrite,     // args: fd, buf, count               -> 書いたバイト数
+    kDrawBatch, // args: layer_id_flags, cmds, bytes  -> WinDrawBatchと同じ
+    kTimeout,   // args: ミリ秒                       -> その時間が経ったら完了する
+  } op;
+
+  uint32_t reserved;
+  uint64_t args[3];
+  uint64_t user_data; // 完了キューへそのまま返される
+};
+
+struct IoRingCompletion {
+  uint64_t user_data;
+  uint64_t value;
+  int error;
+  uint32_t reserved;
+};
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -96,6 +96,36 @@ GetCR3:
     mov rax, cr3
     ret
 
+global GetCR4   ; uint64_t GetCR4();
+GetCR4:
+    mov rax, cr4
+    ret
+
+global SetCR4   ; void SetCR4(uint64_t value);
+SetCR4:
+    mov cr4, rdi
+    ret
+
+global GetRFLAGS    ; uint64_t GetRFLAGS();
+GetRFLAGS:
+    pushfq
+    pop rax
+    ret
+
+global GetCPUID ; void GetCPUID(uint32_t leaf, uint32_t subleaf, uint32_t* regs);
+GetCPUID:
+    push rbx
+    mov r8, rdx
+    mov eax, edi
+    mov ecx, esi
+    cpuid
+    mov [r8], eax
+    mov [r8 + 4], ebx
+    mov [r8 + 8], ecx
+    mov [r8 + 12], edx
+    pop rbx
+    ret
+
 extern kernel_main_stack
 extern KernelMainNewStack
 
@@ -164,8 +194,12 @@ RestoreContext: ; void RestoreContext(void* task_context);
     mov cr3, rax
     mov rax, [rdi + 0x30]
     mov fs, ax
-    mov rax, [rdi + 0x38]
-    mov gs, ax
+    ; GSを再設定するとGSベース（CPULocal）が失われるので復帰しない
+
+    ; システムコール中のタスクから切り替わると, KERNEL_GS_BASEにはそのアプリのGSベースが
+    ; 入っている. 切り替え先がそのままアプリへ戻ってもよいよう, CPULocalへ戻しておく
+    mov ecx, 0xc0000102 ; IA32_KERNEL_GS_BASE
+    call SetCPULocalMSR
 
     mov rax, [rdi + 0x40]
     mov rbx, [rdi + 0x48]
@@ -237,6 +271,13 @@ IntHandlerLAPICTimer:  ; void IntHandlerLAPICTimer();
     push rbx
     push rax
 
+    ; アプリはGSをロードしてGSベースを書き換えられるので, アプリから来たら戻す
+    test qword [rbp + 0x10], 3 ; CS
+    jz .kernel_gs_base_ok
+    mov ecx, 0xc0000101 ; IA32_GS_BASE
+    call SetCPULocalMSR
+.kernel_gs_base_ok:
+
     mov ax, fs
     mov bx, gs
     mov rcx, cr3
@@ -289,12 +330,37 @@ WriteMSR:   ; void WriteMSR(uint32_t msr, uint64_t value);
     wrmsr
     ret
 
-extern GetCurrentTaskOSStackPointer
+extern cpu_local
+
+; SetCPULocalMSR: ecxで指定したMSRにCPULocalのアドレスを書く. rax, rdxを壊す
+SetCPULocalMSR:
+    mov rax, [cpu_local]
+    mov rdx, rax
+    shr rdx, 32
+    wrmsr
+    ret
 
 extern syscall_table
+extern syscall_table_size
+extern SyscallUnknown
+extern SyscallCheckKilled
+
+; CPULocal（cpu_local.hpp）のメンバの位置
+CPU_LOCAL_USER_RSP     equ 0
+CPU_LOCAL_OS_STACK_PTR equ 8
 
 global SyscallEntry
 SyscallEntry:   ; void SyscallEntry(void);
+    ; IA32_FMASKにより割り込み禁止で来る. OS用スタックへ切り替えるまでは
+    ; user_rsp を他のタスクに上書きされないよう割り込みを許可しない.
+    ; アプリ実行中のKERNEL_GS_BASEは常にCPULocalを指すので, アプリがGSを書き換えていても安全
+    swapgs
+    mov [gs:CPU_LOCAL_USER_RSP], rsp
+    mov rsp, [gs:CPU_LOCAL_OS_STACK_PTR]
+    mov rsp, [rsp]      ; OS用スタックポインタをセット
+    push qword [gs:CPU_LOCAL_USER_RSP]
+    sti
+
     push rbp
     push rcx    ; original RIP
     push r11    ; original RFLAGS
@@ -304,44 +370,53 @@ SyscallEntry:   ; void SyscallEntry(void);
     mov rcx, r10
     and eax, 0x7fffffff
     mov rbp, rsp
-
-    ; システムコールをOS用スタックで実行する為の準備
-    and rsp, 0xfffffffffffffff0
-    push rax
-    push rdx
-    cli
-    call GetCurrentTaskOSStackPointer
-    sti
-    mov rdx, [rsp + 0]  ; RDX アプリ用スタックからOS用スタックにコピー
-    mov [rax - 16], rdx
-    mov rdx, [rsp + 8]  ; RAX 同上
-    mov [rax - 8], rdx
-
-    lea rsp, [rax - 16] ; OS用スタックポインタをセット
-    pop rdx
-    pop rax
     and rsp, 0xfffffffffffffff0
 
+    cmp eax, [syscall_table_size]
+    jae .unknown
     call [syscall_table + 8 * eax]
     ; rbx, r12-r15 は callee-saved なので呼び出し側で保存しない
     ; rax は戻り値用なので呼び出し側で保存しない
 
+.return:
+    ; スレッドグループが終了させられていれば, アプリへ戻らずにExitと同様に終わる
+    push rax
+    push rdx
+    call SyscallCheckKilled
+    test rax, rax
+    jnz .exit
+    pop rdx
+    pop rax
+
     mov rsp, rbp
 
     pop rsi     ; システムコール番号を復帰
-    cmp esi, 0x80000002
+    cmp esi, 0x80000002 ; Exit
+    je  .exit
+    cmp esi, 0x80000021 ; ThreadExit
     je  .exit
 
     pop r11
     pop rcx
     pop rbp
+    cli
+    swapgs
+    pop rsp     ; アプリ用スタックに戻す
     o64 sysret
 
 .exit:
+    ; swapgsで戻すとアプリのGSベースがカーネルで使われてしまう.
+    ; KERNEL_GS_BASEにはアプリのGSベースが残っているので, CPULocalへ戻す
     mov rdi, rax
     mov esi, edx
+    mov ecx, 0xc0000102 ; IA32_KERNEL_GS_BASE
+    call SetCPULocalMSR
     jmp ExitApp
 
+.unknown:
+    call SyscallUnknown ; 範囲外の番号は ENOSYS を返す
+    jmp .return
+
 global ExitApp  ; void ExitApp(uint64_t rsp, int32_t ret_val);
 ExitApp:
     mov rsp, rdi
@@ -360,3 +435,57 @@ global InvalidateTLB    ; void InvalidateTLB(uint64_t addr);
 InvalidateTLB:
     invlpg [rdi]
     ret
+
+; アプリのメモリにアクセスする関数.
+; フォルトした命令の位置は user_access_fixups に登録され,
+; ページフォルトを解決できなければ対応する .fault に飛ばされる.
+
+extern user_copy_erms
+
+global CopyUserBytes    ; size_t CopyUserBytes(void* dst, const void* src, size_t n);
+CopyUserBytes:          ; 戻り値はコピーできなかったバイト数
+    mov rcx, rdx
+    cmp byte [user_copy_erms], 0
+    jne .bytes          ; ERMS があれば rep movsb だけで十分に速い
+    shr rcx, 3
+    and edx, 7
+.quads:
+    rep movsq
+    mov rcx, rdx
+.bytes:
+    rep movsb
+    xor eax, eax
+    ret
+.quads_fault:
+    lea rax, [rdx + rcx * 8]
+    ret
+.bytes_fault:
+    mov rax, rcx
+    ret
+
+global StrncpyUserBytes ; int64_t StrncpyUserBytes(char* dst, const char* src, size_t n);
+StrncpyUserBytes:       ; NULを含めて最大nバイトコピーし, コピーしたバイト数を返す. フォルトなら-1
+    xor eax, eax
+.loop:
+    cmp rax, rdx
+    je .done
+.load:
+    mov cl, [rsi + rax]
+    mov [rdi + rax], cl
+    inc rax
+    test cl, cl
+    jnz .loop
+.done:
+    ret
+.fault:
+    mov rax, -1
+    ret
+
+section .data
+
+global user_access_fixups
+user_access_fixups:     ; { フォルトする命令, 飛び先 } の組. { 0, 0 } で終わる
+    dq CopyUserBytes.quads, CopyUserBytes.quads_fault
+    dq CopyUserBytes.bytes, CopyUserBytes.bytes_fault
+    dq StrncpyUserBytes.load, StrncpyUserBytes.fault
+    dq 0, 0
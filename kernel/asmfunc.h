@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 
 extern "C" {
@@ -27,6 +28,14 @@ extern "C" {
 
   uint64_t GetCR3();
 
+  uint64_t GetCR4();
+
+  void SetCR4(uint64_t value);
+
+  uint64_t GetRFLAGS();
+
+  void GetCPUID(uint32_t leaf, uint32_t subleaf, uint32_t* regs);
+
   void SwitchContext(void* next_ctx, void* current_ctx);
 
   void RestoreContext(void* ctx);
@@ -49,4 +58,8 @@ extern "C" {
   void ExitApp(uint64_t rsp, int32_t ret_val);
 
   void InvalidateTLB(uint64_t addr);
+
+  size_t CopyUserBytes(void* dst, const void* src, size_t n);
+
+  int64_t StrncpyUserBytes(char* dst, const char* src, size_t n);
 }
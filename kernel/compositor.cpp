@@ -0,0 +1,216 @@
+#include "compositor.hpp"
+
+#include <algorithm>
+#include <limits>
+#include "asmfunc.h"
+#include "layer.hpp"
+#include "message.hpp"
+#include "task.hpp"
+
+namespace {
+  const int kFrameTimerValue = 1;
+  /** @brief 合成タスクのレベル. アプリ（レベル1）より先に, メインタスクより後に動く. */
+  const int kCompositorLevel = 2;
+
+  /** @brief 溜まっているダメージ. 割り込み禁止で操作する. */
+  std::array<Rectangle<int>, kMaxDamageRects> damage_rects;
+  int num_damage_rects = 0;
+  /** @brief 溜まっているダメージの元になった最も古い入力の時刻. 無ければ0. */
+  uint64_t damage_origin_tsc = 0;
+  /** @brief 次のフレームを合成してよい最初のタイマー値. */
+  unsigned long next_frame_tick = 0;
+  bool frame_timer_armed = false;
+  Task* compositor_task = nullptr;
+
+  long Area(const Rectangle<int>& r) {
+    return static_cast<long>(r.size.x) * r.size.y;
+  }
+
+  /** @brief aとbを両方含む最小の矩形. */
+  Rectangle<int> Bound(const Rectangle<int>& a, const Rectangle<int>& b) {
+    const auto pos = ElementMin(a.pos, b.pos);
+    const auto end = ElementMax(a.pos + a.size, b.pos + b.size);
+    return { pos, end - pos };
+  }
+
+  void MergeDamage(const Rectangle<int>& area) {
+    for (int i = 0; i < num_damage_rects; ++i) {
+      auto& r = damage_rects[i];
+      const auto bound = Bound(r, area);
+      // 別々に描くより画素が増えなければ1つにまとめる. 含まれる場合もここで吸収される
+      if (Area(bound) <= Area(r) + Area(area)) {
+        r = bound;
+        return;
+      }
+    }
+
+    if (num_damage_rects < kMaxDamageRects) {
+      damage_rects[num_damage_rects++] = area;
+      return;
+    }
+
+    int best = 0;
+    long best_growth = std::numeric_limits<long>::max();
+    for (int i = 0; i < num_damage_rects; ++i) {
+      const long growth = Area(Bound(damage_rects[i], area)) - Area(damage_rects[i]);
+      if (growth < best_growth) {
+        best = i;
+        best_growth = growth;
+      }
+    }
+    damage_rects[best] = Bound(damage_rects[best], area);
+  }
+
+  void RecordFrame(uint64_t cycles) {
+    const int bucket = 64 - __builtin_clzll(cycles | 1) - kFrameTimeShift;
+    ++frame_time[std::clamp(bucket, 0, kFrameTimeBuckets - 1)];
+  }
+
+  void TaskCompositor(uint64_t task_id, int64_t data) {
+    __asm__("cli");
+    auto& task = task_manager->CurrentTask();
+    __asm__("sti");
+
+    std::array<Rectangle<int>, kMaxDamageRects> rects;
+
+    while (true) {
+      __asm__("cli");
+
+      while (auto msg = task.ReceiveMessage()) {
+        if (msg->type == Message::kTimerTimeout
+            && msg->arg.timer.value == kFrameTimerValue) {
+          frame_timer_armed = false;
+        }
+      }
+
+      if (num_damage_rects == 0) {
+        task.Sleep();
+        __asm__("sti");
+        continue;
+      }
+
+      const auto now = timer_manager->CurrentTick();
+      if (now < next_frame_tick) {
+        // 前のフレームから間が無いので, ダメージを溜めたまま次のフレームを待つ
+        if (!frame_timer_armed) {
+          timer_manager->AddTimer(
+            Timer{ next_frame_tick, kFrameTimerValue, task_id }
+          );
+          frame_timer_armed = true;
+        }
+        task.Sleep();
+        __asm__("sti");
+        continue;
+      }
+
+      const int num_rects = num_damage_rects;
+      std::copy_n(damage_rects.begin(), num_rects, rects.begin());
+      num_damage_rects = 0;
+      const uint64_t origin_tsc = damage_origin_tsc;
+      damage_origin_tsc = 0;
+      next_frame_tick = now + kFrameTicks;
+      __asm__("sti");
+
+      // 割り込みを禁止するのは矩形1つの描画の間だけにする
+      const uint64_t frame_begin = __builtin_ia32_rdtsc();
+      uint64_t pixels = 0, max_cli_cycles = 0;
+      for (int i = 0; i < num_rects; ++i) {
+        __asm__("cli");
+        const uint64_t begin = __builtin_ia32_rdtsc();
+        layer_manager->Draw(rects[i]);
+        const uint64_t cycles = __builtin_ia32_rdtsc() - begin;
+        __asm__("sti");
+
+        pixels += Area(rects[i]);
+        max_cli_cycles = std::max(max_cli_cycles, cycles);
+      }
+      const uint64_t frame_cycles = __builtin_ia32_rdtsc() - frame_begin;
+
+      __asm__("cli");
+      ++compositor_stat.frames;
+      compositor_stat.rects += num_rects;
+      compositor_stat.pixels += pixels;
+      compositor_stat.max_cli_cycles = std::max(compositor_stat.max_cli_cycles,
+                                                max_cli_cycles);
+      RecordFrame(frame_cycles);
+      if (origin_tsc != 0) {
+        RecordKeyEcho(origin_tsc);
+      }
+      __asm__("sti");
+    }
+  }
+} // namespace
+
+CompositorStat compositor_stat;
+std::array<uint64_t, kFrameTimeBuckets> frame_time;
+
+void AddDamage(const Rectangle<int>& area, uint64_t origin_tsc) {
+  const auto clipped = area & Rectangle<int>{ {0, 0}, ScreenSize() };
+  if (clipped.size.x <= 0 || clipped.size.y <= 0) {
+    return;
+  }
+
+  // 割り込み禁止の文脈（システムコールのcli区間など）からも, タスクの文脈からも呼ばれる
+  const bool interrupt_enabled = GetRFLAGS() & (1u << 9);
+  __asm__("cli");
+
+  ++compositor_stat.damages;
+
+  if (compositor_task == nullptr) {
+    layer_manager->Draw(clipped);
+  } else {
+    const bool was_empty = num_damage_rects == 0;
+    MergeDamage(clipped);
+    if (origin_tsc != 0 && damage_origin_tsc == 0) {
+      damage_origin_tsc = origin_tsc;
+    }
+    // ダメージが既にあれば, 合成タスクは起きているかフレームのタイマーを待っている
+    if (was_empty) {
+      compositor_task->Wakeup();
+    }
+  }
+
+  if (interrupt_enabled) {
+    __asm__("sti");
+  }
+}
+
+void AddLayerDamage(unsigned int layer_id, uint64_t origin_tsc) {
+  AddLayerDamage(layer_id, { {0, 0}, {-1, -1} }, origin_tsc);
+}
+
+void AddLayerDamage(unsigned int layer_id,
+                    const Rectangle<int>& area,
+                    uint64_t origin_tsc) {
+  const bool interrupt_enabled = GetRFLAGS() & (1u << 9);
+  __asm__("cli");
+
+  Rectangle<int> window_area{ {0, 0}, {0, 0} };
+  if (auto layer = layer_manager->FindLayer(layer_id);
+      layer && layer->GetWindow()) {
+    window_area.pos = layer->GetPosition();
+    window_area.size = layer->GetWindow()->Size();
+    // 大きさが負なら, LayerManager::Draw(id) と同様にウィンドウ全体とする
+    if (area.size.x >= 0 || area.size.y >= 0) {
+      window_area = window_area & Rectangle<int>{
+        window_area.pos + area.pos,
+        area.size
+      };
+    }
+  }
+
+  if (interrupt_enabled) {
+    __asm__("sti");
+  }
+
+  AddDamage(window_area, origin_tsc);
+}
+
+void InitializeCompositor() {
+  __asm__("cli");
+  auto& task = task_manager->NewTask()
+    .InitContext(TaskCompositor, 0);
+  task_manager->Wakeup(&task, kCompositorLevel);
+  compositor_task = &task;
+  __asm__("sti");
+}
@@ -0,0 +1,60 @@
+/**
+ * @file compositor.hpp
+ *
+ * 画面の合成を専用のタスクで行う.
+ *
+ * 描画を求める側は再描画の必要な範囲（ダメージ）を登録するだけで戻る.
+ * 合成タスクは溜まったダメージを1フレームの間隔に高々1回, まとめて描画する.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include "graphics.hpp"
+#include "timer.hpp"
+
+/** @brief 合成の最短間隔（タイマー割り込みの回数）. 50fpsに相当する. */
+const int kFrameTicks = kTimerFreq / 50;
+
+/** @brief 溜めておくダメージの矩形の数の上限. 溢れたら近い矩形へまとめる. */
+const int kMaxDamageRects = 16;
+
+/** @brief frame_timeの区間iは [2^(kFrameTimeShift+i-1), 2^(kFrameTimeShift+i)) サイクル. */
+const int kFrameTimeShift = 16;
+const int kFrameTimeBuckets = 16;
+
+struct CompositorStat {
+  /** @brief ダメージの登録回数. */
+  uint64_t damages;
+  /** @brief 合成したフレーム数. */
+  uint64_t frames;
+  /** @brief 描画した矩形の数と画素数. */
+  uint64_t rects, pixels;
+  /** @brief 1つの矩形の描画で割り込みを禁止していた最長のサイクル数. */
+  uint64_t max_cli_cycles;
+};
+
+extern CompositorStat compositor_stat;
+/** @brief 1フレームの合成にかかったサイクル数のヒストグラム. */
+extern std::array<uint64_t, kFrameTimeBuckets> frame_time;
+
+/**
+ * @brief 画面座標の範囲areaを再描画の対象に加える.
+ *
+ * 割り込みの許可状態を問わず呼べる. 合成タスクが動く前は直ちに描画する.
+ *
+ * @param origin_tsc 元になった入力の時刻. 0でなければ, それを描画した時点で
+ *   入力から画面への反映までの遅延を key_echo_latency に数える
+ */
+void AddDamage(const Rectangle<int>& area, uint64_t origin_tsc = 0);
+
+/** @brief レイヤーのウィンドウ全体を再描画の対象に加える. */
+void AddLayerDamage(unsigned int layer_id, uint64_t origin_tsc = 0);
+
+/** @brief レイヤーのウィンドウ内の範囲area（ウィンドウ座標）を再描画の対象に加える. */
+void AddLayerDamage(unsigned int layer_id,
+                    const Rectangle<int>& area,
+                    uint64_t origin_tsc = 0);
+
+void InitializeCompositor();
@@ -1,5 +1,6 @@
 #include <cstring>
 
+#include "compositor.hpp"
 #include "console.hpp"
 #include "font.hpp"
 #include "layer.hpp"
@@ -35,7 +36,7 @@ void Console::PutString(const char* s) {
   }
 
   if (layer_manager) {
-    layer_manager->Draw(layer_id_);
+    AddLayerDamage(layer_id_);
   }
 }
 
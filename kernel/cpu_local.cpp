@@ -0,0 +1,21 @@
+#include "cpu_local.hpp"
+
+#include "asmfunc.h"
+#include "msr.hpp"
+
+CPULocal* cpu_local;
+
+void InitializeCPULocal() {
+  cpu_local = new CPULocal{};
+
+  // カーネル実行中はGS_BASE, アプリ実行中はKERNEL_GS_BASEがCPULocalを指すようにする.
+  // 割り込みハンドラはswapgsしないので, アプリから来たときはRestoreKernelGSBaseで,
+  // タスク切り替えではRestoreContextでそれぞれ戻す
+  const auto addr = reinterpret_cast<uint64_t>(cpu_local);
+  WriteMSR(kIA32_GS_BASE, addr);
+  WriteMSR(kIA32_KERNEL_GS_BASE, addr);
+}
+
+void RestoreKernelGSBase() {
+  WriteMSR(kIA32_GS_BASE, reinterpret_cast<uint64_t>(cpu_local));
+}
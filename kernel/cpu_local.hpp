@@ -0,0 +1,65 @@
+/**
+ * @file cpu_local.hpp
+ *
+ * GSレジスタから参照するCPUごとのデータ.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+class Task;
+
+/**
+ * @brief CPUごとのデータ. カーネル実行中はGSベースがこの構造体を指す.
+ *
+ * SyscallEntryがアセンブリから参照するので, メンバの位置を変えたら
+ * asmfunc.asm の CPU_LOCAL_* も合わせて変更すること.
+ */
+struct CPULocal {
+  /** @brief SyscallEntryがOS用スタックへ切り替える間, アプリのRSPを退避する場所. */
+  uint64_t user_rsp;
+  /** @brief 実行中のタスクのOS用スタックポインタ（Task::OSStackPointer）を指す. */
+  uint64_t* os_stack_ptr;
+  /** @brief 実行中のタスク. */
+  Task* current_task;
+};
+
+static_assert(offsetof(CPULocal, user_rsp) == 0);
+static_assert(offsetof(CPULocal, os_stack_ptr) == 8);
+static_assert(offsetof(CPULocal, current_task) == 16);
+
+extern CPULocal* cpu_local;
+
+/**
+ * @brief CPULocalを確保し, GSベースに設定する.
+ *
+ * セグメントレジスタの設定（InitializeSegmentation）より後に呼ぶこと.
+ * GSを再設定するとGSベースが失われる.
+ */
+void InitializeCPULocal();
+
+/**
+ * @brief GSベースをCPULocalへ戻す.
+ *
+ * アプリはGSをロードしてGSベースを書き換えられる. 割り込みハンドラはswapgsしないので,
+ * アプリ実行中の割り込みや例外では, GSを使う前にこれを呼ぶこと.
+ */
+void RestoreKernelGSBase();
+
+/**
+ * @brief 実行中のタスクを返す.
+ *
+ * GSベース経由で読むので, TaskManager::CurrentTaskと違い割り込みを禁止せずに呼べる.
+ * 実行中のタスクから見た値は, タスクが切り替わっても変わらない.
+ */
+inline Task& CurrentTask() {
+  Task* task;
+  __asm__ volatile(
+    "mov %%gs:%c1, %0"
+    : "=r"(task)
+    : "i"(offsetof(CPULocal, current_task))
+  );
+  return *task;
+}
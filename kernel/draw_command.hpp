@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief WinDrawBatchに渡す描画コマンド.
+ *
+ * コマンドはバッファ内に隙間なく並べる. sizeはコマンド自身と後続データの合計バイト数で,
+ * 4の倍数に切り上げておく. 次のコマンドはsizeバイト後ろから始まる.
+ * 座標はいずれもウィンドウの左上を原点とし, 色は0xRRGGBB.
+ */
+struct DrawCommand {
+  enum DrawCommandType {
+    kFill,
+    kLine,
+    kText, // 直後にlen文字が続く（NUL終端は不要）
+    kBlit, // 直後に幅w×高さhの色（uint32_t）が行順に続く
+  } type;
+
+  uint32_t size;
+
+  union {
+    struct {
+      int x, y, w, h;
+      uint32_t color;
+    } fill;
+
+    struct {
+      int x0, y0, x1, y1;
+      uint32_t color;
+    } line;
+
+    struct {
+      int x, y;
+      uint32_t color;
+      int len;
+    } text;
+
+    struct {
+      int x, y, w, h;
+    } blit;
+
+  } arg;
+};
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
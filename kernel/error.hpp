@@ -35,6 +35,9 @@ class Error {
       kIsDirectory,
       kNoSuchEntry,
       kFreeTypeError,
+      kInvalidAddress,
+      kValueMismatch,
+      kTimeout,
       kLastOfCode, // 常に最後に
     };
 
@@ -69,6 +72,9 @@ class Error {
       "kIsDirectory",
       "kNoSuchEntry",
       "kFreeTypeError",
+      "kInvalidAddress",
+      "kValueMismatch",
+      "kTimeout",
     };
     static_assert(Error::Code::kLastOfCode == code_names_.size());
 
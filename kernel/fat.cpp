@@ -1,23 +1,39 @@
 #include <algorithm>
+#include <array>
 #include <cctype>
 #include <cstring>
 #include <utility>
+#include <vector>
 #include "fat.hpp"
+#include "asmfunc.h"
+#include "page_cache.hpp"
 
 namespace {
 
+  /**
+   * @brief パスの先頭の要素を, ディレクトリエントリと同じ11バイトの8+3形式にする.
+   *
+   * @return 次の要素の先頭（スラッシュが無ければnullptr）と, スラッシュがあったかどうか
+   */
   std::pair<const char*, bool> NextPathElement(const char* path,
-                                               char* path_elem) {
+                                               unsigned char* name83) {
     const char* next_slash = strchr(path, '/');
+    const size_t elem_len = next_slash ? next_slash - path : strlen(path);
+
+    memset(name83, 0x20, 11);
+    int i83 = 0;
+
+    for (size_t i = 0; i < elem_len && i83 < 11; i++, i83++) {
+      if (path[i] == '.') {
+        i83 = 7;
+        continue;
+      }
+      name83[i83] = toupper(path[i]);
+    }
 
     if (next_slash == nullptr) {
-      strcpy(path_elem, path);
       return { nullptr, false };
     }
-
-    const auto elem_len = next_slash - path;
-    strncpy(path_elem, path, elem_len);
-    path_elem[elem_len] = '\0';
     return { &next_slash[1], true };
   }
 
@@ -83,6 +99,103 @@ namespace fat {
     return next;
   }
 
+  namespace {
+    /**
+     * @brief (ディレクトリの開始クラスタ, 8+3形式の名前) からエントリを引くキャッシュ.
+     *
+     * ハッシュで1つの枠に振り分け, 衝突したら上書きする. 見つからなかったこともnullptrとして覚える.
+     * エントリは移動しないので, 無効にするのはディレクトリにエントリが増えうるときだけでよい.
+     * その際は世代を進めて全ての枠をまとめて捨てる.
+     */
+    struct DentryCacheSlot {
+      uint64_t generation;
+      unsigned long dir_cluster;
+      unsigned char name[11];
+      DirectoryEntry* entry;
+    };
+
+    const int kDentryCacheBits = 10;
+    std::array<DentryCacheSlot, 1 << kDentryCacheBits> dentry_cache;
+    uint64_t dentry_generation = 1;
+
+    DentryCacheSlot& DentrySlot(unsigned long dir_cluster,
+                                const unsigned char* name83) {
+      uint64_t h = 0xcbf2'9ce4'8422'2325 ^ dir_cluster;
+      for (int i = 0; i < 11; i++) {
+        h = (h ^ name83[i]) * 0x100'0000'01b3;
+      }
+      return dentry_cache[h >> (64 - kDentryCacheBits)];
+    }
+
+    /**
+     * @brief ディレクトリから8+3形式の名前のエントリを探す. 無ければnullptr.
+     *
+     * 枠は複数のタスクから使われるので, 枠を確かめるのと書き込むのは割り込み禁止で行う.
+     * ディレクトリの探索は割り込みを許して行い, 探索前の世代で書き込むので,
+     * 探索中に無効化されていれば書き込んだ枠は使われない.
+     * 割り込みの許可状態を問わず呼べる（起動中のフォントの読み込みなど）.
+     */
+    DirectoryEntry* LookupEntry(unsigned long dir_cluster,
+                                const unsigned char* name83) {
+      const bool interrupt_enabled = GetRFLAGS() & (1u << 9);
+      __asm__("cli");
+      auto& slot = DentrySlot(dir_cluster, name83);
+      const uint64_t generation = dentry_generation;
+      if (slot.generation == generation
+          && slot.dir_cluster == dir_cluster
+          && memcmp(slot.name, name83, 11) == 0) {
+        ++lookup_stat.hits;
+        auto entry = slot.entry;
+        if (interrupt_enabled) {
+          __asm__("sti");
+        }
+        return entry;
+      }
+      ++lookup_stat.misses;
+      if (interrupt_enabled) {
+        __asm__("sti");
+      }
+
+      DirectoryEntry* found = nullptr;
+      for (auto c = dir_cluster; c != kEndOfClusterchain && !found; ) {
+        auto dir = GetSectorByCluster<DirectoryEntry>(c);
+        for (int i = 0; i < bytes_per_cluster / sizeof(DirectoryEntry); i++) {
+          if (dir[i].name[0] == 0x00) {
+            c = kEndOfClusterchain;
+            break;
+          } else if (memcmp(dir[i].name, name83, 11) == 0) {
+            found = &dir[i];
+            break;
+          }
+        }
+        if (!found && c != kEndOfClusterchain) {
+          c = NextCluster(c);
+        }
+      }
+
+      __asm__("cli");
+      slot.generation = generation;
+      slot.dir_cluster = dir_cluster;
+      memcpy(slot.name, name83, 11);
+      slot.entry = found;
+      if (interrupt_enabled) {
+        __asm__("sti");
+      }
+      return found;
+    }
+
+    void InvalidateDentryCache() {
+      const bool interrupt_enabled = GetRFLAGS() & (1u << 9);
+      __asm__("cli");
+      ++dentry_generation;
+      if (interrupt_enabled) {
+        __asm__("sti");
+      }
+    }
+  } // namespace
+
+  LookupStat lookup_stat;
+
   std::pair<DirectoryEntry*, bool>
   FindFile(const char* path,
            unsigned long directory_cluster) {
@@ -90,52 +203,34 @@ namespace fat {
     if (path[0] == '/') {
       directory_cluster = boot_volume_image->root_cluster;
       path++;
-    } else if (directory_cluster == 0) {
-      directory_cluster = boot_volume_image->root_cluster;
     }
 
-    char path_elem[13];
-    const auto [ next_path, post_slash ] = NextPathElement(path, path_elem);
-    const bool path_last = next_path == nullptr || next_path[0] == '\0';
+    while (true) {
+      if (directory_cluster == 0) {
+        // ルートディレクトリを指す ".." などは開始クラスタが0
+        directory_cluster = boot_volume_image->root_cluster;
+      }
 
-    while (directory_cluster != kEndOfClusterchain) {
-      auto dir = GetSectorByCluster<DirectoryEntry>(directory_cluster);
-      for (int i = 0; i < bytes_per_cluster / sizeof(DirectoryEntry); i++) {
-        if (dir[i].name[0] == 0x00) {
-          goto not_found;
-        } else if (!NameIsEqual(dir[i], path_elem)) {
-          continue;
-        }
+      unsigned char name83[11];
+      const auto [ next_path, post_slash ] = NextPathElement(path, name83);
+      const bool path_last = next_path == nullptr || next_path[0] == '\0';
 
-        if (dir[i].attr == Attribute::kDirectory && !path_last) {
-          return FindFile(next_path, dir[i].FirstCluster());
-        } else {
-          // dir[i]がディレクトリではないかパスの末尾に来てしまったので探索をやめる
-          return { &dir[i], post_slash };
-        }
+      auto entry = LookupEntry(directory_cluster, name83);
+
+      if (entry && entry->attr == Attribute::kDirectory && !path_last) {
+        directory_cluster = entry->FirstCluster();
+        path = next_path;
+        continue;
       }
 
-      directory_cluster = NextCluster(directory_cluster);
+      // 見つからないか, ディレクトリではないかパスの末尾に来たので探索をやめる
+      return { entry, post_slash };
     }
-
-  not_found:
-    return { nullptr, post_slash };
   }
 
   bool NameIsEqual(const DirectoryEntry& entry, const char* name) {
-
     unsigned char name83[11];
-    memset(name83, 0x20, sizeof(name83));
-    int i83 = 0;
-
-    for (int i = 0; name[i] != 0 && i83 < sizeof(name83); i++, i83++) {
-      if (name[i] == '.') {
-        i83 = 7;
-        continue;
-      }
-      name83[i83] = toupper(name[i]);
-    }
-
+    NextPathElement(name, name83);
     return memcmp(entry.name, name83, sizeof(name83)) == 0;
   }
 
@@ -158,6 +253,157 @@ namespace fat {
     );
   }
 
+  namespace {
+    /**
+     * @brief 空きクラスタのビットマップ. ビットが1なら使用中（または範囲外）.
+     *
+     * FATを毎回先頭から探さないよう, 最初の割り当て時にFATから作り, 以後は割り当てと同時に更新する.
+     */
+    std::vector<uint64_t>* cluster_bitmap;
+    /** @brief 有効なクラスタ番号の上限（この値は含まない）. */
+    unsigned long cluster_end;
+    /** @brief 次に空きを探し始めるクラスタ. 割り当てのたびに直後へ進める. */
+    unsigned long next_free_hint;
+
+    void BuildClusterBitmap() {
+      const auto& bpb = *boot_volume_image;
+      const unsigned long data_sectors = bpb.total_sectors_32
+        - bpb.reserved_sector_count
+        - bpb.num_fats * bpb.fat_size_32;
+      const unsigned long fat_entries =
+        static_cast<unsigned long>(bpb.fat_size_32) * bpb.bytes_per_sector
+        / sizeof(uint32_t);
+      cluster_end = std::min(2 + data_sectors / bpb.sectors_per_cluster,
+                             fat_entries);
+
+      // 範囲外のビットは使用中にしておき, 探索で範囲の端を気にしなくてよくする
+      cluster_bitmap = new std::vector<uint64_t>((cluster_end + 63) / 64, ~0ul);
+      const uint32_t* fat = GetFAT();
+      for (unsigned long c = 2; c < cluster_end; ++c) {
+        if ((fat[c] & 0x0ffffffful) == 0) {
+          (*cluster_bitmap)[c / 64] &= ~(1ul << (c % 64));
+          ++cluster_stat.free_clusters;
+        }
+      }
+      cluster_stat.total_clusters = cluster_end - 2;
+      next_free_hint = 2;
+    }
+
+    bool ClusterIsFree(unsigned long cluster) {
+      return cluster < cluster_end
+        && ((*cluster_bitmap)[cluster / 64] >> (cluster % 64) & 1) == 0;
+    }
+
+    /** @brief [cluster, end) で最初の空きクラスタ. 無ければ0. */
+    unsigned long NextFreeCluster(unsigned long cluster, unsigned long end) {
+      while (cluster < end) {
+        const uint64_t free_bits = ~(*cluster_bitmap)[cluster / 64] >> (cluster % 64);
+        if (free_bits) {
+          cluster += __builtin_ctzll(free_bits);
+          return cluster < end ? cluster : 0;
+        }
+        cluster = (cluster / 64 + 1) * 64;
+      }
+      return 0;
+    }
+
+    /** @brief [begin, end) で長さn以上の連続した空きの先頭. 無ければ0. */
+    unsigned long FindFreeRun(unsigned long begin, unsigned long end, size_t n) {
+      for (auto c = NextFreeCluster(begin, end); c != 0; ) {
+        auto run_end = c + 1;
+        while (run_end - c < n && ClusterIsFree(run_end) && run_end < end) {
+          ++run_end;
+        }
+        if (run_end - c >= n) {
+          return c;
+        }
+        c = NextFreeCluster(run_end, end);
+      }
+      return 0;
+    }
+
+    /** @brief 割り当て中のチェーン. Appendでクラスタを後ろへつなぐ. */
+    struct ChainBuilder {
+      uint32_t* fat;
+      unsigned long first, last;
+
+      void Append(unsigned long cluster) {
+        (*cluster_bitmap)[cluster / 64] |= 1ul << (cluster % 64);
+        if (last != 0) {
+          fat[last] = cluster;
+        }
+        if (first == 0) {
+          first = cluster;
+        }
+        last = cluster;
+      }
+    };
+
+    /**
+     * @brief 空きクラスタをn個割り当て, prevの後ろにつないだチェーンを作る.
+     *
+     * 次の順に, なるべく連続したクラスタ（エクステント）を選ぶ.
+     * 1. prevの直後が空いていれば, そこから続けて取る
+     * 2. 残りを丸ごと収められる連続した空きを, next_free_hintから探す
+     * 3. 見つからなければ, next_free_hintから順に空きを取る
+     *
+     * @param prev つなぐ先のクラスタ. 0なら新しいチェーンにする
+     * @return 割り当てたチェーンの先頭と最後尾. 空きが足りなければ何もせず {0, 0}
+     */
+    std::pair<unsigned long, unsigned long> AllocateClusters(unsigned long prev,
+                                                             size_t n) {
+      if (cluster_bitmap == nullptr) {
+        BuildClusterBitmap();
+      }
+      if (n > cluster_stat.free_clusters) {
+        return { 0, 0 };
+      }
+
+      ChainBuilder chain{ GetFAT(), 0, 0 };
+      size_t rest = n;
+
+      for (auto c = prev + 1; prev != 0 && rest > 0 && ClusterIsFree(c); ++c) {
+        chain.Append(c);
+        --rest;
+      }
+
+      if (rest > 0) {
+        unsigned long run = FindFreeRun(next_free_hint, cluster_end, rest);
+        if (run == 0) {
+          run = FindFreeRun(2, next_free_hint, rest);
+        }
+
+        if (run != 0) {
+          for (auto c = run; rest > 0; ++c, --rest) {
+            chain.Append(c);
+          }
+        } else {
+          for (auto c = next_free_hint; rest > 0; ++c, --rest) {
+            c = NextFreeCluster(c, cluster_end);
+            if (c == 0) {
+              c = NextFreeCluster(2, cluster_end);
+            }
+            chain.Append(c);
+          }
+        }
+      }
+
+      chain.fat[chain.last] = kEndOfClusterchain;
+      if (prev != 0) {
+        chain.fat[prev] = chain.first;
+      }
+
+      cluster_stat.free_clusters -= n;
+      cluster_stat.allocated_clusters += n;
+      ++cluster_stat.allocations;
+      next_free_hint = chain.last + 1 < cluster_end ? chain.last + 1 : 2;
+
+      return { chain.first, chain.last };
+    }
+  } // namespace
+
+  ClusterStat cluster_stat;
+
   unsigned long ExtendCluster(unsigned long eoc_cluster,
                               size_t n) {
     uint32_t* fat = GetFAT();
@@ -165,23 +411,18 @@ namespace fat {
       eoc_cluster = fat[eoc_cluster];
     }
 
-    size_t num_allocated = 0;
-    auto current = eoc_cluster;
-
-    for (unsigned long candidate = 2; num_allocated < n; candidate++) {
-      if (fat[candidate] != 0) {
-        continue;
-      }
-      fat[current] = candidate;
-      current = candidate;
-      num_allocated++;
+    if (n == 0) {
+      return eoc_cluster;
     }
 
-    fat[current] = kEndOfClusterchain;
-    return current;
+    const auto [ first, last ] = AllocateClusters(eoc_cluster, n);
+    return first == 0 ? kEndOfClusterchain : last;
   }
 
   DirectoryEntry* AllocateEntry(unsigned long dir_cluster) {
+    // 返したエントリに名前が付くと, 見つからなかったという記録が古くなる
+    InvalidateDentryCache();
+
     while (true) {
       auto dir = GetSectorByCluster<DirectoryEntry>(dir_cluster);
 
@@ -201,6 +442,9 @@ namespace fat {
     }
 
     dir_cluster = ExtendCluster(dir_cluster, 1);
+    if (dir_cluster == kEndOfClusterchain) {
+      return nullptr;
+    }
     auto dir = GetSectorByCluster<DirectoryEntry>(dir_cluster);
     memset(dir, 0, bytes_per_cluster);
 
@@ -258,25 +502,12 @@ namespace fat {
 
     fat::SetFileName(*dir, filename);
     dir->file_size = 0;
+    InvalidateDentryCache();
     return { dir, MAKE_ERROR(Error::kSuccess) };
   }
 
   unsigned long AllocateClusterChain(size_t n) {
-    uint32_t* fat = GetFAT();
-    unsigned long first_cluster;
-
-    for (first_cluster = 2; ; first_cluster++) {
-      if (fat[first_cluster] == 0) {
-        fat[first_cluster] = kEndOfClusterchain;
-        break;
-      }
-    }
-
-    if (n > 1) {
-      ExtendCluster(first_cluster, n - 1);
-    }
-
-    return first_cluster;
+    return AllocateClusters(0, std::max<size_t>(n, 1)).first;
   }
 
   FileDescriptor::FileDescriptor(DirectoryEntry& fat_entry)
@@ -320,6 +551,9 @@ namespace fat {
         wr_cluster_ = fat_entry_.FirstCluster();
       } else {
         wr_cluster_ = AllocateClusterChain(num_cluster(len));
+        if (wr_cluster_ == 0) {
+          return 0;
+        }
         fat_entry_.first_cluster_low = wr_cluster_ & 0xFFFF;
         fat_entry_.first_cluster_high = (wr_cluster_ >> 16) & 0xFFFF;
       }
@@ -332,7 +566,11 @@ namespace fat {
       if (wr_cluster_off_ == bytes_per_cluster) {
         const auto next_cluster = NextCluster(wr_cluster_);
         if (next_cluster == kEndOfClusterchain) {
-          wr_cluster_ = ExtendCluster(wr_cluster_, num_cluster(len - total));
+          const auto last = ExtendCluster(wr_cluster_, num_cluster(len - total));
+          if (last == kEndOfClusterchain) {
+            break;
+          }
+          wr_cluster_ = NextCluster(wr_cluster_);
         } else {
           wr_cluster_ = next_cluster;
         }
@@ -340,7 +578,7 @@ namespace fat {
       }
 
       uint8_t* sec = GetSectorByCluster<uint8_t>(wr_cluster_);
-      size_t n = std::min(len, bytes_per_cluster - wr_cluster_off_);
+      size_t n = std::min(len - total, bytes_per_cluster - wr_cluster_off_);
       memcpy(&sec[wr_cluster_off_], &buf8[total], n);
       total += n;
 
@@ -350,26 +588,94 @@ namespace fat {
     wr_off_ += total;
     fat_entry_.file_size = wr_off_;
 
+    __asm__("cli");
+    page_cache->Invalidate(Identity());
+    __asm__("sti");
+
     return total;
   }
 
   size_t FileDescriptor::Load(void* buf,
                               size_t len,
                               size_t offset) {
+    if (offset >= fat_entry_.file_size) {
+      return 0;
+    }
+
     FileDescriptor fd{fat_entry_};
     fd.rd_off_ = offset;
+    fd.rd_cluster_ = ClusterAt(offset);
+    fd.rd_cluster_off_ = offset;
 
-    unsigned long cluster = fat_entry_.FirstCluster();
+    return fd.Read(buf, len);
+  }
 
-    while (offset >= bytes_per_cluster) {
-      offset -= bytes_per_cluster;
-      cluster = NextCluster(cluster);
+  bool FileDescriptor::MapClusters(size_t index) {
+    if (extents_.empty()) {
+      const auto first = fat_entry_.FirstCluster();
+      if (first == 0) {
+        return false;
+      }
+      extents_.push_back(Extent{ 0, first, 1 });
     }
 
-    fd.rd_cluster_ = cluster;
-    fd.rd_cluster_off_ = offset;
+    while (true) {
+      const auto last = extents_.back();
+      if (index < last.index + last.num_clusters) {
+        return true;
+      }
 
-    return fd.Read(buf, len);
+      const auto tail = last.cluster + last.num_clusters - 1;
+      const auto next = NextCluster(tail);
+      if (next == kEndOfClusterchain) {
+        // 後でチェーンが伸長されたら, 次の呼び出しで末尾から続きを辿る
+        return false;
+      }
+
+      if (next == tail + 1) {
+        ++extents_.back().num_clusters;
+      } else {
+        extents_.push_back(Extent{ last.index + last.num_clusters, next, 1 });
+      }
+    }
+  }
+
+  unsigned long FileDescriptor::ClusterAt(size_t& offset) {
+    const size_t index = offset / bytes_per_cluster;
+    offset %= bytes_per_cluster;
+
+    if (!MapClusters(index)) {
+      return kEndOfClusterchain;
+    }
+
+    auto it = std::upper_bound(
+      extents_.begin(),
+      extents_.end(),
+      index,
+      [](size_t i, const Extent& e) {
+        return i < e.index;
+      }
+    );
+    --it;
+
+    return it->cluster + (index - it->index);
+  }
+
+  const void* FileDescriptor::DirectPage(size_t offset) {
+    if (bytes_per_cluster < 4096
+        || offset % bytes_per_cluster + 4096 > bytes_per_cluster
+        || offset + 4096 > fat_entry_.file_size) {
+      return nullptr;
+    }
+
+    const auto cluster = ClusterAt(offset);
+    const uintptr_t addr = GetClusterAddr(cluster) + offset;
+
+    if (addr % 4096 != 0) {
+      return nullptr;
+    }
+
+    return reinterpret_cast<const void*>(addr);
   }
 
 } // namespace fat
@@ -8,6 +8,7 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <vector>
 #include "error.hpp"
 #include "file.hpp"
 
@@ -129,6 +130,8 @@ namespace fat {
 
   /**
    * @brief 指定されたディレクトリからファイルを返す.
+   *
+   * パスの各要素は一度だけ8+3形式に直し, (ディレクトリ, 名前) ごとの結果をキャッシュから引く.
    * 
    * @param name 8+3形式のファイル名（大文字小文字は区別しない）
    * @param directory_cluster ディレクトリの開始クラスタ（省略した場合ルートディレクトリから検索する）
@@ -140,6 +143,14 @@ namespace fat {
 
   bool NameIsEqual(const DirectoryEntry& entry, const char* name);
 
+  struct LookupStat {
+    /** @brief FindFileがディレクトリを1段引いたとき, キャッシュに有った回数と無かった回数. */
+    uint64_t hits, misses;
+  };
+
+  /** @brief 割り込み禁止で更新する. 読むときも割り込み禁止でまとめて写すこと. */
+  extern LookupStat lookup_stat;
+
   /**
    * @brief 指定されたファイルの内容をバッファへコピーする.
    * 
@@ -156,10 +167,13 @@ namespace fat {
 
   /**
    * @brief 指定されたクラスタ数だけクラスタチェーンを伸長する.
+   *
+   * 空きクラスタはビットマップから探し, なるべく連続したクラスタを割り当てる.
    * 
    * @param eoc_cluster 伸長したいクラスタチェーンに属するいずれかのクラスタ番号
    * @param n 伸長するクラスタ数
-   * @return 伸長後のチェーンにおける最後尾のクラスタ番号
+   * @return 伸長後のチェーンにおける最後尾のクラスタ番号. 空きが足りなければ
+   *   チェーンを変えずにkEndOfClusterchain
    */
   unsigned long ExtendCluster(unsigned long eoc_cluster, size_t n);
 
@@ -168,7 +182,7 @@ namespace fat {
    * ディレクトリが満杯ならクラスタを1つ伸長して空きエントリを確保する.
    * 
    * @param dir_cluster 空きエントリを探すディレクトリ
-   * @return 伸長後のチェーンにおける最後尾のクラスタ番号
+   * @return 空きエントリ. クラスタを伸長できなければnullptr
    */
   DirectoryEntry* AllocateEntry(unsigned long dir_cluster);
 
@@ -192,10 +206,20 @@ namespace fat {
    * @brief 指定した数の空きクラスタからなるチェーンを構築する.
    *
    * @param n  クラスタ数
-   * @return  構築したチェーンの先頭クラスタ番号
+   * @return  構築したチェーンの先頭クラスタ番号. 空きが足りなければ0
    */
   unsigned long AllocateClusterChain(size_t n);
 
+  struct ClusterStat {
+    /** @brief データ領域のクラスタ数と, そのうち空いている数. */
+    unsigned long total_clusters, free_clusters;
+    /** @brief クラスタを割り当てた回数と, 割り当てたクラスタの総数. */
+    uint64_t allocations, allocated_clusters;
+  };
+
+  /** @brief クラスタ割り当ての統計. 空きクラスタのビットマップを作るまでは全て0. */
+  extern ClusterStat cluster_stat;
+
   class FileDescriptor : public ::FileDescriptor {
     public:
       explicit FileDescriptor(DirectoryEntry& fat_entry);
@@ -206,6 +230,15 @@ namespace fat {
       }
       size_t Load(void* buf, size_t len, size_t offset) override;
 
+      const void* Identity() const override {
+        return &fat_entry_;
+      }
+
+      /**
+       * @brief ページが1つのクラスタに収まり, ファイル末尾を越えなければボリュームイメージ上のアドレスを返す.
+       */
+      const void* DirectPage(size_t offset) override;
+
     private:
       DirectoryEntry& fat_entry_;
       size_t rd_off_ = 0;
@@ -214,5 +247,34 @@ namespace fat {
       size_t wr_off_ = 0;
       unsigned long wr_cluster_ = 0;
       size_t wr_cluster_off_ = 0;
+
+      /** @brief ファイル内のindex番目のクラスタから連続するnum_clusters個のクラスタ. */
+      struct Extent {
+        size_t index;
+        unsigned long cluster;
+        size_t num_clusters;
+      };
+
+      /**
+       * @brief これまでに辿ったクラスタチェーンをエクステントの列で表したもの.
+       *
+       * チェーンは末尾にしか伸びないので, 一度辿った部分は変わらない.
+       */
+      std::vector<Extent> extents_;
+
+      /**
+       * @brief ファイル内のindex番目のクラスタまでextents_を伸ばす.
+       *
+       * @return チェーンがindex番目まで続いていればtrue
+       */
+      bool MapClusters(size_t index);
+
+      /**
+       * @brief offsetを含むクラスタを返し, offsetをクラスタ内オフセットに置き換える.
+       *
+       * extents_を二分探索するので, 一度辿った範囲ならファイル内の位置によらずチェーンを参照しない.
+       * チェーンを越えていればkEndOfClusterchain.
+       */
+      unsigned long ClusterAt(size_t& offset);
   };
 } // namespace fat
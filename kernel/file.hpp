@@ -1,8 +1,12 @@
 #pragma once
 
 #include <cstddef>
+#include <cstdint>
+#include <memory>
 #include "error.hpp"
 
+class SharedMemory;
+
 class FileDescriptor {
   public:
     virtual ~FileDescriptor() = default;
@@ -16,6 +20,52 @@ class FileDescriptor {
     virtual size_t Load(void* buf,
                         size_t len,
                         size_t offset) = 0;
+
+    /**
+     * @brief ページキャッシュでファイルを識別する値を返す.
+     *
+     * 同じファイルを開いた記述子は同じ値を返す. nullptrならページキャッシュを使わない.
+     */
+    virtual const void* Identity() const {
+      return nullptr;
+    }
+
+    /**
+     * @brief offsetから始まる4KiBのファイル内容を, 複製せずにマップできるメモリを返す.
+     *
+     * @return 4KiB境界に揃ったメモリ. 直接マップできない場合はnullptr
+     */
+    virtual const void* DirectPage(size_t offset) {
+      return nullptr;
+    }
+
+    /**
+     * @brief 現在のアドレス空間の [addr, addr + 4KiB * num_pages) のページを, 複製せずに書き込む.
+     *
+     * addrは4KiB境界に揃っていること. ページはSharePrivatePageで共有され, 書き込み側が
+     * 後で書き換えると複製される.
+     *
+     * @return 書き込んだページ数. 対応しない場合や先頭のページを共有できない場合はkNotImplemented
+     */
+    virtual WithError<size_t> WritePages(uint64_t addr, size_t num_pages) {
+      return { 0, MAKE_ERROR(Error::kNotImplemented) };
+    }
+
+    /**
+     * @brief 読めるページを複製せずに現在のアドレス空間の [addr, addr + 4KiB * num_pages) へマップする.
+     *
+     * addrは4KiB境界に揃っていること. 呼び出し側は範囲が書き込み可能な領域であることを確認しておく.
+     *
+     * @return マップしたページ数. 次に読める内容がページ単位でなければkNotImplemented
+     */
+    virtual WithError<size_t> ReadPages(uint64_t addr, size_t num_pages) {
+      return { 0, MAKE_ERROR(Error::kNotImplemented) };
+    }
+
+    /** @brief 共有メモリを開いた記述子ならその共有メモリを返す. それ以外はnullptr. */
+    virtual std::shared_ptr<SharedMemory> SharedMemoryObject() {
+      return nullptr;
+    }
 };
 
 size_t PrintToFD(FileDescriptor& fd,
@@ -141,4 +141,22 @@ int BitsPerPixel(PixelFormat format) {
   }
 
   return -1;
-}
\ No newline at end of file
+}
+
+void FrameBuffer::WriteRow(Vector2D<int> pos, const uint32_t* colors, int n) {
+  auto dst = reinterpret_cast<uint32_t*>(FrameAddrAt(pos, config_));
+
+  switch (config_.pixel_format) {
+    case kPixelBGRResv8BitPerColor:
+      // リトルエンディアンの0xRRGGBBはメモリ上でB, G, R, 0の順になる
+      memcpy(dst, colors, 4 * n);
+      break;
+    case kPixelRGBResv8BitPerColor:
+      // 分岐の無いループにしてコンパイラにSIMD化させる
+      for (int i = 0; i < n; i++) {
+        const uint32_t c = colors[i];
+        dst[i] = (c >> 16 & 0xff) | (c & 0xff00) | (c & 0xff) << 16;
+      }
+      break;
+  }
+}
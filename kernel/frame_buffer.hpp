@@ -16,6 +16,13 @@ class FrameBuffer {
     
     void Move(Vector2D<int> dst_pos, const Rectangle<int>& src);
 
+    /**
+     * @brief 0xRRGGBB形式のn個の色を, posから右へ向かって書き込む.
+     *
+     * 範囲はバッファ内に収まっていること.
+     */
+    void WriteRow(Vector2D<int> pos, const uint32_t* colors, int n);
+
     FrameBufferWriter& Writer() {
       return *writer_;
     }
@@ -0,0 +1,102 @@
+#include "futex.hpp"
+
+#include <array>
+#include "cpu_local.hpp"
+#include "task.hpp"
+#include "timer.hpp"
+
+namespace {
+  /** @brief 待っているタスク. 待っている間だけ存在するFutexWaitのスタック上に置く. */
+  struct Waiter {
+    FutexKey key;
+    Task* task;
+    bool woken;
+    Waiter* next;
+  };
+
+  /**
+   * @brief 識別子のハッシュで振り分けた待ち行列.
+   *
+   * 各行列は待ち始めた順の単方向リスト. 割り込み禁止で操作する.
+   */
+  const int kBucketBits = 8;
+  std::array<Waiter*, 1 << kBucketBits> buckets;
+
+  Waiter*& Bucket(FutexKey key) {
+    const uint64_t h = ((key.addr >> 2) ^ key.space) * 0x9e37'79b9'7f4a'7c15;
+    return buckets[h >> (64 - kBucketBits)];
+  }
+
+  bool SameKey(FutexKey a, FutexKey b) {
+    return a.space == b.space && a.addr == b.addr;
+  }
+
+  void Append(Waiter* w) {
+    auto p = &Bucket(w->key);
+    while (*p) {
+      p = &(*p)->next;
+    }
+    *p = w;
+  }
+
+  void Unlink(Waiter* w) {
+    for (auto p = &Bucket(w->key); *p; p = &(*p)->next) {
+      if (*p == w) {
+        *p = w->next;
+        return;
+      }
+    }
+  }
+} // namespace
+
+Error FutexWait(FutexKey key, uintptr_t phys_addr, uint32_t expected,
+                std::optional<unsigned long> deadline) {
+  auto& task = CurrentTask();
+
+  if (*reinterpret_cast<volatile uint32_t*>(phys_addr) != expected) {
+    __asm__("sti");
+    return MAKE_ERROR(Error::kValueMismatch);
+  }
+
+  Waiter w{ key, &task, false, nullptr };
+  Append(&w);
+
+  while (!w.woken) {
+    if (task.Group().killed) {
+      Unlink(&w);
+      __asm__("sti");
+      return MAKE_ERROR(Error::kTimeout);
+    }
+    if (deadline && timer_manager->CurrentTick() >= *deadline) {
+      Unlink(&w);
+      __asm__("sti");
+      return MAKE_ERROR(Error::kTimeout);
+    }
+    task.Sleep();
+    __asm__("cli");
+  }
+  __asm__("sti");
+
+  return MAKE_ERROR(Error::kSuccess);
+}
+
+size_t FutexWake(FutexKey key, size_t count) {
+  size_t num_woken = 0;
+
+  __asm__("cli");
+  for (auto p = &Bucket(key); *p && num_woken < count; ) {
+    auto w = *p;
+    if (!SameKey(w->key, key)) {
+      p = &w->next;
+      continue;
+    }
+
+    *p = w->next;
+    w->woken = true;
+    w->task->Wakeup();
+    ++num_woken;
+  }
+  __asm__("sti");
+
+  return num_woken;
+}
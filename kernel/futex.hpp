@@ -0,0 +1,49 @@
+/**
+ * @file futex.hpp
+ *
+ * メモリ上の値を見てタスクを待たせたり起こしたりする仕組み.
+ *
+ * 共有メモリは物理アドレスで識別するので, 同じフレームを別々のアドレスへマップした
+ * タスク同士でも待ち合わせられる. それ以外はアドレス空間と仮想アドレスで識別する.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include "error.hpp"
+
+/**
+ * @brief 待ち合わせの識別子.
+ *
+ * 共有メモリのページはspaceを0, addrを物理アドレスとする.
+ * それ以外のページはspaceをアドレス空間（PML4の物理アドレス）, addrを仮想アドレスとする.
+ * 自分専用のページのフレームは, SharePrivatePageで共有された後の書き込みで
+ * 複製されて変わりうるので, 待っている間の識別には使えない.
+ */
+struct FutexKey {
+  uint64_t space;
+  uintptr_t addr;
+};
+
+/**
+ * @brief keyが指す32ビット値がexpectedの間, FutexWakeで起こされるまで待つ.
+ *
+ * keyの解決から割り込み禁止のまま呼ぶこと. 戻るときには割り込みを許可している.
+ * 値は今のフレーム上のphys_addrから読む. 値の確認と待ち行列への登録は割り込み禁止のまま
+ * 行うので, 確認した直後のFutexWakeを取りこぼさない. deadlineまでに起こされなければ
+ * 待つのをやめる. deadlineに起床させるタイマーは呼び出し側が設定しておく.
+ *
+ * @return 起こされたらkSuccess. 値がexpectedでなければkValueMismatch, 時間切れならkTimeout.
+ *   スレッドグループが終了させられたときもkTimeoutで待つのをやめる
+ */
+Error FutexWait(FutexKey key, uintptr_t phys_addr, uint32_t expected,
+                std::optional<unsigned long> deadline);
+
+/**
+ * @brief keyで待っているタスクを, 待ち始めた順に最大count個起こす.
+ *
+ * @return 起こしたタスクの数
+ */
+size_t FutexWake(FutexKey key, size_t count);
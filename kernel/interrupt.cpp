@@ -1,12 +1,15 @@
 #include <csignal>
 
 #include "asmfunc.h"
+#include "cpu_local.hpp"
 #include "font.hpp"
 #include "graphics.hpp"
 #include "interrupt.hpp"
 #include "segment.hpp"
 #include "task.hpp"
+#include "thread.hpp"
 #include "timer.hpp"
+#include "uaccess.hpp"
 
 std::array<InterruptDescriptor, 256> idt;
 
@@ -29,8 +32,16 @@ void NotifyEndOfInterrupt() {
 
 namespace {
 
+  /** @brief アプリ実行中に割り込まれたなら, GSを使う前にGSベースを戻す. */
+  void EnterFromUser(const InterruptFrame* frame) {
+    if ((frame->cs & 3) == 3) {
+      RestoreKernelGSBase();
+    }
+  }
+
   __attribute__((interrupt))
   void IntHandlerXHCI(InterruptFrame* frame) {
+    EnterFromUser(frame);
     task_manager->SendMessage(1, Message {Message::kInterruptXHCI});
     NotifyEndOfInterrupt();
   }
@@ -128,17 +139,26 @@ namespace {
 
     auto& task = task_manager->CurrentTask();
     __asm__("sti");
-    ExitApp(task.OSStackPointer(), 128 + SIGSEGV);
+    // 他のスレッドも同じアドレス空間で動き続けられないので, アプリ全体を終わらせる
+    KillThreadGroup(task, 128 + SIGSEGV);
+    ExitApp(task.OSStackPointer(), task.Group().exit_code);
   }
 
   __attribute__((interrupt))
   void IntHandlerPF(InterruptFrame* frame, uint64_t error_code) {
+    EnterFromUser(frame);
     uint64_t cr2 = GetCR2();
 
     if (auto err = HandlePageFault(error_code, cr2); !err) {
       return;
     }
 
+    if (auto fixup = SearchUserAccessFixup(frame->rip)) {
+      // CopyFromUserなどがアプリの不正なアドレスに触れた. 失敗として呼び出し元へ返す
+      frame->rip = fixup;
+      return;
+    }
+
     KillApp(frame);
     PrintFrame(frame, "#PF");
     WriteString(*screen_writer, { 500, 16 * 4 }, "ERR", { 0, 0, 0 });
@@ -149,6 +169,7 @@ namespace {
   #define FaultHandlerWithError(fault_name) \
     __attribute__((interrupt)) \
     void IntHandler ## fault_name (InterruptFrame* frame, uint64_t error_code) { \
+      EnterFromUser(frame); \
       KillApp(frame); \
       PrintFrame(frame, "#" #fault_name); \
       WriteString(*screen_writer, { 500, 16 * 4 }, "ERR", { 0, 0, 0 }); \
@@ -159,6 +180,7 @@ namespace {
   #define FaultHandlerNoError(fault_name) \
     __attribute__((interrupt)) \
     void IntHandler ## fault_name (InterruptFrame* frame) { \
+      EnterFromUser(frame); \
       KillApp(frame); \
       PrintFrame(frame, "#" #fault_name); \
       while (true) __asm__("hlt"); \
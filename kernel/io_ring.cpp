@@ -0,0 +1,143 @@
+#include "io_ring.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include "uaccess.hpp"
+
+namespace {
+  /** @brief 投入キューの位置. 先頭のIoRingをキャッシュラインの境界まで詰める. */
+  const uint32_t kSubmissionOffset = 64;
+
+  static_assert(sizeof(IoRing) <= kSubmissionOffset);
+
+  uint32_t CompletionOffset(uint32_t sq_entries) {
+    return kSubmissionOffset + sq_entries * sizeof(IoRingSubmission);
+  }
+}
+
+IoRingContext::IoRingContext(uint64_t ring_addr,
+                             uint32_t sq_entries,
+                             uint32_t cq_entries)
+    : ring_addr_{ring_addr}, sq_entries_{sq_entries}, cq_entries_{cq_entries} {
+}
+
+uint64_t IoRingContext::RingBytes(uint32_t sq_entries, uint32_t cq_entries) {
+  return CompletionOffset(sq_entries) + cq_entries * sizeof(IoRingCompletion);
+}
+
+Error IoRingContext::InitializeRing() {
+  const IoRing ring{
+    0, 0,
+    0, 0,
+    sq_entries_, cq_entries_,
+    kSubmissionOffset, CompletionOffset(sq_entries_)
+  };
+  return CopyToUser(reinterpret_cast<void*>(ring_addr_), &ring, sizeof(ring));
+}
+
+WithError<bool> IoRingContext::Pop(IoRingSubmission& sqe) {
+  uint32_t sq_tail;
+
+  if (auto err = CopyFromUser(&sq_tail, UserField(&IoRing::sq_tail), sizeof(sq_tail))) {
+    return { false, err };
+  }
+
+  if (sq_tail == sq_head_) {
+    return { false, MAKE_ERROR(Error::kSuccess) };
+  } else if (sq_tail - sq_head_ > sq_entries_) {
+    return { false, MAKE_ERROR(Error::kIndexOutOfRange) };
+  }
+
+  auto [ unread, err ] = UnreadCompletions();
+
+  if (err) {
+    return { false, err };
+  } else if (unread + timeouts_.size() >= cq_entries_) {
+    return { false, MAKE_ERROR(Error::kSuccess) };
+  }
+
+  const uint64_t sqe_addr = ring_addr_ + kSubmissionOffset
+    + (sq_head_ & (sq_entries_ - 1)) * sizeof(IoRingSubmission);
+
+  if (auto err = CopyFromUser(&sqe, reinterpret_cast<const void*>(sqe_addr), sizeof(sqe))) {
+    return { false, err };
+  }
+
+  sq_head_++;
+
+  if (auto err = CopyToUser(UserField(&IoRing::sq_head), &sq_head_, sizeof(sq_head_))) {
+    return { false, err };
+  }
+
+  return { true, MAKE_ERROR(Error::kSuccess) };
+}
+
+Error IoRingContext::Complete(uint64_t user_data, uint64_t value, int error) {
+  const IoRingCompletion cqe{ user_data, value, error, 0 };
+  const uint64_t cqe_addr = ring_addr_ + CompletionOffset(sq_entries_)
+    + (cq_tail_ & (cq_entries_ - 1)) * sizeof(IoRingCompletion);
+
+  if (auto err = CopyToUser(reinterpret_cast<void*>(cqe_addr), &cqe, sizeof(cqe))) {
+    return err;
+  }
+
+  // アプリがcq_tailを見た時点で要素の内容が読めるよう, 要素を書いてから進める
+  cq_tail_++;
+  return CopyToUser(UserField(&IoRing::cq_tail), &cq_tail_, sizeof(cq_tail_));
+}
+
+void IoRingContext::AddTimeout(unsigned long deadline, uint64_t user_data) {
+  timeouts_.push_back(Timeout{ deadline, user_data });
+}
+
+Error IoRingContext::CompleteTimeouts(unsigned long tick) {
+  auto it = timeouts_.begin();
+
+  while (it != timeouts_.end()) {
+    if (it->deadline > tick) {
+      ++it;
+      continue;
+    }
+
+    const uint64_t user_data = it->user_data;
+    it = timeouts_.erase(it);
+
+    if (auto err = Complete(user_data, 0, 0)) {
+      return err;
+    }
+  }
+
+  return MAKE_ERROR(Error::kSuccess);
+}
+
+std::optional<unsigned long> IoRingContext::NextDeadline() const {
+  if (timeouts_.empty()) {
+    return std::nullopt;
+  }
+
+  return std::min_element(
+    timeouts_.begin(),
+    timeouts_.end(),
+    [](const Timeout& a, const Timeout& b) {
+      return a.deadline < b.deadline;
+    }
+  )->deadline;
+}
+
+WithError<uint32_t> IoRingContext::UnreadCompletions() {
+  uint32_t cq_head;
+
+  if (auto err = CopyFromUser(&cq_head, UserField(&IoRing::cq_head), sizeof(cq_head))) {
+    return { 0, err };
+  }
+
+  // アプリが読んだ以上に進めていたら, 全て読まれたものとみなす
+  const uint32_t unread = cq_tail_ - cq_head;
+  return { unread > cq_entries_ ? 0 : unread, MAKE_ERROR(Error::kSuccess) };
+}
+
+template <class T>
+T* IoRingContext::UserField(T IoRing::* member) const {
+  auto ring = reinterpret_cast<IoRing*>(ring_addr_);
+  return &(ring->*member);
+}
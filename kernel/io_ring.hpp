@@ -0,0 +1,75 @@
+/**
+ * @file io_ring.hpp
+ *
+ * アプリと共有する入出力リングのカーネル側の状態.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+#include "app_io_ring.hpp"
+#include "error.hpp"
+
+/**
+ * @brief タスクが IoRingSetup で作った入出力リング.
+ *
+ * リングの実体はアプリのメモリにあり, 読み書きは全てCopyFromUser/CopyToUserで行う.
+ * sq_headとcq_tailはカーネルだけが進めるので, アプリが書き換えても信用せず手元の値を使う.
+ * 呼び出しはリングを持つタスクの文脈（IoRingEnterの中）で行うこと.
+ */
+class IoRingContext {
+  public:
+    static const uint32_t kMaxEntries = 4096;
+
+    IoRingContext(uint64_t ring_addr, uint32_t sq_entries, uint32_t cq_entries);
+
+    /** @brief 指定された要素数のリング全体のバイト数. */
+    static uint64_t RingBytes(uint32_t sq_entries, uint32_t cq_entries);
+
+    /** @brief リングの先頭（IoRing）をアプリのメモリに書き込む. */
+    Error InitializeRing();
+
+    /**
+     * @brief 投入キューの先頭を取り出す.
+     *
+     * 完了キューに空きが無い場合は取り出さず, 処理済みの完了が読まれるのを待つ.
+     *
+     * @return 取り出せたらtrue
+     */
+    WithError<bool> Pop(IoRingSubmission& sqe);
+
+    /** @brief 完了キューに書き込む. 空きはPopで確認済みであること. */
+    Error Complete(uint64_t user_data, uint64_t value, int error);
+
+    /**
+     * @brief deadline（タイマーのティック）に完了するタイムアウト操作を登録する.
+     *
+     * 完了キューの1要素を完了まで予約する.
+     */
+    void AddTimeout(unsigned long deadline, uint64_t user_data);
+
+    /** @brief 期限がtickまでのタイムアウト操作を完了させる. */
+    Error CompleteTimeouts(unsigned long tick);
+
+    /** @brief 最も早いタイムアウトの期限. 無ければstd::nullopt. */
+    std::optional<unsigned long> NextDeadline() const;
+
+    /** @brief 完了キューにあってアプリがまだ読んでいない要素の数. */
+    WithError<uint32_t> UnreadCompletions();
+
+  private:
+    struct Timeout {
+      unsigned long deadline;
+      uint64_t user_data;
+    };
+
+    uint64_t ring_addr_;
+    uint32_t sq_entries_, cq_entries_;
+    uint32_t sq_head_{0}, cq_tail_{0};
+    std::vector<Timeout> timeouts_{};
+
+    template <class T>
+    T* UserField(T IoRing::* member) const;
+};
@@ -65,6 +65,7 @@ void InitializeKeyboard() {
       msg.arg.keyboard.keycode = keycode;
       msg.arg.keyboard.ascii = ascii;
       msg.arg.keyboard.press = press;
+      msg.origin_tsc = __builtin_ia32_rdtsc();
       task_manager->SendMessage(1, msg);
     };
 }
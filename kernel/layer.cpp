@@ -1,5 +1,6 @@
 #include <algorithm>
 
+#include "compositor.hpp"
 #include "console.hpp"
 #include "layer.hpp"
 #include "logger.hpp"
@@ -119,8 +120,8 @@ void LayerManager::Move(unsigned int id, Vector2D<int> new_pos) {
   const auto window_size = layer->GetWindow()->Size();
   const auto old_pos = layer->GetPosition();
   layer->Move(new_pos);
-  Draw({old_pos, window_size});
-  Draw(id);
+  AddDamage({old_pos, window_size});
+  AddLayerDamage(id);
 }
 
 void LayerManager::MoveRelative(unsigned int id, Vector2D<int> pos_diff) {
@@ -128,8 +129,8 @@ void LayerManager::MoveRelative(unsigned int id, Vector2D<int> pos_diff) {
   const auto window_size = layer->GetWindow()->Size();
   const auto old_pos = layer->GetPosition();
   layer->MoveRelative(pos_diff);
-  Draw({old_pos, window_size});
-  Draw(id);
+  AddDamage({old_pos, window_size});
+  AddLayerDamage(id);
 }
 
 void LayerManager::UpDown(unsigned int id, int new_z) {
@@ -265,7 +266,7 @@ void ActiveLayer::Activate(unsigned int layer_id) {
   if (active_layer_ > 0) {
     Layer* layer = manager_.FindLayer(active_layer_);
     layer->GetWindow()->Deactivate();
-    manager_.Draw(active_layer_);
+    AddLayerDamage(active_layer_);
     SendWindowActiveMessage(active_layer_, 0);
   }
 
@@ -279,7 +280,7 @@ void ActiveLayer::Activate(unsigned int layer_id) {
       active_layer_,
       manager_.GetHeight(mouse_layer_) - 1
     );
-    manager_.Draw(active_layer_);
+    AddLayerDamage(active_layer_);
     SendWindowActiveMessage(active_layer_, 1);
   }
 }
@@ -353,10 +354,14 @@ void ProcessLayerMessage(const Message& msg) {
       layer_manager->MoveRelative(arg.layer_id, {arg.x, arg.y});
       break;
     case LayerOperation::Draw:
-      layer_manager->Draw(arg.layer_id);
+      AddLayerDamage(arg.layer_id, msg.origin_tsc);
       break;
     case LayerOperation::DrawArea:
-      layer_manager->Draw(arg.layer_id, {{arg.x, arg.y}, {arg.w, arg.h}});
+      AddLayerDamage(
+        arg.layer_id,
+        {{arg.x, arg.y}, {arg.w, arg.h}},
+        msg.origin_tsc
+      );
       break;
   }
 }
@@ -374,7 +379,7 @@ Error CloseLayer(unsigned int layer_id) {
   __asm__("cli");
   active_layer->Activate(0);
   layer_manager->RemoveLayer(layer_id);
-  layer_manager->Draw({ pos, size });
+  AddDamage({ pos, size });
   layer_task_map->erase(layer_id);
   __asm__("sti");
 
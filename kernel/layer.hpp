@@ -82,10 +82,10 @@ class LayerManager {
     /** @brief 指定されたレイヤーが持つウィンドウの指定された範囲を描画する． */
     void Draw(unsigned int id, Rectangle<int> area) const;
 
-    /** @brief idで指定されたレイヤーの位置情報を、指定された絶対座標に更新する. 再描画する. */
+    /** @brief idで指定されたレイヤーの位置情報を、指定された絶対座標に更新する. 再描画を依頼する. */
     void Move(unsigned int id, Vector2D<int> new_pos);
 
-    /** @brief idで指定されたレイヤーの位置情報を、指定された相対座標に更新する. 再描画する. */
+    /** @brief idで指定されたレイヤーの位置情報を、指定された相対座標に更新する. 再描画を依頼する. */
     void MoveRelative(unsigned int id, Vector2D<int> poss_diff);
 
     /**
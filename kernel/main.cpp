@@ -15,7 +15,9 @@
 
 #include "acpi.hpp"
 #include "asmfunc.h"
+#include "compositor.hpp"
 #include "console.hpp"
+#include "cpu_local.hpp"
 #include "fat.hpp"
 #include "font.hpp"
 #include "frame_buffer_config.hpp"
@@ -25,16 +27,19 @@
 #include "layer.hpp"
 #include "logger.hpp"
 #include "memory_manager.hpp"
+#include "page_cache.hpp"
 #include "memory_map.hpp"
 #include "message.hpp"
 #include "mouse.hpp"
 #include "paging.hpp"
 #include "pci.hpp"
 #include "segment.hpp"
+#include "shm.hpp"
 #include "syscall.hpp"
 #include "task.hpp"
 #include "terminal.hpp"
 #include "timer.hpp"
+#include "uaccess.hpp"
 #include "usb/xhci/xhci.hpp"
 #include "window.hpp"
 
@@ -167,7 +172,7 @@ void InputTextWindow(char c) {
     DrawTextCursor(true);
   }
 
-  layer_manager->Draw(text_window_layer_id);;
+  AddLayerDamage(text_window_layer_id);
 }
 
 alignas(16) uint8_t kernel_main_stack[1024 * 1024];
@@ -189,6 +194,8 @@ extern "C" void KernelMainNewStack(
   InitializeSegmentation();
   InitializePaging();
   InitializeMemoryManager(memory_map);
+  InitializePageCache();
+  InitializeSharedMemory();
   InitializeTSS();
   InitializeInterrupt();
 
@@ -199,7 +206,7 @@ extern "C" void KernelMainNewStack(
   InitializeLayer();
   InitializeMainWindow();
   InitializeTextWindow();
-  layer_manager->Draw({{0, 0}, ScreenSize()});
+  AddDamage({{0, 0}, ScreenSize()});
   
   acpi::Initialize(acpi_table);
   InitializeLAPICTimer();
@@ -213,10 +220,14 @@ extern "C" void KernelMainNewStack(
   });
   bool textbox_cursor_visible = false;;
 
+  InitializeUserAccess();
+  InitializeCPULocal();
   InitializeSyscall();
 
   InitializeTask();
   Task& main_task = task_manager->CurrentTask();
+  InitializeReadAhead();
+  InitializeCompositor();
 
   usb::xhci::Initialize();
   InitializeKeyboard();
@@ -229,6 +240,7 @@ extern "C" void KernelMainNewStack(
     .Wakeup();
 
   char str[128];
+  unsigned long shown_tick = std::numeric_limits<unsigned long>::max();
 
   while (true) {
 
@@ -236,20 +248,24 @@ extern "C" void KernelMainNewStack(
     const auto tick = timer_manager->CurrentTick();
     __asm__("sti");
 
-    sprintf(str, "%010lu", tick);
-    FillRectangle(
-      *main_window->InnerWriter(),
-      {20, 4},
-      {8 * 10, 16},
-      {0xc6, 0xc6, 0xc6}
-    );
-    WriteString(
-      *main_window->InnerWriter(),
-      {20, 4},
-      str,
-      {0, 0, 0}
-    );
-    layer_manager->Draw(main_window_layer_id);
+    // 表示が変わるときだけ描き直す. 実際の描画は合成タスクがフレームごとにまとめて行う
+    if (tick != shown_tick) {
+      shown_tick = tick;
+      sprintf(str, "%010lu", tick);
+      FillRectangle(
+        *main_window->InnerWriter(),
+        {20, 4},
+        {8 * 10, 16},
+        {0xc6, 0xc6, 0xc6}
+      );
+      WriteString(
+        *main_window->InnerWriter(),
+        {20, 4},
+        str,
+        {0, 0, 0}
+      );
+      AddLayerDamage(main_window_layer_id);
+    }
 
     __asm__("cli");
     auto msg = main_task.ReceiveMessage();
@@ -278,7 +294,7 @@ extern "C" void KernelMainNewStack(
           __asm__("sti");
           textbox_cursor_visible = !textbox_cursor_visible;;
           DrawTextCursor(textbox_cursor_visible);
-          layer_manager->Draw(text_window_layer_id);
+          AddLayerDamage(text_window_layer_id);
         }
         break;
       case Message::kKeyPush:
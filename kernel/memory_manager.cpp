@@ -5,7 +5,8 @@
 BitmapMemoryManager::BitmapMemoryManager()
   : alloc_map_ {},
     range_begin_ { FrameID { 0 } },
-    range_end_ { FrameID { kFrameCount } } {
+    range_end_ { FrameID { kFrameCount } },
+    allocated_frames_ { 0 } {
 }
 
 WithError<FrameID> BitmapMemoryManager::Allocate(size_t num_frames) {
@@ -61,6 +62,7 @@ void BitmapMemoryManager::MarkAllocated(FrameID start_frame, size_t num_frames)
 void BitmapMemoryManager::SetMemoryRange(FrameID range_begin, FrameID range_end) {
   range_begin_ = range_begin;
   range_end_ = range_end;
+  allocated_frames_ = Stat().allocated_frames;
 }
 
 MemoryStat BitmapMemoryManager::Stat() const {
@@ -86,6 +88,15 @@ void BitmapMemoryManager::SetBit(FrameID frame, bool allocated) {
   auto line_index = frame.ID() / kBitsPerMapLine;
   auto bit_index = frame.ID() % kBitsPerMapLine;
 
+  if (GetBit(frame) != allocated
+      && range_begin_.ID() <= frame.ID() && frame.ID() < range_end_.ID()) {
+    if (allocated) {
+      allocated_frames_++;
+    } else {
+      allocated_frames_--;
+    }
+  }
+
   if (allocated) {
     alloc_map_[line_index] |= (static_cast<MapLineType>(1) << bit_index);
   } else {
@@ -98,6 +98,15 @@ class BitmapMemoryManager {
    */
   MemoryStat Stat() const;
 
+  /**
+   * @brief 空きフレームの数を返す.
+   *
+   * Statと違いビットマップを走査しないので, 割り当てのたびに呼んでもよい.
+   */
+  size_t FreeFrames() const {
+    return range_end_.ID() - range_begin_.ID() - allocated_frames_;
+  }
+
   private:
     std::array<MapLineType, kFrameCount / kBitsPerMapLine> alloc_map_;
 
@@ -105,6 +114,8 @@ class BitmapMemoryManager {
     FrameID range_begin_;
     /** @brief このメモリマネージャでメモリ範囲の終点. 最終フレームの次のフレーム. */
     FrameID range_end_;
+    /** @brief メモリ範囲内で割り当て済みのフレーム数. */
+    size_t allocated_frames_;
 
     bool GetBit(FrameID frame) const;
     void SetBit(FrameID frame, bool allocated);
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <array>
+#include <cstdint>
+
 enum class LayerOperation {
   Move, MoveRelative, Draw, DrawArea
 };
@@ -14,7 +17,6 @@ struct Message {
     kMouseMove,
     kMouseButton,
     kWindowActive,
-    kPipe,
     kWindowClose,
   } type;
 
@@ -56,13 +58,66 @@ struct Message {
       int activate; // 1: activate, 0: deactivate
     } window_active;
 
-    struct {
-      char data[16];
-      uint8_t len;
-    } pipe;
-
     struct {
       unsigned int layer_id;
     } window_close;
   } arg;
+
+  /**
+   * @brief 元になった入力を受け取った時刻（rdtsc）. 無ければ0.
+   *
+   * 入力から画面に反映されるまでの遅延を測るため, 入力を処理して出したメッセージへ引き継ぐ.
+   */
+  uint64_t origin_tsc;
 };
+
+/** @brief メッセージの優先度による分類. 値の大きい分類のメッセージから先に受け取る. */
+enum class MessageClass {
+  kTimer,     // カーソルの点滅などのタイマー
+  kLayer,     // 描画とウィンドウの操作
+  kInterrupt, // 割り込みの後処理
+  kInput,     // キーボードとマウス, 及びそれらと順序を保つウィンドウの状態の変化
+};
+
+const int kNumMessageClasses = 4;
+
+inline MessageClass ClassOf(Message::Type type) {
+  switch (type) {
+    case Message::kKeyPush:
+    case Message::kMouseMove:
+    case Message::kMouseButton:
+    // アクティブ化や閉じる操作より後の入力が先に届かないよう, 入力と同じ分類にする
+    case Message::kWindowActive:
+    case Message::kWindowClose:
+      return MessageClass::kInput;
+    case Message::kInterruptXHCI:
+      return MessageClass::kInterrupt;
+    case Message::kTimerTimeout:
+      return MessageClass::kTimer;
+    default:
+      return MessageClass::kLayer;
+  }
+}
+
+/** @brief タスクのメッセージキューの, 分類ごとの統計. */
+struct MessageQueueStat {
+  uint64_t received;
+  uint64_t max_depth;
+  /** @brief 送られてから受け取られるまでのサイクル数. */
+  uint64_t total_wait_cycles;
+  uint64_t max_wait_cycles;
+};
+
+/** @brief key_echo_latency の最初の区間の上限（2の冪指数）と区間の数. */
+const int kKeyEchoLatencyShift = 16;
+const int kKeyEchoLatencyBuckets = 16;
+
+/**
+ * @brief キーを押してからターミナルのエコーが描画されるまでのサイクル数の分布.
+ *
+ * 区間iは [2^(shift+i-1), 2^(shift+i)) を数える. 先頭と末尾の区間はそれより外側も含む.
+ */
+extern std::array<uint64_t, kKeyEchoLatencyBuckets> key_echo_latency;
+
+/** @brief origin_tscから現在までのサイクル数を key_echo_latency に数える. */
+void RecordKeyEcho(uint64_t origin_tsc);
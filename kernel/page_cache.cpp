@@ -0,0 +1,296 @@
+#include "page_cache.hpp"
+
+#include <algorithm>
+#include "asmfunc.h"
+#include "memory_manager.hpp"
+#include "paging.hpp"
+#include "task.hpp"
+
+WithError<uintptr_t> PageCache::Get(FileDescriptor& fd,
+                                    uint64_t offset,
+                                    PageMapEntry* entry) {
+  const Key key{ fd.Identity(), offset };
+
+  if (key.file == nullptr) {
+    return { 0, MAKE_ERROR(Error::kNotImplemented) };
+  }
+
+  if (auto frame_addr = Find(fd, offset, entry)) {
+    return { frame_addr, MAKE_ERROR(Error::kSuccess) };
+  }
+
+  uintptr_t frame_addr;
+  bool owned = false;
+
+  if (auto direct = fd.DirectPage(offset)) {
+    frame_addr = reinterpret_cast<uintptr_t>(direct);
+  } else {
+    auto [ frame, err ] = NewPageMap();
+
+    if (err) {
+      return { 0, err };
+    }
+
+    frame_addr = reinterpret_cast<uintptr_t>(frame);
+    owned = true;
+    fd.Load(frame, 4096, offset);
+  }
+
+  Insert(key, frame_addr, entry, owned);
+  return { frame_addr, MAKE_ERROR(Error::kSuccess) };
+}
+
+uintptr_t PageCache::Find(const FileDescriptor& fd,
+                          uint64_t offset,
+                          PageMapEntry* entry) {
+  auto it = index_.find(Key{ fd.Identity(), offset });
+
+  if (it == index_.end() || it->first.file == nullptr) {
+    return 0;
+  }
+
+  auto& page = pages_[it->second];
+  page.maps.push_back(entry);
+  page.referenced = true;
+  return it->second;
+}
+
+void PageCache::Prefetch(FileDescriptor& fd, uint64_t offset) {
+  const Key key{ fd.Identity(), offset };
+
+  if (key.file == nullptr || index_.count(key) > 0) {
+    return;
+  }
+
+  if (auto direct = fd.DirectPage(offset)) {
+    Insert(key, reinterpret_cast<uintptr_t>(direct), nullptr, false);
+    return;
+  }
+
+  auto frame = memory_manager->Allocate(1);
+
+  if (frame.error) {
+    return;
+  }
+
+  auto page = frame.value.Frame();
+  memset(page, 0, 4096);
+  fd.Load(page, 4096, offset);
+  Insert(key, reinterpret_cast<uintptr_t>(page), nullptr, true);
+}
+
+bool PageCache::Release(uintptr_t frame_addr, PageMapEntry* entry) {
+  if (auto anon = anonymous_refs_.find(frame_addr);
+      anon != anonymous_refs_.end()) {
+    if (--anon->second == 0) {
+      anonymous_refs_.erase(anon);
+      memory_manager->Free(FrameID{ frame_addr / kBytesPerFrame }, 1);
+    }
+    return true;
+  }
+
+  auto it = pages_.find(frame_addr);
+
+  if (it == pages_.end()) {
+    return false;
+  }
+
+  auto& maps = it->second.maps;
+  maps.erase(std::remove(maps.begin(), maps.end(), entry), maps.end());
+
+  if (maps.empty() && !it->second.indexed) {
+    Drop(it);
+  }
+
+  return true;
+}
+
+void PageCache::AddAnonymousRef(uintptr_t frame_addr, int refs) {
+  anonymous_refs_[frame_addr] += refs;
+}
+
+int PageCache::AnonymousRefs(uintptr_t frame_addr) const {
+  auto it = anonymous_refs_.find(frame_addr);
+  return it == anonymous_refs_.end() ? 0 : it->second;
+}
+
+bool PageCache::Unshare(uintptr_t frame_addr) {
+  auto it = anonymous_refs_.find(frame_addr);
+
+  if (it == anonymous_refs_.end() || it->second != 1) {
+    return false;
+  }
+
+  anonymous_refs_.erase(it);
+  return true;
+}
+
+void PageCache::Invalidate(const void* file_identity) {
+  auto it = index_.lower_bound(Key{ file_identity, 0 });
+
+  while (it != index_.end() && it->first.file == file_identity) {
+    auto page = pages_.find(it->second);
+    it = index_.erase(it);
+    page->second.indexed = false;
+
+    if (page->second.maps.empty()) {
+      Drop(page);
+    }
+  }
+}
+
+size_t PageCache::Reclaim(size_t num_frames) {
+  size_t num_freed = 0;
+  bool unmapped = false;
+  // 全ページの参照記録を消して一周し, 二周目で追い出せる長さ
+  size_t steps = 2 * pages_.size();
+  auto it = pages_.lower_bound(clock_hand_);
+
+  for (; num_freed < num_frames && steps > 0 && !pages_.empty(); steps--) {
+    if (it == pages_.end()) {
+      it = pages_.begin();
+    }
+
+    // ボリュームイメージ上のページは追い出してもフレームが空かない
+    if (!it->second.owned || TestAndClearReferenced(it->second)) {
+      ++it;
+      continue;
+    }
+
+    for (auto entry : it->second.maps) {
+      entry->data = 0;
+      unmapped = true;
+    }
+
+    auto next = std::next(it);
+    Drop(it);
+    it = next;
+    num_freed++;
+  }
+
+  clock_hand_ = it == pages_.end() ? 0 : it->first;
+
+  if (unmapped) {
+    // 追い出したページは他のアドレス空間にもマップされ得るが,
+    // それらのTLBはCR3の切り替えで消えるので現在の空間だけ消せばよい
+    SetCR3(GetCR3());
+  }
+
+  return num_freed;
+}
+
+void PageCache::Drop(std::map<uintptr_t, Page>::iterator it) {
+  if (it->second.indexed) {
+    index_.erase(it->second.key);
+  }
+
+  if (it->second.owned) {
+    memory_manager->Free(FrameID{ it->first / kBytesPerFrame }, 1);
+  }
+
+  pages_.erase(it);
+}
+
+void PageCache::Insert(const Key& key,
+                       uintptr_t frame_addr,
+                       PageMapEntry* entry,
+                       bool owned) {
+  Page page{ key, {}, true, owned, true };
+
+  if (entry) {
+    page.maps.push_back(entry);
+  }
+
+  index_[key] = frame_addr;
+  pages_[frame_addr] = std::move(page);
+}
+
+bool PageCache::TestAndClearReferenced(Page& page) {
+  bool referenced = page.referenced;
+  page.referenced = false;
+
+  for (auto entry : page.maps) {
+    referenced |= entry->bits.accessed;
+    entry->bits.accessed = 0;
+  }
+
+  return referenced;
+}
+
+PageCache* page_cache;
+
+void InitializePageCache() {
+  page_cache = new PageCache;
+}
+
+namespace {
+  struct ReadAheadRequest {
+    std::shared_ptr<FileDescriptor> file;
+    uint64_t offset;
+    size_t num_pages;
+  };
+
+  /** @brief 溜めておく先読み依頼の上限. 溢れた依頼は捨てる. */
+  const size_t kMaxReadAheadRequests = 32;
+
+  std::deque<ReadAheadRequest>* read_ahead_requests;
+  Task* read_ahead_task;
+
+  void TaskReadAhead(uint64_t task_id, int64_t data) {
+    __asm__("cli");
+    auto& task = task_manager->CurrentTask();
+    __asm__("sti");
+
+    while (true) {
+      __asm__("cli");
+
+      if (read_ahead_requests->empty()) {
+        task.Sleep();
+        __asm__("sti");
+        continue;
+      }
+
+      auto req = read_ahead_requests->front();
+      read_ahead_requests->pop_front();
+      __asm__("sti");
+
+      const size_t file_size = req.file->Size();
+
+      for (size_t i = 0; i < req.num_pages; i++) {
+        const uint64_t offset = req.offset + 4096 * i;
+
+        if (offset >= file_size) {
+          break;
+        }
+
+        // 1ページずつ割り込みを許可し, フォルトしたタスクを待たせすぎない
+        __asm__("cli");
+        page_cache->Prefetch(*req.file, offset);
+        __asm__("sti");
+      }
+    }
+  }
+} // namespace
+
+void RequestReadAhead(std::shared_ptr<FileDescriptor> file,
+                      uint64_t offset,
+                      size_t num_pages) {
+  if (read_ahead_task == nullptr
+      || read_ahead_requests->size() >= kMaxReadAheadRequests) {
+    return;
+  }
+
+  read_ahead_requests->push_back(ReadAheadRequest{
+    std::move(file),
+    offset,
+    num_pages
+  });
+  read_ahead_task->Wakeup();
+}
+
+void InitializeReadAhead() {
+  read_ahead_requests = new std::deque<ReadAheadRequest>;
+  read_ahead_task = &task_manager->NewTask()
+    .InitContext(TaskReadAhead, 0)
+    .Wakeup();
+}
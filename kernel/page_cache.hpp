@@ -0,0 +1,143 @@
+/**
+ * @file page_cache.hpp
+ *
+ * メモリマップされたファイルのページキャッシュ.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <vector>
+#include "error.hpp"
+#include "file.hpp"
+#include "paging.hpp"
+
+/**
+ * @brief (ファイル, ページオフセット) をキーとして, ファイル内容を保持する物理フレームを共有する.
+ *
+ * 同じファイルをマップした全てのタスクは同じフレームを読み込み専用でマップする.
+ * フレームごとにマップしているページエントリを覚えておき, メモリが不足したときは
+ * クロックアルゴリズムで最近参照されていないページを選んでエントリごと追い出す.
+ * ページは常に読み込み専用でマップされるので, 追い出しても書き戻しは不要.
+ */
+class PageCache {
+  public:
+    /**
+     * @brief ファイルのoffsetから始まる4KiBを保持するフレームを返し, entryをその参照として登録する.
+     *
+     * キャッシュに無ければ, ファイルが提供する直接マップ用のメモリを使うか,
+     * 新しいフレームを割り当ててファイル内容を読み込む.
+     *
+     * @param offset ファイル内オフセット（4KiBの倍数）
+     * @param entry フレームをマップするページエントリ. 設定は呼び出し側で行う
+     * @return フレームの物理アドレス. ファイルがキャッシュに対応しない場合はkNotImplemented
+     */
+    WithError<uintptr_t> Get(FileDescriptor& fd,
+                             uint64_t offset,
+                             PageMapEntry* entry);
+
+    /** @brief キャッシュ済みのページならGetと同様にフレームを返す. 無ければ0. */
+    uintptr_t Find(const FileDescriptor& fd,
+                   uint64_t offset,
+                   PageMapEntry* entry);
+
+    /**
+     * @brief ページを参照せずにキャッシュへ読み込む（先読み用）.
+     *
+     * 空きフレームが無い場合はキャッシュを追い出さずに諦める.
+     */
+    void Prefetch(FileDescriptor& fd, uint64_t offset);
+
+    /**
+     * @brief Getで登録したページエントリの参照を外す.
+     *
+     * AddAnonymousRefで共有した無名ページなら参照を1つ減らし, 最後の参照ならフレームを解放する.
+     *
+     * @return フレームがキャッシュの管理下に無ければfalse
+     */
+    bool Release(uintptr_t frame_addr, PageMapEntry* entry);
+
+    /**
+     * @brief アプリの無名ページのフレームに参照をrefs個追加する.
+     *
+     * パイプでページを受け渡すときに使う. 無名ページは追い出しの対象にならない.
+     * 参照を持つページエントリ（あるいはパイプ）はReleaseで参照を手放す.
+     */
+    void AddAnonymousRef(uintptr_t frame_addr, int refs = 1);
+
+    /** @brief 共有した無名ページなら参照数を返す. そうでなければ0. */
+    int AnonymousRefs(uintptr_t frame_addr) const;
+
+    /**
+     * @brief 参照が1つだけ残った無名ページを共有の管理から外す.
+     *
+     * @return 外したらtrue. 呼び出し側は残った参照を共有していないページとして扱う
+     */
+    bool Unshare(uintptr_t frame_addr);
+
+    /**
+     * @brief 指定されたファイルのページをキャッシュから外す.
+     *
+     * ファイルへ書き込んだときに呼ぶ. マップ中のページは参照が無くなった時点で解放される.
+     */
+    void Invalidate(const void* file_identity);
+
+    /**
+     * @brief 最近参照されていないページを追い出し, 最大num_frames個のフレームを解放する.
+     *
+     * 追い出したページをマップしていたエントリは非存在にする.
+     * 次にアクセスされるとページフォルトを経て読み込み直される.
+     *
+     * @return 解放したフレーム数
+     */
+    size_t Reclaim(size_t num_frames);
+
+  private:
+    struct Key {
+      const void* file;
+      uint64_t offset;
+
+      bool operator<(const Key& rhs) const {
+        return file < rhs.file || (file == rhs.file && offset < rhs.offset);
+      }
+    };
+
+    struct Page {
+      Key key;
+      std::vector<PageMapEntry*> maps; // このフレームをマップしているページエントリ
+      bool referenced; // 前回クロックの針が通過した後に使われた
+      bool owned;   // フレームをキャッシュが割り当てた（ボリュームイメージ上のページではない）
+      bool indexed; // index_から辿れる. falseならInvalidate済み
+    };
+
+    std::map<Key, uintptr_t> index_{};
+    std::map<uintptr_t, Page> pages_{};
+    std::map<uintptr_t, int> anonymous_refs_{};
+    uintptr_t clock_hand_{0};
+
+    void Drop(std::map<uintptr_t, Page>::iterator it);
+    void Insert(const Key& key, uintptr_t frame_addr, PageMapEntry* entry, bool owned);
+
+    /** @brief ページが最近使われたかを返し, 使用の記録（アクセス済みビットを含む）を消す. */
+    bool TestAndClearReferenced(Page& page);
+};
+
+extern PageCache* page_cache;
+
+void InitializePageCache();
+
+/**
+ * @brief ファイルの [offset, offset + 4KiB * num_pages) の先読みを先読みタスクへ依頼する.
+ *
+ * 読み込みは先読みタスクで非同期に行われる. 割り込み禁止状態で呼ぶこと.
+ */
+void RequestReadAhead(std::shared_ptr<FileDescriptor> file,
+                      uint64_t offset,
+                      size_t num_pages);
+
+/** @brief 先読みタスクを起動する. InitializeTaskの後に呼ぶ. */
+void InitializeReadAhead();
@@ -1,34 +1,52 @@
+#include <algorithm>
 #include <array>
 #include "asmfunc.h"
+#include "cpu_local.hpp"
 #include "logger.hpp"
 #include "memory_manager.hpp"
+#include "page_cache.hpp"
+#include "reclaim.hpp"
 #include "paging.hpp"
+#include "shm.hpp"
 #include "task.hpp"
+#include "vma.hpp"
+#include "window.hpp"
 
 namespace {
   const uint64_t kPageSize4K = 4096;
   const uint64_t kPageSize2M = 512 * kPageSize4K;
   const uint64_t kPageSize1G = 512 * kPageSize2M;
 
+  const uint64_t kCR0WP = 1u << 16;
+  const uint64_t kCR4PGE = 1u << 7;
+
   alignas(kPageSize4K) std::array<uint64_t, 512> pml4_table;
-  alignas(kPageSize4K) std::array<uint64_t, 512> pdp_table;
+  alignas(kPageSize4K)
+    std::array<std::array<uint64_t, 512>, kKernelPDPTCount> pdp_tables;
   alignas(kPageSize4K)
     std::array<std::array<uint64_t, 512>, kPageDirectoryCount> page_directory;
 }
 
 void SetupIdentityPageTable() {
 
-  pml4_table[0] = reinterpret_cast<uint64_t>(&pdp_table[0]) | 0x003;
+  for (int i_pml4 = 0; i_pml4 < pdp_tables.size(); i_pml4++) {
+    pml4_table[i_pml4] =
+      reinterpret_cast<uint64_t>(&pdp_tables[i_pml4]) | 0x003;
+  }
 
   for (int i_pdpt = 0; i_pdpt < page_directory.size(); i_pdpt++) {
-    pdp_table[i_pdpt] = reinterpret_cast<uint64_t>(&page_directory[i_pdpt]) | 0x003;
+    pdp_tables[i_pdpt / 512][i_pdpt % 512] =
+      reinterpret_cast<uint64_t>(&page_directory[i_pdpt]) | 0x003;
     for (int i_pd = 0; i_pd < 512; i_pd++) {
-      page_directory[i_pdpt][i_pd] = i_pdpt * kPageSize1G + i_pd * kPageSize2M | 0x083;
+      // 0x100: グローバルページ. CR3を切り替えてもTLBから追い出されない
+      page_directory[i_pdpt][i_pd] = i_pdpt * kPageSize1G + i_pd * kPageSize2M | 0x183;
     }
   }
 
   ResetCR3();
-  SetCR0(GetCR0() & 0xfffeffff); // Clear WP
+  SetCR4(GetCR4() | kCR4PGE);
+  // WP: カーネルからの書き込みでも読み込み専用ページを保護し, 共有ページの複製を起こさせる
+  SetCR0(GetCR0() | kCR0WP);
 }
 
 void InitializePaging() {
@@ -40,176 +58,323 @@ void ResetCR3() {
 }
 
 namespace {
-  
-  WithError<PageMapEntry*> SetNewPageMapIfNotPresent(PageMapEntry& entry) {
-    if (entry.bits.present) {
-      return { entry.Pointer(), MAKE_ERROR(Error::kSuccess) };
-    }
 
-    auto [ child_map, err ] = NewPageMap();
+  /**
+   * @brief ページテーブルを解放するたびに増える世代番号.
+   *
+   * PageMapCursorはこの値が変わったらキャッシュを破棄する.
+   */
+  uint64_t page_map_generation = 1;
 
-    if (err) {
-      return { nullptr, err };
-    }
+  /** @brief 1エントリずつinvlpgする上限. これを超えたらCR3を再設定する. */
+  const size_t kMaxInvalidatePages = 32;
 
-    entry.SetPointer(child_map);
-    entry.bits.present = 1;
-
-    return { child_map, MAKE_ERROR(Error::kSuccess) };
+  /** @brief 48ビットの仮想アドレス空間に収まるようにアドレスを切り詰める. */
+  uint64_t Truncate48(uint64_t addr) {
+    return addr & 0x0000'ffff'ffff'ffff;
   }
 
-  WithError<size_t> SetupPageMap(PageMapEntry* page_map,
-                                 int page_map_level,
-                                 LinearAddress4Level addr,
-                                 size_t num_4kpages,
-                                 bool writable) {
-    while (num_4kpages > 0) {
+  bool IsEmptyPageMap(const PageMapEntry* table) {
+    for (int i = 0; i < 512; i++) {
+      if (table[i].bits.present) {
+        return false;
+      }
+    }
+    return true;
+  }
 
-      const auto entry_index = addr.Part(page_map_level);
-      auto [ child_map, err ] = SetNewPageMapIfNotPresent(page_map[entry_index]);
+  /**
+   * @brief table（page_map_level段目）のうち [first, last] と重なる範囲を解放する.
+   *
+   * 範囲に完全に含まれる, あるいは解放後に空になった下位のテーブルも解放する.
+   *
+   * @param table_base table の先頭エントリが指す仮想アドレス（48ビット）
+   * @param first 解放する範囲の先頭アドレス（48ビット）
+   * @param last 解放する範囲の末尾アドレス（48ビット, 範囲に含む）
+   */
+  Error CleanPageMap(PageMapEntry* table,
+                     int page_map_level,
+                     uint64_t table_base,
+                     uint64_t first,
+                     uint64_t last) {
+    const uint64_t entry_bytes = kPageSize4K << (9 * (page_map_level - 1));
+    const int i_first = first <= table_base
+      ? 0
+      : (first - table_base) / entry_bytes;
+    const int i_last = std::min<uint64_t>(511, (last - table_base) / entry_bytes);
+
+    for (int i = i_first; i <= i_last; i++) {
+      auto& entry = table[i];
 
-      if (err) {
-        return { num_4kpages, err };
+      if (!entry.bits.present) {
+        continue;
       }
 
-      page_map[entry_index].bits.writable = 1;
-      page_map[entry_index].bits.user = 1;
-
       if (page_map_level == 1) {
-        page_map[entry_index].bits.writable = writable;
-        num_4kpages--;
-      } else {
-        page_map[entry_index].bits.writable = true;
-        auto [ num_remain_pages, err ] = SetupPageMap(
-          child_map,
-          page_map_level - 1,
-          addr,
-          num_4kpages,
-          writable
-        );
+        const auto entry_addr = reinterpret_cast<uintptr_t>(entry.Pointer());
+
+        if (entry.bits.pinned) {
+          // 所有者（ウィンドウなど）がフレームを解放する
+        } else if (entry.bits.shared) {
+          page_cache->Release(entry_addr, &entry);
+        } else {
+          const FrameID map_frame { entry_addr / kBytesPerFrame };
 
-        if (err) {
-          return { num_4kpages, err };
+          if (auto err = memory_manager->Free(map_frame, 1)) {
+            return err;
+          }
         }
 
-        num_4kpages = num_remain_pages;
+        entry.data = 0;
+        continue;
       }
 
-      if (entry_index == 511) {
-        break;
+      const uint64_t entry_base = table_base + i * entry_bytes;
+      const uint64_t entry_last = entry_base + (entry_bytes - 1);
+      auto child_map = entry.Pointer();
+
+      if (auto err = CleanPageMap(
+          child_map,
+          page_map_level - 1,
+          entry_base,
+          first,
+          last
+        )) {
+        return err;
       }
 
-      addr.SetPart(page_map_level, entry_index + 1);
+      if ((first <= entry_base && entry_last <= last)
+          || IsEmptyPageMap(child_map)) {
+        entry.data = 0;
 
-      for (int level = page_map_level - 1; level >= 1; level--) {
-        addr.SetPart(level, 0);
+        if (auto err = FreePageMap(child_map)) {
+          return err;
+        }
       }
     }
 
-    return { num_4kpages, MAKE_ERROR(Error::kSuccess) };
+    return MAKE_ERROR(Error::kSuccess);
   }
 
-  Error CleanPageMap(PageMapEntry* page_map,
-                     int page_map_level,
-                     LinearAddress4Level addr) {
-    for (int i = addr.Part(page_map_level); i < 512; i++) {
-      auto entry = page_map[i];
+  /** @brief 順次アクセスと判断したときの先読みページ数の初期値と上限. */
+  const size_t kReadAheadInitPages = 4;
+  const size_t kReadAheadMaxPages = 64;
 
-      if (!entry.bits.present) {
-        continue;
+  /** @brief ページキャッシュのフレームを読み込み専用の共有ページとしてエントリに設定する. */
+  void SetSharedPage(PageMapEntry& entry, uintptr_t frame_addr) {
+    entry.data = 0;
+    entry.SetPointer(reinterpret_cast<PageMapEntry*>(frame_addr));
+    entry.bits.present = 1;
+    entry.bits.user = 1;
+    entry.bits.shared = 1;
+  }
+
+  /** @brief フォルトしたページが直前のフォルトに続くかを見て, 先読みページ数を更新する. */
+  void UpdateReadAhead(VirtualMemoryArea& vma, uint64_t page_index) {
+    switch (vma.advice) {
+      case VirtualMemoryArea::kRandom:
+        vma.read_ahead_pages = 0;
+        return;
+      case VirtualMemoryArea::kSequential:
+        vma.read_ahead_pages = kReadAheadMaxPages;
+        return;
+      default:
+        break;
+    }
+
+    if (page_index != vma.next_fault_page) {
+      vma.read_ahead_pages = 0;
+    } else if (vma.read_ahead_pages == 0) {
+      vma.read_ahead_pages = kReadAheadInitPages;
+    } else {
+      vma.read_ahead_pages =
+        std::min(2 * vma.read_ahead_pages, kReadAheadMaxPages);
+    }
+  }
+
+  Error PreparePageCache(VirtualMemoryArea& vma,
+                         uint64_t causal_vaddr,
+                         PageMapCursor& cursor) {
+    LinearAddress4Level page_vaddr{causal_vaddr};
+    page_vaddr.parts.offset = 0;
+    const uint64_t page_index = (page_vaddr.value - vma.begin) / kPageSize4K;
+    const long file_offset = page_vaddr.value - vma.begin + vma.file_offset;
+
+    auto pml4_table = reinterpret_cast<PageMapEntry*>(GetCR3());
+    auto [ entry, err ] = cursor.Lookup(pml4_table, page_vaddr, true);
+
+    if (err) {
+      return err;
+    }
+
+    auto [ frame_addr, err_cache ] =
+      page_cache->Get(*vma.file, file_offset, entry);
+
+    if (err_cache.Cause() == Error::kNotImplemented) {
+      // キャッシュに対応しないファイルはタスク専用のページへ読み込む
+      if (auto err = SetupPageMaps(page_vaddr, 1, true, &cursor)) {
+        return err;
       }
+      void* page = reinterpret_cast<void*>(page_vaddr.value);
+      vma.file->Load(page, 4096, file_offset);
 
-      if (page_map_level > 1) {
-        if (auto err = CleanPageMap(
-            entry.Pointer(),
-            page_map_level - 1,
-            addr
-          )) {
-          return err;
-        }
+      if (!vma.writable) {
+        ProtectPageMaps(page_vaddr, 1, false);
+      }
+      return MAKE_ERROR(Error::kSuccess);
+    } else if (err_cache) {
+      return err_cache;
+    }
+
+    // 共有ページは読み込み専用でマップし, 書き込まれたらCopyOnePageで複製する
+    SetSharedPage(*entry, frame_addr);
+    UpdateReadAhead(vma, page_index);
+
+    // 先読み済みのページはまとめてマップし, 以降のフォルトを省く
+    const uint64_t vma_pages = vma.size / kPageSize4K;
+    const uint64_t end_page =
+      std::min(page_index + 1 + vma.read_ahead_pages, vma_pages);
+    uint64_t next_page = page_index + 1;
+
+    for (; next_page < end_page; next_page++) {
+      LinearAddress4Level vaddr{vma.begin + next_page * kPageSize4K};
+      auto [ entry, err ] = cursor.Lookup(pml4_table, vaddr, true);
+
+      if (err || entry->bits.present) {
+        break;
       }
 
-      if (entry.bits.writable) {
-        const auto entry_addr = reinterpret_cast<uintptr_t>(entry.Pointer());
-        const FrameID map_frame { entry_addr / kBytesPerFrame };
-  
-        if (auto err = memory_manager->Free(map_frame, 1)) {
-          return err;
-        }
+      const auto frame_addr = page_cache->Find(
+        *vma.file,
+        vma.file_offset + next_page * kPageSize4K,
+        entry
+      );
+
+      if (frame_addr == 0) {
+        break;
       }
 
-      page_map[i].data = 0;
+      SetSharedPage(*entry, frame_addr);
     }
 
-    return MAKE_ERROR(Error::kSuccess);
-  }
+    vma.next_fault_page = next_page;
 
-  const FileMapping* FindFileMapping(const std::vector<FileMapping>& fmaps,
-                                     uint64_t causal_vaddr) {
-    for (const FileMapping& m : fmaps) {
-      if (m.vaddr_begin <= causal_vaddr && causal_vaddr < m.vaddr_end) {
-        return &m;
-      }
+    if (vma.read_ahead_pages > 0 && next_page < vma_pages) {
+      RequestReadAhead(
+        vma.file,
+        vma.file_offset + next_page * kPageSize4K,
+        std::min(vma.read_ahead_pages, vma_pages - next_page)
+      );
     }
 
-    return nullptr;
+    return MAKE_ERROR(Error::kSuccess);
   }
 
-  Error PreparePageCache(FileDescriptor& fd,
-                         const FileMapping& m,
-                         uint64_t causal_vaddr) {
+  /** @brief ウィンドウの影バッファのうちフォルトしたページを, 共有したままマップする. */
+  Error PrepareWindowBuffer(VirtualMemoryArea& vma,
+                            uint64_t causal_vaddr,
+                            PageMapCursor& cursor) {
     LinearAddress4Level page_vaddr{causal_vaddr};
     page_vaddr.parts.offset = 0;
+    const uint64_t offset = page_vaddr.value - vma.begin + vma.file_offset;
 
-    if (auto err = SetupPageMaps(page_vaddr, 1)) {
-      return err;
+    if (offset >= vma.window->PinnedBufferBytes()) {
+      return MAKE_ERROR(Error::kIndexOutOfRange);
     }
 
-    const long file_offset = page_vaddr.value - m.vaddr_begin;
-    void* page_cache = reinterpret_cast<void*>(page_vaddr.value);
-    fd.Load(page_cache, 4096, file_offset);
+    auto pml4_table = reinterpret_cast<PageMapEntry*>(GetCR3());
+    auto [ entry, err ] = cursor.Lookup(pml4_table, page_vaddr, true);
 
+    if (err) {
+      return err;
+    }
+
+    entry->data = 0;
+    entry->SetPointer(
+      reinterpret_cast<PageMapEntry*>(vma.window->PinnedBuffer() + offset));
+    entry->bits.present = 1;
+    entry->bits.writable = vma.writable;
+    entry->bits.user = 1;
+    entry->bits.pinned = 1;
     return MAKE_ERROR(Error::kSuccess);
   }
 
-  Error SetPageContent(PageMapEntry* table,
-                       int part,
-                       LinearAddress4Level addr,
-                       PageMapEntry* content) {
-    if (part == 1) {
-      const auto i = addr.Part(part);
-      table[i].SetPointer(content);
-      table[i].bits.writable = 1;
-      InvalidateTLB(addr.value);
-      return MAKE_ERROR(Error::kSuccess);
-    }
+  /** @brief 共有メモリのうちフォルトしたページを, 全てのタスクと同じフレームのままマップする. */
+  Error PrepareSharedMemory(VirtualMemoryArea& vma,
+                            uint64_t causal_vaddr,
+                            PageMapCursor& cursor) {
+    LinearAddress4Level page_vaddr{causal_vaddr};
+    page_vaddr.parts.offset = 0;
+    const uint64_t offset = page_vaddr.value - vma.begin + vma.file_offset;
 
-    const auto i = addr.Part(part);
-    return SetPageContent(table[i].Pointer(), part - 1, addr, content);
-  }
+    if (offset >= vma.shm->Bytes()) {
+      return MAKE_ERROR(Error::kIndexOutOfRange);
+    }
 
-  Error CopyOnePage(uint64_t causal_addr) {
-    auto [ p, err ] = NewPageMap();
+    auto pml4_table = reinterpret_cast<PageMapEntry*>(GetCR3());
+    auto [ entry, err ] = cursor.Lookup(pml4_table, page_vaddr, true);
 
     if (err) {
       return err;
     }
 
-    const auto aligned_addr = causal_addr & 0xffff'ffff'ffff'f000;
-    memcpy(p, reinterpret_cast<const void*>(aligned_addr), 4096);
-    return SetPageContent(
+    entry->data = 0;
+    entry->SetPointer(reinterpret_cast<PageMapEntry*>(vma.shm->Frame(offset)));
+    entry->bits.present = 1;
+    entry->bits.writable = vma.writable;
+    entry->bits.user = 1;
+    entry->bits.pinned = 1;
+    return MAKE_ERROR(Error::kSuccess);
+  }
+
+  Error CopyOnePage(uint64_t causal_addr, PageMapCursor& cursor) {
+    auto [ entry, err_lookup ] = cursor.Lookup(
       reinterpret_cast<PageMapEntry*>(GetCR3()),
-      4,
       LinearAddress4Level { causal_addr },
-      p
+      false
     );
+
+    if (err_lookup) {
+      return err_lookup;
+    } else if (entry == nullptr) {
+      return MAKE_ERROR(Error::kIndexOutOfRange);
+    }
+
+    const auto aligned_addr = causal_addr & 0xffff'ffff'ffff'f000;
+    const auto frame_addr = reinterpret_cast<uintptr_t>(entry->Pointer());
+
+    if (entry->bits.shared && page_cache->Unshare(frame_addr)) {
+      // パイプで渡された無名ページの最後の参照なので, 複製せずに自分のものにする
+      entry->bits.shared = 0;
+    } else if (entry->bits.shared) {
+      auto [ p, err ] = NewPageMap();
+
+      if (err) {
+        return err;
+      }
+
+      memcpy(p, reinterpret_cast<const void*>(aligned_addr), 4096);
+      page_cache->Release(frame_addr, entry);
+      entry->SetPointer(p);
+      entry->bits.shared = 0;
+    }
+
+    // 共有されていないページはmprotectで読み込み専用にされていただけなので, 複製は不要
+    entry->bits.writable = 1;
+    InvalidateTLB(aligned_addr);
+    return MAKE_ERROR(Error::kSuccess);
   }
 
 } // namespace
 
 WithError<PageMapEntry*> NewPageMap() {
+  ReclaimMemory(false);
   auto frame = memory_manager->Allocate(1);
 
+  if (frame.error && ReclaimMemory(true) > 0) {
+    frame = memory_manager->Allocate(1);
+  }
+
   if (frame.error) {
     return { nullptr, frame.error };
   }
@@ -220,20 +385,276 @@ WithError<PageMapEntry*> NewPageMap() {
 }
 
 Error FreePageMap(PageMapEntry* table) {
+  page_map_generation++;
   const FrameID frame { reinterpret_cast<uintptr_t>(table) / kBytesPerFrame };
   return memory_manager->Free(frame, 1);
 }
 
+WithError<PageMapEntry*> NewPML4() {
+  auto [ pml4, err ] = NewPageMap();
+
+  if (err) {
+    return { nullptr, err };
+  }
+
+  // カーネル空間は共有PDPTを指すだけなので, エントリの複製は不要
+  for (int i = 0; i < pdp_tables.size(); i++) {
+    pml4[i].data = pml4_table[i];
+  }
+
+  return { pml4, MAKE_ERROR(Error::kSuccess) };
+}
+
+WithError<PageMapEntry*> PageMapCursor::Lookup(PageMapEntry* pml4,
+                                               LinearAddress4Level addr,
+                                               bool create) {
+  const uint64_t base = addr.value & ~(kPageSize2M - 1);
+
+  if (table_ && pml4_ == pml4 && base_ == base
+      && generation_ == page_map_generation) {
+    return { &table_[addr.parts.page], MAKE_ERROR(Error::kSuccess) };
+  }
+
+  PageMapEntry* table = pml4;
+
+  for (int level = 4; level >= 2; level--) {
+    auto& entry = table[addr.Part(level)];
+
+    if (!entry.bits.present) {
+      if (!create) {
+        return { nullptr, MAKE_ERROR(Error::kSuccess) };
+      }
+
+      auto [ child_map, err ] = NewPageMap();
+
+      if (err) {
+        return { nullptr, err };
+      }
+
+      entry.SetPointer(child_map);
+      entry.bits.present = 1;
+    }
+
+    if (create) {
+      entry.bits.writable = 1;
+      entry.bits.user = 1;
+    }
+
+    table = entry.Pointer();
+  }
+
+  pml4_ = pml4;
+  base_ = base;
+  table_ = table;
+  generation_ = page_map_generation;
+  return { &table[addr.parts.page], MAKE_ERROR(Error::kSuccess) };
+}
+
 Error SetupPageMaps(LinearAddress4Level addr,
                     size_t num_4kpages,
-                    bool writable) {
+                    bool writable,
+                    PageMapCursor* cursor) {
+  PageMapCursor local_cursor;
+
+  if (cursor == nullptr) {
+    cursor = &local_cursor;
+  }
+
+  auto pml4_table = reinterpret_cast<PageMapEntry*>(GetCR3());
+  addr.parts.offset = 0;
+
+  for (; num_4kpages > 0; num_4kpages--) {
+    auto [ entry, err ] = cursor->Lookup(pml4_table, addr, true);
+
+    if (err) {
+      return err;
+    }
+
+    if (!entry->bits.present) {
+      auto [ page, err ] = NewPageMap();
+
+      if (err) {
+        return err;
+      }
+
+      entry->SetPointer(page);
+      entry->bits.present = 1;
+    }
+
+    entry->bits.writable = writable;
+    entry->bits.user = 1;
+
+    if (addr.value == 0xffff'ffff'ffff'f000) {
+      break;
+    }
+
+    addr.value += kPageSize4K;
+  }
+
+  return MAKE_ERROR(Error::kSuccess);
+}
+
+Error CleanPageMaps(LinearAddress4Level addr, size_t num_4kpages) {
+  if (num_4kpages == 0) {
+    return MAKE_ERROR(Error::kSuccess);
+  }
+
+  auto pml4_table = reinterpret_cast<PageMapEntry*>(GetCR3());
+  addr.parts.offset = 0;
+  const uint64_t first = Truncate48(addr.value);
+  const uint64_t last = Truncate48(addr.value + (num_4kpages * kPageSize4K - 1));
+
+  if (last < first) {
+    return MAKE_ERROR(Error::kIndexOutOfRange);
+  }
+
+  if (auto err = CleanPageMap(pml4_table, 4, 0, first, last)) {
+    return err;
+  }
+
+  if (num_4kpages <= kMaxInvalidatePages) {
+    for (size_t i = 0; i < num_4kpages; i++) {
+      InvalidateTLB(addr.value + i * kPageSize4K);
+    }
+  } else {
+    // カーネルのページはグローバルなので, CR3の再設定で失われるのはアプリ空間のみ
+    SetCR3(GetCR3());
+  }
+
+  return MAKE_ERROR(Error::kSuccess);
+}
+
+void ProtectPageMaps(LinearAddress4Level addr, size_t num_4kpages, bool writable) {
+  PageMapCursor cursor;
   auto pml4_table = reinterpret_cast<PageMapEntry*>(GetCR3());
-  return SetupPageMap(pml4_table, 4, addr, num_4kpages, writable).error;
+  addr.parts.offset = 0;
+  const uint64_t first_page = addr.value;
+  const size_t total_pages = num_4kpages;
+
+  while (num_4kpages > 0) {
+    auto [ entry, err ] = cursor.Lookup(pml4_table, addr, false);
+    size_t step = 1;
+
+    if (entry == nullptr) {
+      // 中間のテーブルが無ければ, 次の2MiB境界まで読み飛ばす
+      step = 512 - addr.parts.page;
+    } else if (entry->bits.present) {
+      entry->bits.writable = writable && !entry->bits.shared;
+    }
+
+    if (step >= num_4kpages || addr.value + step * kPageSize4K < addr.value) {
+      break;
+    }
+
+    num_4kpages -= step;
+    addr.value += step * kPageSize4K;
+  }
+
+  if (total_pages <= kMaxInvalidatePages) {
+    for (size_t i = 0; i < total_pages; i++) {
+      InvalidateTLB(first_page + i * kPageSize4K);
+    }
+  } else {
+    SetCR3(GetCR3());
+  }
+}
+
+WithError<uintptr_t> SharePrivatePage(LinearAddress4Level addr) {
+  PageMapCursor cursor;
+  addr.parts.offset = 0;
+  auto [ entry, err ] = cursor.Lookup(
+    reinterpret_cast<PageMapEntry*>(GetCR3()), addr, false);
+
+  if (err) {
+    return { 0, err };
+  } else if (entry == nullptr || !entry->bits.present || entry->bits.pinned) {
+    return { 0, MAKE_ERROR(Error::kNotImplemented) };
+  }
+
+  const auto frame_addr = reinterpret_cast<uintptr_t>(entry->Pointer());
+
+  if (entry->bits.shared) {
+    // ページキャッシュやアプリのイメージのフレームは, 所有者の都合で解放されうる
+    if (page_cache->AnonymousRefs(frame_addr) == 0) {
+      return { 0, MAKE_ERROR(Error::kNotImplemented) };
+    }
+    page_cache->AddAnonymousRef(frame_addr);
+    return { frame_addr, MAKE_ERROR(Error::kSuccess) };
+  }
+
+  // エントリ自身と呼び出し側の2つの参照を持つ共有ページにする
+  page_cache->AddAnonymousRef(frame_addr, 2);
+  entry->bits.shared = 1;
+  entry->bits.writable = 0;
+  InvalidateTLB(addr.value);
+  return { frame_addr, MAKE_ERROR(Error::kSuccess) };
+}
+
+Error MapSharedPage(LinearAddress4Level addr, uintptr_t frame_addr) {
+  PageMapCursor cursor;
+  addr.parts.offset = 0;
+  auto [ entry, err ] = cursor.Lookup(
+    reinterpret_cast<PageMapEntry*>(GetCR3()), addr, true);
+
+  if (err) {
+    return err;
+  }
+
+  if (entry->bits.present) {
+    const auto old_addr = reinterpret_cast<uintptr_t>(entry->Pointer());
+
+    if (entry->bits.pinned) {
+      return MAKE_ERROR(Error::kNotImplemented);
+    } else if (entry->bits.shared) {
+      page_cache->Release(old_addr, entry);
+    } else if (auto err = memory_manager->Free(
+          FrameID{ old_addr / kBytesPerFrame }, 1)) {
+      return err;
+    }
+  }
+
+  entry->data = 0;
+  entry->SetPointer(reinterpret_cast<PageMapEntry*>(frame_addr));
+  entry->bits.present = 1;
+  entry->bits.user = 1;
+  entry->bits.shared = 1;
+  InvalidateTLB(addr.value);
+  return MAKE_ERROR(Error::kSuccess);
 }
 
-Error CleanPageMaps(LinearAddress4Level addr) {
+WithError<uintptr_t> ResolveWritableAddress(uint64_t addr) {
+  auto& cursor = CurrentTask().PageCursor();
   auto pml4_table = reinterpret_cast<PageMapEntry*>(GetCR3());
-  return CleanPageMap(pml4_table, 4, addr);
+
+  // 未割り当てのファイルのページは, 割り当てと複製の2回のフォルトで書き込み可能になる
+  for (int i = 0; i < 3; ++i) {
+    auto [ entry, err ] = cursor.Lookup(pml4_table, LinearAddress4Level{addr}, false);
+
+    if (err) {
+      return { 0, err };
+    } else if (entry && entry->bits.present && entry->bits.writable) {
+      const auto frame_addr = reinterpret_cast<uintptr_t>(entry->Pointer());
+      return { frame_addr + (addr & 0xfff), MAKE_ERROR(Error::kSuccess) };
+    }
+
+    const bool present = entry && entry->bits.present;
+    if (auto err = HandlePageFault(present | 2, addr)) {
+      return { 0, err };
+    }
+  }
+
+  return { 0, MAKE_ERROR(Error::kIndexOutOfRange) };
+}
+
+Error FreeAddressSpace(PageMapEntry* pml4) {
+  const uint64_t first = Truncate48(kUserSpaceBegin);
+  const uint64_t last = Truncate48(kUserSpaceBegin + (kUserSpaceBytes - 1));
+
+  if (auto err = CleanPageMap(pml4, 4, 0, first, last)) {
+    return err;
+  }
+
+  return FreePageMap(pml4);
 }
 
 Error CopyPageMaps(PageMapEntry* dest,
@@ -247,6 +668,7 @@ Error CopyPageMaps(PageMapEntry* dest,
       }
       dest[i] = src[i];
       dest[i].bits.writable = 0;
+      dest[i].bits.shared = 1;
     }
     return MAKE_ERROR(Error::kSuccess);
   }
@@ -270,23 +692,36 @@ Error CopyPageMaps(PageMapEntry* dest,
 }
 
 Error HandlePageFault(uint64_t error_code, uint64_t causal_addr) {
-  auto& task = task_manager->CurrentTask();
+  auto& task = CurrentTask();
+  auto& cursor = task.PageCursor();
+  task.PageFaultCount()++;
   const bool present = (error_code >> 0) & 1;
   const bool rw      = (error_code >> 1) & 1;
-  const bool user    = (error_code >> 2) & 1;
-  if (present && rw && user) {
-    return CopyOnePage(causal_addr);
-  } else if (present) {
-    return MAKE_ERROR(Error::kAlreadyAllocated);
+  auto vma = task.VMAs().Find(causal_addr);
+
+  if (vma == nullptr || (rw && !vma->writable)) {
+    return MAKE_ERROR(Error::kIndexOutOfRange);
   }
 
-  if (task.DPagingBegin() <= causal_addr && causal_addr < task.DPagingEnd()) {
-    return SetupPageMaps(LinearAddress4Level{causal_addr}, 1);
+  // CR0.WPによりカーネルからの書き込み（CopyToUser）でも共有ページは複製される
+  if (present && rw) {
+    return CopyOnePage(causal_addr, cursor);
+  } else if (present) {
+    return MAKE_ERROR(Error::kAlreadyAllocated);
   }
 
-  if (auto m = FindFileMapping(task.FileMaps(), causal_addr)) {
-    return PreparePageCache(*task.Files()[m->fd], *m, causal_addr);
+  if (vma->type == VirtualMemoryArea::kFileMap) {
+    return PreparePageCache(*vma, causal_addr, cursor);
+  } else if (vma->type == VirtualMemoryArea::kWindowBuffer) {
+    return PrepareWindowBuffer(*vma, causal_addr, cursor);
+  } else if (vma->type == VirtualMemoryArea::kSharedMemory) {
+    return PrepareSharedMemory(*vma, causal_addr, cursor);
   }
 
-  return MAKE_ERROR(Error::kIndexOutOfRange);
+  return SetupPageMaps(
+    LinearAddress4Level{causal_addr},
+    1,
+    vma->writable,
+    &cursor
+  );
 }
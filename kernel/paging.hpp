@@ -19,6 +19,29 @@
  */
 const size_t kPageDirectoryCount = 64;
 
+/**
+ * @brief カーネル空間のマッピングに用いる共有PDPTの個数.
+ *
+ * 1つのPDPTは512個のページディレクトリ（512GiB）を指せる.
+ * これらのPDPTは全てのアドレス空間のPML4から共有される.
+ */
+const size_t kKernelPDPTCount = (kPageDirectoryCount + 511) / 512;
+
+/**
+ * @brief アプリケーション用（上位半分）の先頭となるPML4エントリのインデックス.
+ *
+ * PML4の [0, kUserPML4Index) はカーネル空間, [kUserPML4Index, 512) はアプリ空間.
+ */
+const int kUserPML4Index = 256;
+
+/** @brief アプリケーション用仮想アドレス空間の先頭アドレス. */
+const uint64_t kUserSpaceBegin = 0xffff'8000'0000'0000;
+
+/** @brief アプリケーション用仮想アドレス空間の大きさ（バイト）. */
+const uint64_t kUserSpaceBytes = 0x0000'8000'0000'0000;
+
+static_assert(kKernelPDPTCount <= kUserPML4Index);
+
 /**
  * @brief 仮想アドレス = 物理アドレス（アイデンティティマッピング (identity mapping)）となるようにページテーブルを設定する.
  * 
@@ -77,7 +100,9 @@ union PageMapEntry {
     uint64_t dirty : 1;
     uint64_t huge_page : 1;
     uint64_t global : 1;
-    uint64_t : 3;
+    uint64_t shared : 1; // 他のアドレス空間とフレームを共有している（OSが使う無視ビット）
+    uint64_t pinned : 1; // フレームをカーネルの他のオブジェクトが所有している（同上）
+    uint64_t : 1;
 
     uint64_t addr : 40;
     uint64_t : 12;
@@ -92,12 +117,100 @@ union PageMapEntry {
   }
 };
 
+/**
+ * @brief 最後に辿った末端のページテーブルを覚えておくページテーブル走査器.
+ *
+ * 同じ2MiB領域内のページを続けて扱う場合, PML4からの4段の走査を省略する.
+ * いずれかのページテーブルが解放されるとキャッシュは自動的に無効になる.
+ */
+class PageMapCursor {
+  public:
+    /**
+     * @brief 仮想アドレスを含む4KiBページを指すエントリ（レベル1）を返す.
+     *
+     * @param pml4 走査するPML4
+     * @param addr 仮想アドレス
+     * @param create trueなら存在しない中間テーブルを作成する
+     * @return ページエントリ. createがfalseで中間テーブルが無い場合はnullptr
+     */
+    WithError<PageMapEntry*> Lookup(PageMapEntry* pml4,
+                                    LinearAddress4Level addr,
+                                    bool create);
+
+  private:
+    PageMapEntry* pml4_{nullptr};
+    uint64_t base_{0};
+    PageMapEntry* table_{nullptr};
+    uint64_t generation_{0};
+};
+
 WithError<PageMapEntry*> NewPageMap();
 Error FreePageMap(PageMapEntry* table);
+
+/**
+ * @brief 新しいアドレス空間のPML4を生成する.
+ *
+ * カーネル空間のエントリは共有PDPTを指すように設定され, アプリ空間は空となる.
+ */
+WithError<PageMapEntry*> NewPML4();
+
+/**
+ * @brief 現在のアドレス空間の [addr, addr + 4KiB * num_4kpages) にページを割り当てる.
+ *
+ * 既に割り当て済みのページは書き込み可否だけを更新する.
+ *
+ * @param cursor 走査に用いるカーソル. nullptrなら呼び出し内でのみ有効なカーソルを使う
+ */
 Error SetupPageMaps(LinearAddress4Level addr,
                     size_t num_4kpages,
-                    bool writable = true);
-Error CleanPageMaps(LinearAddress4Level addr);
+                    bool writable = true,
+                    PageMapCursor* cursor = nullptr);
+
+/**
+ * @brief 現在のアドレス空間の [addr, addr + 4KiB * num_4kpages) のページを解放する.
+ *
+ * 共有されていないページのフレームは解放し, 共有ページ（sharedビットが立つもの）は
+ * マッピングだけを解除する. 空になった中間のページテーブルも解放する.
+ */
+Error CleanPageMaps(LinearAddress4Level addr, size_t num_4kpages);
+
+/**
+ * @brief 現在のアドレス空間の [addr, addr + 4KiB * num_4kpages) の書き込み可否を変更する.
+ *
+ * 未割り当てのページは無視する. 共有ページは書き込み可能にせず, 書き込み時に複製させる.
+ */
+void ProtectPageMaps(LinearAddress4Level addr, size_t num_4kpages, bool writable);
+/**
+ * @brief 現在のアドレス空間のaddrのページを, 複製せずに他へ渡せる共有ページにする.
+ *
+ * 共有していない無名ページは読み込み専用の共有ページに変わり, 次の書き込みで複製される.
+ * 呼び出し側はフレームへの参照を1つ得る. 手放すときは page_cache->Release を呼ぶ.
+ *
+ * @return フレームの物理アドレス. 未割り当てのページやファイルのページはkNotImplemented
+ */
+WithError<uintptr_t> SharePrivatePage(LinearAddress4Level addr);
+
+/**
+ * @brief SharePrivatePageで得た参照を, 現在のアドレス空間のaddrへ読み込み専用でマップする.
+ *
+ * 参照はページエントリへ移る. addrに既にあったページは解放する.
+ * 書き込むと複製されるか, 最後の参照なら共有をやめて書き込み可能になる.
+ */
+Error MapSharedPage(LinearAddress4Level addr, uintptr_t frame_addr);
+
+/**
+ * @brief 現在のアドレス空間のaddrを含むページを書き込める状態にし, addrの物理アドレスを返す.
+ *
+ * 未割り当てのページや共有中のページは, 書き込みでフォルトしたときと同様に割り当てるか複製する.
+ * 割り込み禁止で呼ぶ. 書き込めない領域ならHandlePageFaultのエラーを返す.
+ */
+WithError<uintptr_t> ResolveWritableAddress(uint64_t addr);
+
+/**
+ * @brief 現在のものとは限らないアドレス空間のアプリ空間を解放し, PML4自体も解放する.
+ */
+Error FreeAddressSpace(PageMapEntry* pml4);
+
 Error CopyPageMaps(PageMapEntry* dest,
                    PageMapEntry* src,
                    int part,
@@ -0,0 +1,376 @@
+#include "pipe.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include "cpu_local.hpp"
+#include "memory_manager.hpp"
+#include "page_cache.hpp"
+#include "paging.hpp"
+#include "task.hpp"
+
+namespace {
+  /** @brief 起こされる前に待つのをやめたtaskを待ち行列から取り除く. */
+  void StopWaiting(std::vector<Task*>& waiters, Task* task) {
+    waiters.erase(std::remove(waiters.begin(), waiters.end(), task),
+                  waiters.end());
+  }
+} // namespace
+
+Pipe::Pipe(size_t capacity) : buf_(capacity) {
+}
+
+Pipe::~Pipe() {
+  for (auto& seg : segments_) {
+    for (auto frame_addr : seg.pages) {
+      page_cache->Release(frame_addr, nullptr);
+    }
+  }
+}
+
+size_t Pipe::Read(void* buf, size_t len) {
+  if (len == 0) {
+    return 0;
+  }
+
+  __asm__("cli");
+  if (!AcquireEnd(reading_, waiting_read_turn_)) {
+    __asm__("sti");
+    return 0;
+  }
+  WaitReadable();
+  if (segments_.empty()) {
+    ReleaseEnd(reading_, waiting_read_turn_);
+    __asm__("sti");
+    return 0;
+  }
+  // 先頭の区間は読み込み側しか変更せず, 読み込み側は今このタスクだけが使っているので,
+  // コピー中は割り込みを許してよい
+  const auto& seg = segments_.front();
+  const size_t n = std::min(seg.bytes, len);
+  __asm__("sti");
+
+  auto bufc = reinterpret_cast<char*>(buf);
+
+  if (seg.pages.empty()) {
+    const size_t offset = read_pos_ % buf_.size();
+    const size_t first = std::min(n, buf_.size() - offset);
+    memcpy(bufc, &buf_[offset], first);
+    memcpy(bufc + first, &buf_[0], n - first);
+  } else {
+    size_t page_offset = seg.page_offset;
+    for (size_t copied = 0, i = 0; copied < n; ++i) {
+      const size_t bytes = std::min<size_t>(kBytesPerFrame - page_offset, n - copied);
+      memcpy(bufc + copied,
+             reinterpret_cast<const char*>(seg.pages[i]) + page_offset,
+             bytes);
+      copied += bytes;
+      page_offset = 0;
+    }
+  }
+
+  __asm__("cli");
+  Consume(n);
+  ReleaseEnd(reading_, waiting_read_turn_);
+  __asm__("sti");
+
+  return n;
+}
+
+size_t Pipe::Write(const void* buf, size_t len) {
+  auto bufc = reinterpret_cast<const char*>(buf);
+  size_t written = 0;
+
+  // 書き込み側を使い終えるまで, write_pos_から先は他の書き込みに使われない
+  __asm__("cli");
+  if (!AcquireEnd(writing_, waiting_write_turn_)) {
+    __asm__("sti");
+    return 0;
+  }
+  __asm__("sti");
+
+  auto& task = CurrentTask();
+
+  while (written < len) {
+    __asm__("cli");
+    while (write_pos_ - read_pos_ == buf_.size() && !read_closed_ &&
+           !task.Group().killed) {
+      waiting_writers_.push_back(&task);
+      task.Sleep();
+      __asm__("cli");
+    }
+    if (read_closed_ || task.Group().killed) {
+      StopWaiting(waiting_writers_, &task);
+      __asm__("sti");
+      break;
+    }
+    const size_t space = buf_.size() - (write_pos_ - read_pos_);
+    __asm__("sti");
+
+    const size_t n = std::min(space, len - written);
+    const size_t offset = write_pos_ % buf_.size();
+    const size_t first = std::min(n, buf_.size() - offset);
+    memcpy(&buf_[offset], bufc + written, first);
+    memcpy(&buf_[0], bufc + written + first, n - first);
+    written += n;
+
+    __asm__("cli");
+    write_pos_ += n;
+    if (segments_.empty() || !segments_.back().pages.empty()) {
+      segments_.push_back(Segment{ n });
+    } else {
+      segments_.back().bytes += n;
+    }
+    WakeupAll(waiting_readers_);
+    __asm__("sti");
+  }
+
+  __asm__("cli");
+  ReleaseEnd(writing_, waiting_write_turn_);
+  __asm__("sti");
+
+  return written;
+}
+
+WithError<size_t> Pipe::WritePages(uint64_t addr, size_t num_pages) {
+  size_t written = 0;
+
+  __asm__("cli");
+  if (!AcquireEnd(writing_, waiting_write_turn_)) {
+    __asm__("sti");
+    return { 0, MAKE_ERROR(Error::kSuccess) };
+  }
+  __asm__("sti");
+
+  auto& task = CurrentTask();
+
+  while (written < num_pages) {
+    __asm__("cli");
+    while (page_bytes_ >= kMaxPageBytes && !read_closed_ &&
+           !task.Group().killed) {
+      waiting_writers_.push_back(&task);
+      task.Sleep();
+      __asm__("cli");
+    }
+    if (read_closed_ || task.Group().killed) {
+      StopWaiting(waiting_writers_, &task);
+      __asm__("sti");
+      break;
+    }
+
+    const size_t room = (kMaxPageBytes - page_bytes_) / kBytesPerFrame;
+    const size_t n = std::min(room, num_pages - written);
+    Segment seg{ 0 };
+
+    for (size_t i = 0; i < n; ++i) {
+      LinearAddress4Level page_addr{addr + (written + i) * kBytesPerFrame};
+      auto [ frame_addr, err ] = SharePrivatePage(page_addr);
+      if (err) {
+        break;
+      }
+      seg.pages.push_back(frame_addr);
+    }
+
+    const size_t shared = seg.pages.size();
+    if (shared > 0) {
+      seg.bytes = shared * kBytesPerFrame;
+      page_bytes_ += seg.bytes;
+      segments_.push_back(std::move(seg));
+      WakeupAll(waiting_readers_);
+    }
+    __asm__("sti");
+
+    written += shared;
+    if (shared < n) {
+      break;
+    }
+  }
+
+  __asm__("cli");
+  const bool read_closed = read_closed_;
+  ReleaseEnd(writing_, waiting_write_turn_);
+  __asm__("sti");
+
+  if (written == 0 && !read_closed) {
+    // 呼び出し側が複製して書き込む
+    return { 0, MAKE_ERROR(Error::kNotImplemented) };
+  }
+  return { written, MAKE_ERROR(Error::kSuccess) };
+}
+
+WithError<size_t> Pipe::ReadPages(uint64_t addr, size_t num_pages) {
+  __asm__("cli");
+  if (!AcquireEnd(reading_, waiting_read_turn_)) {
+    __asm__("sti");
+    return { 0, MAKE_ERROR(Error::kSuccess) };
+  }
+  WaitReadable();
+  if (segments_.empty()) {
+    ReleaseEnd(reading_, waiting_read_turn_);
+    __asm__("sti");
+    return { 0, MAKE_ERROR(Error::kSuccess) };
+  }
+
+  auto& seg = segments_.front();
+  size_t mapped = 0;
+
+  if (!seg.pages.empty() && seg.page_offset == 0) {
+    const size_t n = std::min(num_pages, seg.pages.size());
+    for (; mapped < n; ++mapped) {
+      LinearAddress4Level page_addr{addr + mapped * kBytesPerFrame};
+      if (auto err = MapSharedPage(page_addr, seg.pages[mapped])) {
+        break;
+      }
+    }
+
+    // 参照はページエントリへ移ったので, Consumeで解放しないよう先に取り除く
+    seg.pages.erase(seg.pages.begin(), seg.pages.begin() + mapped);
+    seg.bytes -= mapped * kBytesPerFrame;
+    page_bytes_ -= mapped * kBytesPerFrame;
+    if (seg.bytes == 0) {
+      segments_.pop_front();
+    }
+    WakeupAll(waiting_writers_);
+  }
+  ReleaseEnd(reading_, waiting_read_turn_);
+  __asm__("sti");
+
+  if (mapped == 0) {
+    // 呼び出し側が複製して読み込む
+    return { 0, MAKE_ERROR(Error::kNotImplemented) };
+  }
+  return { mapped, MAKE_ERROR(Error::kSuccess) };
+}
+
+void Pipe::CloseRead() {
+  __asm__("cli");
+  read_closed_ = true;
+  WakeupAll(waiting_writers_);
+  __asm__("sti");
+}
+
+void Pipe::CloseWrite() {
+  __asm__("cli");
+  write_closed_ = true;
+  WakeupAll(waiting_readers_);
+  __asm__("sti");
+}
+
+void Pipe::WaitReadable() {
+  auto& task = CurrentTask();
+
+  while (segments_.empty() && !write_closed_) {
+    if (task.Group().killed) {
+      StopWaiting(waiting_readers_, &task);
+      return;
+    }
+    waiting_readers_.push_back(&task);
+    task.Sleep();
+    __asm__("cli");
+  }
+}
+
+void Pipe::Consume(size_t n) {
+  auto& seg = segments_.front();
+
+  if (seg.pages.empty()) {
+    read_pos_ += n;
+  } else {
+    seg.page_offset += n;
+    page_bytes_ -= n;
+    while (!seg.pages.empty() && seg.page_offset >= kBytesPerFrame) {
+      page_cache->Release(seg.pages.front(), nullptr);
+      seg.pages.pop_front();
+      seg.page_offset -= kBytesPerFrame;
+    }
+  }
+
+  seg.bytes -= n;
+  if (seg.bytes == 0) {
+    segments_.pop_front();
+  }
+  WakeupAll(waiting_writers_);
+}
+
+void Pipe::WakeupAll(std::vector<Task*>& waiters) {
+  for (auto task : waiters) {
+    task->Wakeup();
+  }
+  waiters.clear();
+}
+
+bool Pipe::AcquireEnd(bool& busy, std::vector<Task*>& waiters) {
+  auto& task = CurrentTask();
+
+  while (busy) {
+    if (task.Group().killed) {
+      StopWaiting(waiters, &task);
+      return false;
+    }
+    waiters.push_back(&task);
+    task.Sleep();
+    __asm__("cli");
+  }
+  busy = true;
+  return true;
+}
+
+void Pipe::ReleaseEnd(bool& busy, std::vector<Task*>& waiters) {
+  busy = false;
+  WakeupAll(waiters);
+}
+
+PipeDescriptor::PipeDescriptor(std::shared_ptr<Pipe> pipe, End end)
+    : pipe_{std::move(pipe)}, end_{end} {
+}
+
+PipeDescriptor::~PipeDescriptor() {
+  if (end_ == kRead) {
+    pipe_->CloseRead();
+  } else {
+    FinishWrite();
+  }
+}
+
+size_t PipeDescriptor::Read(void* buf, size_t len) {
+  if (end_ != kRead) {
+    return 0;
+  }
+  return pipe_->Read(buf, len);
+}
+
+size_t PipeDescriptor::Write(const void* buf, size_t len) {
+  if (end_ != kWrite || closed_) {
+    return 0;
+  }
+  return pipe_->Write(buf, len);
+}
+
+WithError<size_t> PipeDescriptor::WritePages(uint64_t addr, size_t num_pages) {
+  if (end_ != kWrite || closed_) {
+    return { 0, MAKE_ERROR(Error::kSuccess) };
+  }
+  return pipe_->WritePages(addr, num_pages);
+}
+
+WithError<size_t> PipeDescriptor::ReadPages(uint64_t addr, size_t num_pages) {
+  if (end_ != kRead) {
+    return { 0, MAKE_ERROR(Error::kSuccess) };
+  }
+  return pipe_->ReadPages(addr, num_pages);
+}
+
+void PipeDescriptor::FinishWrite() {
+  if (end_ == kWrite && !closed_) {
+    closed_ = true;
+    pipe_->CloseWrite();
+  }
+}
+
+std::pair<std::shared_ptr<PipeDescriptor>, std::shared_ptr<PipeDescriptor>>
+MakePipe(size_t capacity) {
+  auto pipe = std::make_shared<Pipe>(capacity);
+  return {
+    std::make_shared<PipeDescriptor>(pipe, PipeDescriptor::kRead),
+    std::make_shared<PipeDescriptor>(pipe, PipeDescriptor::kWrite),
+  };
+}
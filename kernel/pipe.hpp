@@ -0,0 +1,142 @@
+/**
+ * @file pipe.hpp
+ *
+ * タスク間でバイト列を受け渡すパイプ.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <vector>
+#include "file.hpp"
+
+class Task;
+
+/**
+ * @brief リングバッファを共有するパイプ本体.
+ *
+ * 読み書きするタスクは固定せず, Read/Writeを呼んだタスクが待つ.
+ * 待っているタスクを起こすのは, 空のパイプに書いたときと満杯のパイプから読んだときだけ.
+ * コピーは割り込みを許して行うので, 同じ側（読み込みまたは書き込み）の呼び出しは
+ * 1つずつ順に処理する. 1回の書き込みは他の書き込みと混ざらない.
+ *
+ * WritePagesで書かれたページはリングバッファへ複製せず, フレームへの参照のまま並べる.
+ * 書かれた順序を保つため, 内容はリングバッファ上の区間とページの区間の列として管理する.
+ */
+class Pipe {
+  public:
+    static const size_t kDefaultCapacity = 64 * 1024;
+    /** @brief ページのまま溜めておける最大のバイト数. */
+    static const size_t kMaxPageBytes = 1024 * 1024;
+
+    explicit Pipe(size_t capacity = kDefaultCapacity);
+    ~Pipe();
+    Pipe(const Pipe&) = delete;
+    Pipe& operator=(const Pipe&) = delete;
+
+    /**
+     * @brief 最大lenバイト読む.
+     *
+     * 空なら書き込まれるまで待つ.
+     *
+     * @return 読んだバイト数. 空で書き込み側が全て閉じていれば0
+     */
+    size_t Read(void* buf, size_t len);
+
+    /**
+     * @brief lenバイト全てを書くまで, 満杯になるたびに読まれるのを待つ.
+     *
+     * @return 書いたバイト数. 読み込み側が閉じていれば書けなかった分は捨てる
+     */
+    size_t Write(const void* buf, size_t len);
+
+    /** @brief FileDescriptor::WritePagesと同じ. 溜まったページが多すぎれば読まれるのを待つ. */
+    WithError<size_t> WritePages(uint64_t addr, size_t num_pages);
+
+    /** @brief FileDescriptor::ReadPagesと同じ. 空なら書き込まれるまで待つ. */
+    WithError<size_t> ReadPages(uint64_t addr, size_t num_pages);
+
+    void CloseRead();
+    void CloseWrite();
+
+  private:
+    struct Segment {
+      size_t bytes;                // 未読のバイト数
+      std::deque<uintptr_t> pages; // 空ならリングバッファ上の区間
+      size_t page_offset{0};       // pages.front() のうち読み終えたバイト数
+    };
+
+    std::vector<char> buf_;
+    // リングバッファへ読み書きした累計のバイト数. 差が溜まっているバイト数になる
+    size_t read_pos_{0}, write_pos_{0};
+    std::deque<Segment> segments_;
+    size_t page_bytes_{0};
+    bool read_closed_{false}, write_closed_{false};
+    std::vector<Task*> waiting_readers_, waiting_writers_;
+    // 読み込み側, 書き込み側を処理中のタスクがあるか. 後から来たタスクは順番を待つ
+    bool reading_{false}, writing_{false};
+    std::vector<Task*> waiting_read_turn_, waiting_write_turn_;
+
+    /**
+     * @brief 割り込み禁止で呼ぶ. 空でなくなるか書き込み側が全て閉じるまで待つ.
+     *
+     * スレッドグループが終了させられたら, 空のままでも戻る.
+     */
+    void WaitReadable();
+    /** @brief 割り込み禁止で呼ぶ. 先頭の区間からnバイトを読み終えたことにする. */
+    void Consume(size_t n);
+    void WakeupAll(std::vector<Task*>& waiters);
+    /**
+     * @brief 割り込み禁止で呼ぶ. busyが下りるまで待ってから立てる.
+     *
+     * @return 立てたらtrue. 待つ間にスレッドグループが終了させられたらfalse
+     */
+    bool AcquireEnd(bool& busy, std::vector<Task*>& waiters);
+    /** @brief 割り込み禁止で呼ぶ. busyを下ろし, 順番を待つタスクを起こす. */
+    void ReleaseEnd(bool& busy, std::vector<Task*>& waiters);
+};
+
+/**
+ * @brief パイプの読み込み側または書き込み側.
+ *
+ * 記述子が破棄されるとその側を閉じる.
+ */
+class PipeDescriptor : public FileDescriptor {
+  public:
+    enum End {
+      kRead,
+      kWrite,
+    };
+
+    PipeDescriptor(std::shared_ptr<Pipe> pipe, End end);
+    ~PipeDescriptor() override;
+    size_t Read(void* buf, size_t len) override;
+    size_t Write(const void* buf, size_t len) override;
+    WithError<size_t> WritePages(uint64_t addr, size_t num_pages) override;
+    WithError<size_t> ReadPages(uint64_t addr, size_t num_pages) override;
+
+    size_t Size() const override {
+      return 0;
+    }
+
+    size_t Load(void* buf,
+                size_t len,
+                size_t offset) override {
+      return 0;
+    }
+
+    /** @brief 書き込み側を閉じ, 読み込み側に終端を知らせる. */
+    void FinishWrite();
+
+  private:
+    std::shared_ptr<Pipe> pipe_;
+    End end_;
+    bool closed_{false};
+};
+
+/** @brief 新しいパイプの読み込み側と書き込み側を作る. */
+std::pair<std::shared_ptr<PipeDescriptor>, std::shared_ptr<PipeDescriptor>>
+MakePipe(size_t capacity = Pipe::kDefaultCapacity);
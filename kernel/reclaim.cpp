@@ -0,0 +1,34 @@
+#include "reclaim.hpp"
+
+#include "asmfunc.h"
+#include "memory_manager.hpp"
+#include "page_cache.hpp"
+#include "terminal.hpp"
+
+size_t ReclaimMemory(bool force) {
+  const size_t free_frames = memory_manager->FreeFrames();
+
+  if (!force && free_frames >= kLowWatermarkFrames) {
+    return 0;
+  }
+
+  const size_t num_frames = free_frames < kHighWatermarkFrames
+    ? kHighWatermarkFrames - free_frames
+    : 1;
+
+  // ページフォルト処理（割り込み禁止）からも, タスクの文脈からも呼ばれる
+  const bool interrupt_enabled = GetRFLAGS() & (1u << 9);
+  __asm__("cli");
+
+  size_t num_freed = page_cache->Reclaim(num_frames);
+
+  if (num_freed < num_frames) {
+    num_freed += EvictAppImages(num_frames - num_freed);
+  }
+
+  if (interrupt_enabled) {
+    __asm__("sti");
+  }
+
+  return num_freed;
+}
@@ -0,0 +1,26 @@
+/**
+ * @file reclaim.hpp
+ *
+ * 空きメモリが不足したときのページ回収.
+ */
+
+#pragma once
+
+#include <cstddef>
+
+/** @brief 空きフレームがこの数を下回ったら回収を始める（4MiB）. */
+const size_t kLowWatermarkFrames = 1024;
+
+/** @brief 回収を始めたら, 空きフレームがこの数になるまで続ける（8MiB）. */
+const size_t kHighWatermarkFrames = 2048;
+
+/**
+ * @brief 空きフレームが少なければ, 読み直せるページを追い出して空きを増やす.
+ *
+ * ページキャッシュのページをクロックアルゴリズムで追い出し, それでも足りなければ
+ * 実行中のタスクが使っていないキャッシュ済みアプリイメージを古い順に破棄する.
+ *
+ * @param force trueなら空きフレームの数に関わらず少なくとも1フレームの回収を試みる
+ * @return 回収したフレーム数
+ */
+size_t ReclaimMemory(bool force);
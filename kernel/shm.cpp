@@ -0,0 +1,114 @@
+#include "shm.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include "memory_manager.hpp"
+#include "reclaim.hpp"
+
+SharedMemory::SharedMemory(const std::string& name,
+                           std::vector<uintptr_t>&& frames)
+    : name_{name}, frames_{std::move(frames)} {
+}
+
+SharedMemory::~SharedMemory() {
+  // 登録は期限切れのまま残し, 次のCreateSharedMemoryで取り除く.
+  // 最後の参照はVMAの削除などで割り込み禁止のまま消えることがあるので, ここでは登録に触れない
+  for (auto frame_addr : frames_) {
+    memory_manager->Free(FrameID{ frame_addr / kBytesPerFrame }, 1);
+  }
+}
+
+SharedMemoryDescriptor::SharedMemoryDescriptor(std::shared_ptr<SharedMemory> shm)
+    : shm_{std::move(shm)} {
+}
+
+size_t SharedMemoryDescriptor::Load(void* buf, size_t len, size_t offset) {
+  if (offset >= shm_->Bytes()) {
+    return 0;
+  }
+  len = std::min(len, shm_->Bytes() - offset);
+
+  auto bufc = reinterpret_cast<char*>(buf);
+  for (size_t copied = 0; copied < len; ) {
+    const size_t page_offset = (offset + copied) % kBytesPerFrame;
+    const size_t bytes = std::min<size_t>(kBytesPerFrame - page_offset,
+                                          len - copied);
+    memcpy(bufc + copied,
+           reinterpret_cast<const char*>(shm_->Frame(offset + copied)) + page_offset,
+           bytes);
+    copied += bytes;
+  }
+  return len;
+}
+
+WithError<std::shared_ptr<SharedMemory>> CreateSharedMemory(const char* name,
+                                                            size_t bytes) {
+  if (bytes == 0 || bytes > SharedMemory::kMaxBytes) {
+    return { nullptr, MAKE_ERROR(Error::kIndexOutOfRange) };
+  }
+
+  __asm__("cli");
+  for (auto it = shared_memories->begin(); it != shared_memories->end(); ) {
+    it = it->second.expired() ? shared_memories->erase(it) : std::next(it);
+  }
+  const bool exists = shared_memories->count(name) > 0;
+  __asm__("sti");
+
+  if (exists) {
+    return { nullptr, MAKE_ERROR(Error::kAlreadyAllocated) };
+  }
+
+  const size_t num_frames = (bytes + kBytesPerFrame - 1) / kBytesPerFrame;
+  std::vector<uintptr_t> frames;
+  frames.reserve(num_frames);
+
+  while (frames.size() < num_frames) {
+    auto frame = memory_manager->Allocate(1);
+    if (frame.error && ReclaimMemory(true) > 0) {
+      frame = memory_manager->Allocate(1);
+    }
+    if (frame.error) {
+      for (auto frame_addr : frames) {
+        memory_manager->Free(FrameID{ frame_addr / kBytesPerFrame }, 1);
+      }
+      return { nullptr, frame.error };
+    }
+
+    memset(frame.value.Frame(), 0, kBytesPerFrame);
+    frames.push_back(reinterpret_cast<uintptr_t>(frame.value.Frame()));
+  }
+
+  auto shm = std::make_shared<SharedMemory>(name, std::move(frames));
+
+  __asm__("cli");
+  // フレームを用意している間に同名のものが作られていたら諦める
+  auto& slot = (*shared_memories)[name];
+  if (!slot.expired()) {
+    __asm__("sti");
+    return { nullptr, MAKE_ERROR(Error::kAlreadyAllocated) };
+  }
+  slot = shm;
+  __asm__("sti");
+
+  return { shm, MAKE_ERROR(Error::kSuccess) };
+}
+
+WithError<std::shared_ptr<SharedMemory>> OpenSharedMemory(const char* name) {
+  __asm__("cli");
+  std::shared_ptr<SharedMemory> shm;
+  if (auto it = shared_memories->find(name); it != shared_memories->end()) {
+    shm = it->second.lock();
+  }
+  __asm__("sti");
+
+  if (!shm) {
+    return { nullptr, MAKE_ERROR(Error::kNoSuchEntry) };
+  }
+  return { shm, MAKE_ERROR(Error::kSuccess) };
+}
+
+std::map<std::string, std::weak_ptr<SharedMemory>>* shared_memories;
+
+void InitializeSharedMemory() {
+  shared_memories = new std::map<std::string, std::weak_ptr<SharedMemory>>;
+}
@@ -0,0 +1,94 @@
+/**
+ * @file shm.hpp
+ *
+ * アプリ間で物理フレームを共有する名前付き共有メモリ.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "error.hpp"
+#include "file.hpp"
+
+/**
+ * @brief 名前付き共有メモリの本体.
+ *
+ * 作成時に全てのフレームを割り当ててゼロで埋め, 破棄されるまで解放しない.
+ * マップしたタスクはフレームをpinnedビット付きでマップするので,
+ * マップを外してもタスクが終了してもフレームは解放されない.
+ * 記述子とマップした領域が全て無くなると破棄され, 名前も使えなくなる.
+ */
+class SharedMemory {
+  public:
+    static const size_t kMaxBytes = 64 * 1024 * 1024;
+
+    SharedMemory(const std::string& name, std::vector<uintptr_t>&& frames);
+    ~SharedMemory();
+    SharedMemory(const SharedMemory&) = delete;
+    SharedMemory& operator=(const SharedMemory&) = delete;
+
+    const std::string& Name() const {
+      return name_;
+    }
+
+    /** @brief 大きさ（4KiBの倍数）. */
+    size_t Bytes() const {
+      return frames_.size() * 4096;
+    }
+
+    /** @brief offsetを含むページのフレームの物理アドレス. offsetはBytes()未満であること. */
+    uintptr_t Frame(size_t offset) const {
+      return frames_[offset / 4096];
+    }
+
+  private:
+    std::string name_;
+    std::vector<uintptr_t> frames_;
+};
+
+/** @brief 共有メモリを開いた記述子. ShmMapでマップするためだけに使う. */
+class SharedMemoryDescriptor : public FileDescriptor {
+  public:
+    explicit SharedMemoryDescriptor(std::shared_ptr<SharedMemory> shm);
+
+    size_t Read(void* buf, size_t len) override {
+      return 0;
+    }
+
+    size_t Write(const void* buf, size_t len) override {
+      return 0;
+    }
+
+    size_t Size() const override {
+      return shm_->Bytes();
+    }
+
+    size_t Load(void* buf, size_t len, size_t offset) override;
+
+    std::shared_ptr<SharedMemory> SharedMemoryObject() override {
+      return shm_;
+    }
+
+  private:
+    std::shared_ptr<SharedMemory> shm_;
+};
+
+/**
+ * @brief bytesバイト（4KiB単位に切り上げ）の共有メモリを作り, nameで登録する.
+ *
+ * @return 同名の共有メモリが残っていればkAlreadyAllocated.
+ *   bytesが0かSharedMemory::kMaxBytesを超えればkIndexOutOfRange
+ */
+WithError<std::shared_ptr<SharedMemory>> CreateSharedMemory(const char* name,
+                                                            size_t bytes);
+
+/** @brief nameで登録された共有メモリを返す. 無ければkNoSuchEntry. */
+WithError<std::shared_ptr<SharedMemory>> OpenSharedMemory(const char* name);
+
+extern std::map<std::string, std::weak_ptr<SharedMemory>>* shared_memories;
+void InitializeSharedMemory();
@@ -1,18 +1,30 @@
+#include <algorithm>
 #include <array>
 #include <cstdint>
 #include <cerrno>
 #include <cmath>
+#include <optional>
+#include <vector>
 #include <fcntl.h>
 #include "app_event.hpp"
 #include "asmfunc.h"
+#include "compositor.hpp"
+#include "cpu_local.hpp"
+#include "draw_command.hpp"
 #include "font.hpp"
+#include "futex.hpp"
 #include "keyboard.hpp"
 #include "logger.hpp"
 #include "msr.hpp"
+#include "page_cache.hpp"
+#include "shm.hpp"
 #include "syscall.hpp"
 #include "task.hpp"
 #include "terminal.hpp"
+#include "thread.hpp"
 #include "timer.hpp"
+#include "uaccess.hpp"
+#include "window_buffer.hpp"
 
 namespace syscall {
 
@@ -31,11 +43,14 @@ namespace syscall {
       return { 0, EPERM };
     }
 
-    const char* s = reinterpret_cast<const char*>(arg2);
-    const auto len = strlen(s);
+    char s[1025];
+    const auto [ len, err ] =
+      StrncpyFromUser(s, reinterpret_cast<const char*>(arg2), sizeof(s));
 
-    if (len > 1024) {
+    if (err.Cause() == Error::kBufferTooSmall) {
       return { 0, E2BIG };
+    } else if (err) {
+      return { 0, EFAULT };
     }
 
     Log(static_cast<LogLevel>(arg1), "%s", s);
@@ -43,36 +58,82 @@ namespace syscall {
     return { len, 0 };
   }
 
-  SYSCALL(PutString) {
-    const auto fd = arg1;
-    const char* s = reinterpret_cast<const char*>(arg2);
-    const auto len = arg3;
+  namespace {
+    /** @brief これ以上の大きさでページ境界に揃った読み書きは, ページを複製せずに渡すことを試す. */
+    const size_t kPageTransferMinBytes = 16 * 4096;
+
+    /**
+     * @brief ページ単位で受け渡しできる範囲なら, その先頭から数えたページ数を返す.
+     *
+     * [addr, addr + len) がタスクの1つの領域に収まっていることを確認する.
+     * for_read ならページを差し替えてよい書き込み可能な無名メモリの領域に限る.
+     */
+    size_t TransferablePages(Task& task, uint64_t addr, size_t len,
+                             bool for_read) {
+      if (len < kPageTransferMinBytes || addr % 4096 != 0) {
+        return 0;
+      }
+
+      __asm__("cli");
+      auto vma = task.VMAs().Find(addr);
+      bool ok = vma != nullptr && len <= vma->begin + vma->size - addr;
+
+      if (ok && for_read) {
+        const bool anonymous = vma->type == VirtualMemoryArea::kImage
+          || vma->type == VirtualMemoryArea::kHeap
+          || vma->type == VirtualMemoryArea::kStack
+          || vma->type == VirtualMemoryArea::kAnonymous;
+        ok = vma->writable && anonymous;
+      }
+      __asm__("sti");
 
-    if (len > 1024) {
-      return { 0, E2BIG};
+      return ok ? len / 4096 : 0;
     }
+  }
 
-    __asm__("cli");
-    auto& task = task_manager->CurrentTask();
-    __asm__("sti");
+  SYSCALL(PutString) {
+    const auto fd = arg1;
+    auto& task = CurrentTask();
 
     if (fd < 0 || task.Files().size() <= fd || !task.Files()[fd]) {
       return { 0, EBADF };
     }
 
+    if (auto num_pages = TransferablePages(task, arg2, arg3, false)) {
+      auto [ n, err ] = task.Files()[fd]->WritePages(arg2, num_pages);
+      if (!err) {
+        return { n * 4096, 0 };
+      }
+    }
+
+    // 一度に書く量を制限する. 残りはアプリ側（newlib）が繰り返し呼ぶ
+    char s[4096];
+    const auto len = std::min<uint64_t>(arg3, sizeof(s));
+
+    if (auto err = CopyFromUser(s, reinterpret_cast<const char*>(arg2), len)) {
+      return { 0, EFAULT };
+    }
+
     return { task.Files()[fd]->Write(s, len), 0 };
   }
 
   SYSCALL(Exit) {
-    __asm__("cli");
-    auto& task = task_manager->CurrentTask();
-    __asm__("sti");
-    return { task.OSStackPointer(), static_cast<int>(arg1) };
+    auto& task = CurrentTask();
+    // どのスレッドからのExitでもアプリ全体を終わらせる
+    KillThreadGroup(task, arg1);
+    return { task.OSStackPointer(), task.Group().exit_code };
   }
 
   SYSCALL(OpenWindow) {
     const int w = arg1, h = arg2, x = arg3, y = arg4;
-    const auto title = reinterpret_cast<const char*>(arg5);
+    char title[128];
+
+    if (auto [ len, err ] = StrncpyFromUser(
+          title, reinterpret_cast<const char*>(arg5), sizeof(title));
+        err && err.Cause() != Error::kBufferTooSmall) {
+      return { 0, EFAULT };
+    }
+
     const auto win = std::make_shared<ToplevelWindow>(
       w,
       h,
@@ -88,7 +149,7 @@ namespace syscall {
       .ID();
     active_layer->Activate(layer_id);
 
-    const auto task_id = task_manager->CurrentTask().ID();
+    const auto task_id = CurrentTask().ID();
     layer_task_map->insert(std::make_pair(layer_id, task_id));
     __asm__("sti");
 
@@ -116,9 +177,7 @@ namespace syscall {
       }
 
       if ((layer_flags & 1) == 0) {
-        __asm__("cli");
-        layer_manager->Draw(layer_id);
-        __asm__("sti");
+        AddLayerDamage(layer_id);
       }
 
       return res;
@@ -126,6 +185,15 @@ namespace syscall {
   }
 
   SYSCALL(WinWriteString) {
+    // ウィンドウに収まらない部分は描かれないので, 長すぎる文字列は切り詰める
+    char s[1024];
+
+    if (auto [ len, err ] = StrncpyFromUser(
+          s, reinterpret_cast<const char*>(arg5), sizeof(s));
+        err && err.Cause() != Error::kBufferTooSmall) {
+      return { 0, EFAULT };
+    }
+
     return DoWinFunc(
       [](Window& win,
          int x,
@@ -144,7 +212,7 @@ namespace syscall {
       arg2,
       arg3,
       arg4,
-      reinterpret_cast<const char*>(arg5)
+      s
     );
   }
 
@@ -186,62 +254,71 @@ namespace syscall {
     );
   }
 
-  SYSCALL(WinDrawLine) {
-    return DoWinFunc(
-      [](Window& win,
-         int x0,
-         int y0,
-         int x1,
-         int y1,
-         uint32_t color) {
-
-        auto sign = [](int x) {
-          return (x > 0)
-            ? 1
-            : (x < 0)
-              ? -1
-              : 0;
-        };
+  namespace {
+    void DrawLine(PixelWriter& writer,
+                  int x0,
+                  int y0,
+                  int x1,
+                  int y1,
+                  const PixelColor& color) {
+      auto sign = [](int x) {
+        return (x > 0)
+          ? 1
+          : (x < 0)
+            ? -1
+            : 0;
+      };
+
+      const int dx = x1 - x0 + sign(x1 - x0);
+      const int dy = y1 - y0 + sign(y1 - y0);
+
+      if (dx == 0 && dy == 0) {
+        writer.Write({x0, y0}, color);
+        return;
+      }
 
-        const int dx = x1 - x0 + sign(x1 - x0);
-        const int dy = y1 - y0 + sign(y1 - y0);
+      const auto floord = static_cast<double(*)(double)>(floor);
+      const auto ceild = static_cast<double(*)(double)>(ceil);
 
-        if (dx == 0 && dy == 0) {
-          win.Writer()->Write({x0, y0}, ToColor(color));
-          return Result{ 0, 0 };
+      if (abs(dx) >= abs(dy)) {
+        if (dx < 0) {
+          std::swap(x0, x1);
+          std::swap(y0, y1);
         }
 
-        const auto floord = static_cast<double(*)(double)>(floor);
-        const auto ceild = static_cast<double(*)(double)>(ceil);
-
-        if (abs(dx) >= abs(dy)) {
-          if (dx < 0) {
-            std::swap(x0, x1);
-            std::swap(y0, y1);
-          }
-
-          const auto roundish = y1 >= y0 ? floord : ceild;
-          const double m = static_cast<double>(dy) / dx;
+        const auto roundish = y1 >= y0 ? floord : ceild;
+        const double m = static_cast<double>(dy) / dx;
 
-          for (int x = x0; x <= x1; x++) {
-            const int y = roundish(m * (x - x0) + y0);
-            win.Writer()->Write({x, y}, ToColor(color));
-          }
-        } else {
-          if (dy < 0) {
-            std::swap(x0, x1);
-            std::swap(y0, y1);
-          }
+        for (int x = x0; x <= x1; x++) {
+          const int y = roundish(m * (x - x0) + y0);
+          writer.Write({x, y}, color);
+        }
+      } else {
+        if (dy < 0) {
+          std::swap(x0, x1);
+          std::swap(y0, y1);
+        }
 
-          const auto roundish = x1 >= x0 ? floord : ceild;
-          const double m = static_cast<double>(dx) / dy;
+        const auto roundish = x1 >= x0 ? floord : ceild;
+        const double m = static_cast<double>(dx) / dy;
 
-          for (int y = y0; y <= y1; y++) {
-            const int x = roundish(m * (y - y0) + x0);
-            win.Writer()->Write({x, y}, ToColor(color));
-          }
+        for (int y = y0; y <= y1; y++) {
+          const int x = roundish(m * (y - y0) + x0);
+          writer.Write({x, y}, color);
         }
+      }
+    }
+  }
 
+  SYSCALL(WinDrawLine) {
+    return DoWinFunc(
+      [](Window& win,
+         int x0,
+         int y0,
+         int x1,
+         int y1,
+         uint32_t color) {
+        DrawLine(*win.Writer(), x0, y0, x1, y1, ToColor(color));
         return Result{ 0, 0 };
       },
       arg1,
@@ -264,87 +341,157 @@ namespace syscall {
     return { 0, 0 };
   }
 
-  SYSCALL (ReadEvent) {
-    if (arg1 < 0x8000'0000'0000'0000) {
-      return { 0, EFAULT };
-    }
-
-    const auto app_events = reinterpret_cast<AppEvent*>(arg1);
-    const size_t len = arg2;
-
-    __asm__("cli");
-    auto& task = task_manager->CurrentTask();
-    __asm__("sti");
-
-    size_t i = 0;
-
-    while (i < len) {
-      __asm__("cli");
-      auto msg = task.ReceiveMessage();
-      if (!msg && i == 0) {
-        task.Sleep();
-        continue;
-      }
-      __asm__("sti");
-
-      if (!msg) {
-        break;
-      }
-
-      switch (msg->type) {
+  namespace {
+    /**
+     * @brief タスクを起こすためだけに使うタイマーの値.
+     *
+     * ReadEventは0以上の値のタイマーをアプリへ渡さない.
+     */
+    const int kWakeupTimerValue = 0;
+
+    /** @brief メッセージをアプリ向けのイベントに変換する. アプリへ渡さないなら nullopt. */
+    std::optional<AppEvent> ToAppEvent(const Message& msg) {
+      AppEvent ev;
+
+      switch (msg.type) {
         case Message::kKeyPush:
-          if (msg->arg.keyboard.keycode == 20 /* Q key */ 
-              && msg->arg.keyboard.modifier
+          if (msg.arg.keyboard.keycode == 20 /* Q key */
+              && msg.arg.keyboard.modifier
                  & (kLControlBitMask | kRControlBitMask)) {
-            app_events[i].type = AppEvent::kQuit;
+            ev.type = AppEvent::kQuit;
           } else {
-            app_events[i].type = AppEvent::kKeyPush;
-            app_events[i].arg.keypush.modifier = msg->arg.keyboard.modifier;
-            app_events[i].arg.keypush.keycode = msg->arg.keyboard.keycode;
-            app_events[i].arg.keypush.ascii = msg->arg.keyboard.ascii;
-            app_events[i].arg.keypush.press = msg->arg.keyboard.press;
+            ev.type = AppEvent::kKeyPush;
+            ev.arg.keypush.modifier = msg.arg.keyboard.modifier;
+            ev.arg.keypush.keycode = msg.arg.keyboard.keycode;
+            ev.arg.keypush.ascii = msg.arg.keyboard.ascii;
+            ev.arg.keypush.press = msg.arg.keyboard.press;
           }
-          i++;
-          break;
+          return ev;
         case Message::kMouseMove:
-          app_events[i].type = AppEvent::kMouseMove;
-          app_events[i].arg.mouse_move.x = msg->arg.mouse_move.x;
-          app_events[i].arg.mouse_move.y = msg->arg.mouse_move.y;
-          app_events[i].arg.mouse_move.dx = msg->arg.mouse_move.dx;
-          app_events[i].arg.mouse_move.dy = msg->arg.mouse_move.dy;
-          app_events[i].arg.mouse_move.buttons = msg->arg.mouse_move.buttons;
-          i++;
-          break;
+          ev.type = AppEvent::kMouseMove;
+          ev.arg.mouse_move.x = msg.arg.mouse_move.x;
+          ev.arg.mouse_move.y = msg.arg.mouse_move.y;
+          ev.arg.mouse_move.dx = msg.arg.mouse_move.dx;
+          ev.arg.mouse_move.dy = msg.arg.mouse_move.dy;
+          ev.arg.mouse_move.buttons = msg.arg.mouse_move.buttons;
+          return ev;
         case Message::kMouseButton:
-          app_events[i].type = AppEvent::kMouseButton;
-          app_events[i].arg.mouse_button.x = msg->arg.mouse_button.x;
-          app_events[i].arg.mouse_button.y = msg->arg.mouse_button.y;
-          app_events[i].arg.mouse_button.press = msg->arg.mouse_button.press;
-          app_events[i].arg.mouse_button.button = msg->arg.mouse_button.button;
-          i++;
-          break;
+          ev.type = AppEvent::kMouseButton;
+          ev.arg.mouse_button.x = msg.arg.mouse_button.x;
+          ev.arg.mouse_button.y = msg.arg.mouse_button.y;
+          ev.arg.mouse_button.press = msg.arg.mouse_button.press;
+          ev.arg.mouse_button.button = msg.arg.mouse_button.button;
+          return ev;
         case Message::kTimerTimeout:
-          if (msg->arg.timer.value < 0) {
-            app_events[i].type = AppEvent::kTimerTimeout;
-            app_events[i].arg.timer.timeout = msg->arg.timer.timeout;
-            app_events[i].arg.timer.value = -msg->arg.timer.value;
-          i++;
+          if (msg.arg.timer.value >= 0) {
+            return std::nullopt;
           }
-          break;
+          ev.type = AppEvent::kTimerTimeout;
+          ev.arg.timer.timeout = msg.arg.timer.timeout;
+          ev.arg.timer.value = -msg.arg.timer.value;
+          return ev;
         case Message::kWindowClose:
-          app_events[i].type = AppEvent::kQuit;
-          i++;
-          break;
+          ev.type = AppEvent::kQuit;
+          return ev;
         default:
           Log(
             kInfo,
             "uncaught event type: %u\n",
-            msg->type
+            msg.type
           );
+          return std::nullopt;
+      }
+    }
+
+    /**
+     * @brief イベントを最大len個読む.
+     *
+     * 1個も無ければ, flagsに従ってdeadlineまで（nulloptなら無期限に）待つ.
+     * 1個でも読めたら, 待たずにその時点で溜まっている分だけを返す.
+     * アプリへはkBatch個ずつまとめてコピーする.
+     */
+    Result ReadEvents(AppEvent* app_events, size_t len, unsigned int flags,
+                      std::optional<unsigned long> deadline,
+                      uint32_t type_mask) {
+      const size_t kBatch = 16;
+      std::array<AppEvent, kBatch> buf;
+      size_t num_buffered = 0;
+      size_t num_copied = 0;
+
+      auto flush = [&]() {
+        auto err = CopyToUser(&app_events[num_copied], buf.data(),
+                              sizeof(AppEvent) * num_buffered);
+        num_copied += num_buffered;
+        num_buffered = 0;
+        return err;
+      };
+
+      if (type_mask != 0) {
+        type_mask |= APP_EVENT_MASK(AppEvent::kQuit);
+      }
+
+      auto& task = CurrentTask();
+
+      while (num_copied + num_buffered < len) {
+        __asm__("cli");
+        auto msg = task.ReceiveMessage();
+        if (!msg && num_copied + num_buffered == 0 &&
+            (flags & kReadEventNonBlock) == 0 && !task.Group().killed) {
+          if (!deadline || timer_manager->CurrentTick() < *deadline) {
+            task.Sleep();
+            continue;
+          }
+        }
+        __asm__("sti");
+
+        if (!msg) {
+          break;
+        }
+
+        auto ev = ToAppEvent(*msg);
+        if (!ev || (type_mask != 0 &&
+                    (type_mask & APP_EVENT_MASK(ev->type)) == 0)) {
+          continue;
+        }
+
+        buf[num_buffered++] = *ev;
+        if (num_buffered == kBatch) {
+          if (auto err = flush()) {
+            return { 0, EFAULT };
+          }
+        }
+      }
+
+      if (num_buffered > 0) {
+        if (auto err = flush()) {
+          return { 0, EFAULT };
+        }
       }
+
+      return { num_copied, 0 };
+    }
+  }
+
+  SYSCALL(ReadEvent) {
+    return ReadEvents(reinterpret_cast<AppEvent*>(arg1), arg2,
+                      0, std::nullopt, 0);
+  }
+
+  SYSCALL(ReadEventEx) {
+    const unsigned int flags = arg3;
+    std::optional<unsigned long> deadline;
+
+    if (flags & kReadEventTimeout) {
+      deadline = timer_manager->CurrentTick() + arg4 * kTimerFreq / 1000;
+
+      __asm__("cli");
+      timer_manager->AddTimer(
+        Timer{ *deadline, kWakeupTimerValue, CurrentTask().ID() });
+      __asm__("sti");
     }
-    
-    return { i, 0 };
+
+    return ReadEvents(reinterpret_cast<AppEvent*>(arg1), arg2,
+                      flags, deadline, arg5);
   }
 
   SYSCALL(CreateTimer) {
@@ -355,9 +502,7 @@ namespace syscall {
       return { 0, EINVAL };
     }
 
-    __asm__("cli");
-    const uint64_t task_id = task_manager->CurrentTask().ID();
-    __asm__("sti");
+    const uint64_t task_id = CurrentTask().ID();
 
     unsigned long timeout = arg3 * kTimerFreq / 1000;
 
@@ -378,17 +523,22 @@ namespace syscall {
 
   namespace {
 
-    size_t AllocateFD(Task& task) {
-      const size_t num_files = task.Files().size();
+    /** @brief 空いている番号にfileを登録する. 同じアプリのスレッドと共有するので割り込み禁止で行う. */
+    size_t InstallFD(Task& task, std::shared_ptr<::FileDescriptor> file) {
+      __asm__("cli");
+      auto& files = task.Files();
+      size_t fd = 0;
 
-      for (size_t i = 0; i < num_files; i++) {
-        if (!task.Files()[i]) {
-          return i;
-        }
+      while (fd < files.size() && files[fd]) {
+        ++fd;
+      }
+      if (fd == files.size()) {
+        files.emplace_back();
       }
+      files[fd] = std::move(file);
+      __asm__("sti");
 
-      task.Files().emplace_back();
-      return num_files;
+      return fd;
     }
 
     std::pair<fat::DirectoryEntry*, int> CreateFile(const char* path) {
@@ -403,11 +553,18 @@ namespace syscall {
   } // namespace
 
   SYSCALL(OpenFile) {
-    const char* path = reinterpret_cast<const char*>(arg1);
     const int flags = arg2;
-    __asm__("cli");
-    auto& task = task_manager->CurrentTask();
-    __asm__("sti");
+    auto& task = CurrentTask();
+
+    char path[256];
+    const auto [ path_len, err_path ] =
+      StrncpyFromUser(path, reinterpret_cast<const char*>(arg1), sizeof(path));
+
+    if (err_path.Cause() == Error::kBufferTooSmall) {
+      return { 0, ENAMETOOLONG };
+    } else if (err_path) {
+      return { 0, EFAULT };
+    }
 
     if (strcmp(path, "@stdin") == 0) {
       return { 0, 0 };
@@ -428,97 +585,992 @@ namespace syscall {
       return { 0, ENOENT };
     }
 
-    size_t fd = AllocateFD(task);
-    task.Files()[fd] = std::make_unique<fat::FileDescriptor>(*file);
-    return { fd, 0 };
+    return { InstallFD(task, std::make_shared<fat::FileDescriptor>(*file)), 0 };
   }
 
   SYSCALL(ReadFile) {
     const int fd = arg1;
     void* buf = reinterpret_cast<void*>(arg2);
     size_t count = arg3;
-    __asm__("cli");
-    auto& task = task_manager->CurrentTask();
-    __asm__("sti");
+    auto& task = CurrentTask();
 
     if (fd < 0 || task.Files().size() <= fd || !task.Files()[fd]) {
       return { 0, EBADF };
     }
 
-    return { task.Files()[fd]->Read(buf, count), 0 };
+    if (auto num_pages = TransferablePages(task, arg2, count, true)) {
+      auto [ n, err ] = task.Files()[fd]->ReadPages(arg2, num_pages);
+      if (!err) {
+        return { n * 4096, 0 };
+      }
+    }
+
+    // 一度に読む量を制限する. 足りない分はアプリ側（newlib）が繰り返し呼ぶ
+    uint8_t kbuf[4096];
+    const size_t n = task.Files()[fd]->Read(kbuf, std::min(count, sizeof(kbuf)));
+
+    if (auto err = CopyToUser(buf, kbuf, n)) {
+      return { 0, EFAULT };
+    }
+
+    return { n, 0 };
   }
 
   SYSCALL(DemandPages) {
     const size_t num_pages = arg1;
     // const int flags = arg2;
+    auto& task = CurrentTask();
+
     __asm__("cli");
-    auto& task = task_manager->CurrentTask();
+    auto [ dp_end, err ] = task.VMAs().ExtendHeap(4096 * num_pages);
     __asm__("sti");
 
-    const uint64_t dp_end = task.DPagingEnd();
-    task.SetDPagingEnd(dp_end + 4096 * num_pages);
+    if (err) {
+      return { 0, ENOMEM };
+    }
+
     return { dp_end, 0 };
   }
 
+  namespace {
+    // apps/syscall.h の MAPFILE_* と同じ値
+    const int kMapFileSequential = 1;
+    const int kMapFileRandom = 2;
+    const int kMapFileWillNeed = 4;
+  } // namespace
+
   SYSCALL(MapFile) {
     const int fd = arg1;
-    size_t* file_size = reinterpret_cast<size_t*>(arg2);
-    // const int flags = arg3;
+    const auto user_file_size = reinterpret_cast<size_t*>(arg2);
+    const int flags = arg3;
+    auto& task = CurrentTask();
+
+    size_t file_size;
+
+    if (auto err = CopyFromUser(&file_size, user_file_size, sizeof(file_size))) {
+      return { 0, EFAULT };
+    }
+
+    // fdが負の場合は *file_size バイトの無名メモリをマップする
+    VirtualMemoryArea vma{ VirtualMemoryArea::kAnonymous };
+
+    if (fd < 0 && file_size == 0) {
+      return { 0, EINVAL };
+    } else if (fd >= 0) {
+      if (task.Files().size() <= fd || !task.Files()[fd]) {
+        return { 0, EBADF };
+      }
+
+      file_size = task.Files()[fd]->Size();
+      vma.type = VirtualMemoryArea::kFileMap;
+      vma.file = task.Files()[fd];
+
+      if (auto err = CopyToUser(user_file_size, &file_size, sizeof(file_size))) {
+        return { 0, EFAULT };
+      }
+    }
+
+    vma.size = std::max<size_t>(4096, (file_size + 4095) & 0xffff'ffff'ffff'f000);
+    vma.writable = true;
+
+    if (flags & kMapFileSequential) {
+      vma.advice = VirtualMemoryArea::kSequential;
+    } else if (flags & kMapFileRandom) {
+      vma.advice = VirtualMemoryArea::kRandom;
+    }
+
     __asm__("cli");
-    auto& task = task_manager->CurrentTask();
+    auto [ vaddr_begin, err ] = task.VMAs().InsertAnywhere(vma);
     __asm__("sti");
 
-    if (fd < 0 || task.Files().size() <= fd || !task.Files()[fd]) {
-      return { 0, EBADF };
+    if (err) {
+      return { 0, ENOMEM };
+    }
+
+    if ((flags & kMapFileWillNeed) && vma.file) {
+      __asm__("cli");
+      RequestReadAhead(vma.file, 0, vma.size / 4096);
+      __asm__("sti");
     }
 
-    *file_size = task.Files()[fd]->Size();
-    const uint64_t vaddr_end = task.FileMapEnd();
-    const uint64_t vaddr_begin =
-      (vaddr_end - *file_size) & 0xffff'ffff'ffff'f000;
-    task.SetFileMapEnd(vaddr_begin);
-    task.FileMaps().push_back(FileMapping {
-      fd,
-      vaddr_begin,
-      vaddr_end
-    });
     return { vaddr_begin, 0 };
   }
 
-  #undef SYSCALL
+  namespace {
+    const int kProtRead = 1;  // apps/syscall.h の PROT_READ
+    const int kProtWrite = 2; // apps/syscall.h の PROT_WRITE
+    const int kProtExec = 4;  // PROT_EXEC. ページは常に実行できるので受け付けるだけ
+
+    /** @brief [addr, addr + len) がページ境界に揃ったアプリ空間の範囲ならページ数を返す. */
+    std::optional<size_t> UserPageRange(uint64_t addr, size_t len) {
+      if ((addr & 4095) != 0 || addr < kUserSpaceBegin || len == 0) {
+        return std::nullopt;
+      }
 
-} // namespace syscall
+      const size_t num_pages = (len + 4095) / 4096;
 
-using SyscallFuncType = syscall::Result (uint64_t,
-                                         uint64_t,
-                                         uint64_t,
-                                         uint64_t,
-                                         uint64_t,
-                                         uint64_t);
+      if (num_pages > (0 - addr) / 4096) {
+        return std::nullopt;
+      }
+
+      return num_pages;
+    }
+  } // namespace
+
+  SYSCALL(Munmap) {
+    const uint64_t addr = arg1;
+    const size_t len = arg2;
+    auto& task = CurrentTask();
+
+    const auto num_pages = UserPageRange(addr, len);
+
+    if (!num_pages) {
+      return { 0, EINVAL };
+    }
 
-extern "C" std::array<SyscallFuncType*, 0x10> syscall_table {
-  /* 0x00 */ syscall::LogString,
-  /* 0x01 */ syscall::PutString,
-  /* 0x02 */ syscall::Exit,
-  /* 0x03 */ syscall::OpenWindow,
-  /* 0x04 */ syscall::WinWriteString,
-  /* 0x05 */ syscall::WinFillRectangle,
-  /* 0x06 */ syscall::GetCurrentTick,
-  /* 0x07 */ syscall::WinRedraw,
-  /* 0x08 */ syscall::WinDrawLine,
-  /* 0x09 */ syscall::CloseWindow,
-  /* 0x0a */ syscall::ReadEvent,
-  /* 0x0b */ syscall::CreateTimer,
-  /* 0x0c */ syscall::OpenFile,
-  /* 0x0d */ syscall::ReadFile,
-  /* 0x0e */ syscall::DemandPages,
-  /* 0x0f */ syscall::MapFile,
-};
+    // 領域を取り除くと共有メモリが破棄されることがあるので, 先にマップを外す
+    __asm__("cli");
+    auto err = CleanPageMaps(LinearAddress4Level{addr}, *num_pages);
+    task.VMAs().Remove(addr, *num_pages * 4096);
+    __asm__("sti");
+
+    if (err) {
+      return { 0, EINVAL };
+    }
+
+    return { 0, 0 };
+  }
+
+  SYSCALL(Mprotect) {
+    const uint64_t addr = arg1;
+    const size_t len = arg2;
+    const int prot = arg3;
+    auto& task = CurrentTask();
+
+    const auto num_pages = UserPageRange(addr, len);
+
+    if (!num_pages) {
+      return { 0, EINVAL };
+    }
+
+    // ページは常に読めるので, 読めなくする指定（PROT_NONEなど）は実現できない
+    if ((prot & kProtRead) == 0 || (prot & ~(kProtRead | kProtWrite | kProtExec))) {
+      return { 0, EINVAL };
+    }
+
+    const bool writable = prot & kProtWrite;
+
+    __asm__("cli");
+    auto err = task.VMAs().Protect(addr, *num_pages * 4096, writable);
+    if (!err) {
+      ProtectPageMaps(LinearAddress4Level{addr}, *num_pages, writable);
+    }
+    __asm__("sti");
+
+    if (err) {
+      return { 0, ENOMEM };
+    }
+    return { 0, 0 };
+  }
+
+  SYSCALL(GetPageFaultCount) {
+    auto& task = CurrentTask();
+    return { task.PageFaultCount(), 0 };
+  }
+
+  namespace {
+    /**
+     * @brief 描画コマンドを1つ実行する.
+     *
+     * @param user_cmd アプリのメモリ上のコマンドの先頭
+     * @param cmd user_cmdからコピー済みのコマンド本体
+     */
+    int ExecuteDrawCommand(Window& win,
+                           const char* user_cmd,
+                           const DrawCommand& cmd) {
+      auto& writer = *win.Writer();
+      const size_t data_bytes = cmd.size - sizeof(DrawCommand);
+      const char* user_data = user_cmd + sizeof(DrawCommand);
+
+      switch (cmd.type) {
+      case DrawCommand::kFill:
+        FillRectangle(writer,
+                      { cmd.arg.fill.x, cmd.arg.fill.y },
+                      { cmd.arg.fill.w, cmd.arg.fill.h },
+                      ToColor(cmd.arg.fill.color));
+        return 0;
+      case DrawCommand::kLine:
+        DrawLine(writer,
+                 cmd.arg.line.x0, cmd.arg.line.y0,
+                 cmd.arg.line.x1, cmd.arg.line.y1,
+                 ToColor(cmd.arg.line.color));
+        return 0;
+      case DrawCommand::kText: {
+        // ウィンドウに収まらない部分は描かれないので, 長すぎる文字列は切り詰める
+        char s[1024];
+        const size_t len = cmd.arg.text.len;
+
+        if (cmd.arg.text.len < 0 || len > data_bytes) {
+          return EINVAL;
+        }
+
+        const size_t copy_len = std::min(len, sizeof(s) - 1);
+
+        if (CopyFromUser(s, user_data, copy_len)) {
+          return EFAULT;
+        }
+
+        s[copy_len] = '\0';
+        WriteString(writer,
+                    { cmd.arg.text.x, cmd.arg.text.y },
+                    s,
+                    ToColor(cmd.arg.text.color));
+        return 0;
+      }
+      case DrawCommand::kBlit: {
+        const int w = cmd.arg.blit.w, h = cmd.arg.blit.h;
+
+        if (w < 0 || h < 0
+            || static_cast<uint64_t>(w) * h * sizeof(uint32_t) > data_bytes) {
+          return EINVAL;
+        }
+
+        // ウィンドウからはみ出す部分は読み飛ばす
+        const int x0 = std::max(0, -cmd.arg.blit.x);
+        const int x1 = std::min(w, win.Width() - cmd.arg.blit.x);
+        const int y0 = std::max(0, -cmd.arg.blit.y);
+        const int y1 = std::min(h, win.Height() - cmd.arg.blit.y);
+        uint32_t pixels[256];
+
+        for (int y = y0; y < y1; y++) {
+          for (int x = x0; x < x1; x += std::size(pixels)) {
+            const int n = std::min<int>(x1 - x, std::size(pixels));
+            const char* src =
+              user_data + (static_cast<size_t>(y) * w + x) * sizeof(uint32_t);
+
+            if (CopyFromUser(pixels, src, n * sizeof(uint32_t))) {
+              return EFAULT;
+            }
+
+            for (int i = 0; i < n; i++) {
+              writer.Write({ cmd.arg.blit.x + x + i, cmd.arg.blit.y + y },
+                           ToColor(pixels[i]));
+            }
+          }
+        }
+        return 0;
+      }
+      }
+
+      return EINVAL;
+    }
+  }
+
+  SYSCALL(WinDrawBatch) {
+    const char* cmds = reinterpret_cast<const char*>(arg2);
+    const size_t bytes = arg3;
+
+    return DoWinFunc(
+      [cmds, bytes](Window& win) {
+        size_t num_executed = 0;
+
+        for (size_t offset = 0; offset < bytes; ) {
+          DrawCommand cmd;
+
+          if (bytes - offset < sizeof(cmd)) {
+            return Result{ num_executed, EINVAL };
+          }
+
+          if (CopyFromUser(&cmd, cmds + offset, sizeof(cmd))) {
+            return Result{ num_executed, EFAULT };
+          }
+
+          if (cmd.size < sizeof(cmd) || cmd.size % 4 != 0
+              || cmd.size > bytes - offset) {
+            return Result{ num_executed, EINVAL };
+          }
+
+          if (auto err = ExecuteDrawCommand(win, cmds + offset, cmd)) {
+            return Result{ num_executed, err };
+          }
+
+          offset += cmd.size;
+          num_executed++;
+        }
+
+        return Result{ num_executed, 0 };
+      },
+      arg1
+    );
+  }
+
+  SYSCALL(MapWindowBuffer) {
+    const unsigned int layer_id = arg1 & 0xffffffff;
+    const auto user_info = reinterpret_cast<WindowBufferInfo*>(arg2);
+
+    auto& task = CurrentTask();
+
+    __asm__("cli");
+    auto layer = layer_manager->FindLayer(layer_id);
+    std::shared_ptr<Window> win;
+    Error err_pin = MAKE_ERROR(Error::kSuccess);
+
+    if (layer) {
+      // 描画中に影バッファが入れ替わらないよう, 割り込み禁止のまま移す
+      win = layer->GetWindow();
+      err_pin = win->PinShadowBuffer();
+    }
+    __asm__("sti");
+
+    if (!win) {
+      return { 0, EBADF };
+    } else if (err_pin.Cause() == Error::kNotImplemented) {
+      return { 0, EINVAL };
+    } else if (err_pin) {
+      return { 0, ENOMEM };
+    }
+
+    VirtualMemoryArea vma{ VirtualMemoryArea::kWindowBuffer };
+    vma.size = win->PinnedBufferBytes();
+    vma.writable = true;
+    vma.window = win;
+
+    __asm__("cli");
+    auto [ vaddr_begin, err ] = task.VMAs().InsertAnywhere(vma);
+    __asm__("sti");
+
+    if (err) {
+      return { 0, ENOMEM };
+    }
+
+    const auto& config = win->ShadowBufferConfig();
+    WindowBufferInfo info{
+      reinterpret_cast<uint8_t*>(vaddr_begin),
+      static_cast<int>(config.horizontal_resolution),
+      static_cast<int>(config.vertical_resolution),
+      static_cast<int>(config.pixels_per_scan_line),
+      config.pixel_format == kPixelRGBResv8BitPerColor
+        ? WindowBufferInfo::kRGBResv8BitPerColor
+        : WindowBufferInfo::kBGRResv8BitPerColor,
+    };
+
+    if (auto err = CopyToUser(user_info, &info, sizeof(info))) {
+      __asm__("cli");
+      task.VMAs().Remove(vaddr_begin, vma.size);
+      __asm__("sti");
+      return { 0, EFAULT };
+    }
+
+    return { vaddr_begin, 0 };
+  }
+
+  SYSCALL(WinDamage) {
+    const unsigned int layer_id = arg1 & 0xffffffff;
+    const int x = arg2, y = arg3, w = arg4, h = arg5;
+
+    if (w <= 0 || h <= 0) {
+      return { 0, EINVAL };
+    }
+
+    __asm__("cli");
+    auto layer = layer_manager->FindLayer(layer_id);
+
+    if (layer) {
+      AddLayerDamage(layer_id, {{x, y}, {w, h}});
+    }
+    __asm__("sti");
+
+    if (layer == nullptr) {
+      return { 0, EBADF };
+    }
+
+    return { 0, 0 };
+  }
+
+  namespace {
+    /** @brief WinBlitで扱う画像の幅の上限. 行の一時バッファの大きさを抑える. */
+    const int kMaxBlitWidth = 8192;
+
+    /**
+     * @brief 画像の1行をn画素分, 0xRRGGBB形式へ変換する.
+     *
+     * @param src_x 各画素の変換元のx座標. nullptrならsrcの先頭から順に変換する
+     */
+    template <int kBytesPerPixel>
+    void ConvertImageRow(const uint8_t* src,
+                         const int* src_x,
+                         uint32_t* dst,
+                         int n) {
+      // 画素形式をテンプレート引数にして分岐を外し, コンパイラにSIMD化させる
+      for (int i = 0; i < n; i++) {
+        const uint8_t* p = src + kBytesPerPixel * (src_x ? src_x[i] : i);
+
+        if constexpr (kBytesPerPixel >= 3) {
+          dst[i] = uint32_t{p[0]} << 16 | uint32_t{p[1]} << 8 | p[2];
+        } else {
+          dst[i] = uint32_t{p[0]} * 0x010101u;
+        }
+      }
+    }
+
+    void ConvertImageRow(BlitImage::BlitImageFormat format,
+                         const uint8_t* src,
+                         const int* src_x,
+                         uint32_t* dst,
+                         int n) {
+      switch (format) {
+        case BlitImage::kGray:      ConvertImageRow<1>(src, src_x, dst, n); break;
+        case BlitImage::kGrayAlpha: ConvertImageRow<2>(src, src_x, dst, n); break;
+        case BlitImage::kRGB:       ConvertImageRow<3>(src, src_x, dst, n); break;
+        case BlitImage::kRGBA:      ConvertImageRow<4>(src, src_x, dst, n); break;
+      }
+    }
+  }
+
+  SYSCALL(WinBlit) {
+    BlitImage image;
+
+    if (auto err = CopyFromUser(
+          &image, reinterpret_cast<const BlitImage*>(arg2), sizeof(image))) {
+      return { 0, EFAULT };
+    }
+
+    const int x = arg3, y = arg4;
+    // 大きさが0なら画像と同じ大きさで転送する
+    const int w = arg5 ? static_cast<int>(arg5) : image.width;
+    const int h = arg6 ? static_cast<int>(arg6) : image.height;
+    const int bpp = image.format;
+
+    if (image.width <= 0 || image.width > kMaxBlitWidth || image.height <= 0
+        || bpp < BlitImage::kGray || BlitImage::kRGBA < bpp
+        || image.bytes_per_line < image.width * bpp
+        || w <= 0 || h <= 0) {
+      return { 0, EINVAL };
+    }
+
+    return DoWinFunc(
+      [&image, x, y, w, h, bpp](Window& win) {
+        // 転送先のうちウィンドウに収まる範囲 [x0, x1) × [y0, y1)
+        const int x0 = std::max<int64_t>(x, 0);
+        const int x1 = std::min<int64_t>(int64_t{x} + w, win.Width());
+        const int y0 = std::max<int64_t>(y, 0);
+        const int y1 = std::min<int64_t>(int64_t{y} + h, win.Height());
+
+        if (x0 >= x1 || y0 >= y1) {
+          return Result{ 0, 0 };
+        }
+
+        const int n = x1 - x0;
+        const bool scaled = w != image.width || h != image.height;
+        std::vector<int> src_x;
+        int src_first = x0 - x, src_last = x1 - x - 1;
+
+        if (scaled) {
+          src_x.resize(n);
+
+          for (int i = 0; i < n; i++) {
+            src_x[i] = (int64_t{x0} - x + i) * image.width / w;
+          }
+
+          src_first = src_x.front();
+          src_last = src_x.back();
+
+          for (auto& sx : src_x) {
+            sx -= src_first;
+          }
+        }
+
+        std::vector<uint8_t> src_row((src_last - src_first + 1) * bpp);
+        std::vector<uint32_t> colors(n);
+        int converted_row = -1;
+
+        for (int dy = y0; dy < y1; dy++) {
+          const int sy = (int64_t{dy} - y) * image.height / h;
+
+          // 拡大時は同じ行が続くので, 変換済みの色をそのまま使う
+          if (sy != converted_row) {
+            const uint8_t* src = image.pixels
+              + int64_t{sy} * image.bytes_per_line + src_first * bpp;
+
+            if (CopyFromUser(src_row.data(), src, src_row.size())) {
+              return Result{ 0, EFAULT };
+            }
+
+            ConvertImageRow(image.format,
+                            src_row.data(),
+                            scaled ? src_x.data() : nullptr,
+                            colors.data(),
+                            n);
+            converted_row = sy;
+          }
+
+          win.WriteRow({x0, dy}, colors.data(), n);
+        }
+
+        return Result{ 0, 0 };
+      },
+      arg1
+    );
+  }
+
+  namespace {
+    bool IsPowerOfTwo(uint64_t x) {
+      return x != 0 && (x & (x - 1)) == 0;
+    }
+
+    /** @brief 投入された操作を実行する. タイムアウト以外は即座に完了キューへ書く. */
+    Error ExecuteIoRingOp(Task& task,
+                          IoRingContext& ring,
+                          const IoRingSubmission& sqe) {
+      const auto a = sqe.args;
+      Result res{ 0, 0 };
+
+      switch (sqe.op) {
+        case IoRingSubmission::kNop:
+          break;
+        case IoRingSubmission::kOpen:
+          res = OpenFile(a[0], a[1], 0, 0, 0, 0);
+          break;
+        case IoRingSubmission::kRead:
+          res = ReadFile(a[0], a[1], a[2], 0, 0, 0);
+          break;
+        case IoRingSubmission::kWrite:
+          res = PutString(a[0], a[1], a[2], 0, 0, 0);
+          break;
+        case IoRingSubmission::kDrawBatch:
+          res = WinDrawBatch(a[0], a[1], a[2], 0, 0, 0);
+          break;
+        case IoRingSubmission::kTimeout: {
+          const unsigned long deadline =
+            timer_manager->CurrentTick() + a[0] * kTimerFreq / 1000;
+          ring.AddTimeout(deadline, sqe.user_data);
+
+          __asm__("cli");
+          timer_manager->AddTimer(Timer{ deadline, kWakeupTimerValue, task.ID() });
+          __asm__("sti");
+          return MAKE_ERROR(Error::kSuccess);
+        }
+        default:
+          res.error = EINVAL;
+          break;
+      }
+
+      return ring.Complete(sqe.user_data, res.value, res.error);
+    }
+  } // namespace
+
+  SYSCALL(IoRingSetup) {
+    const uint64_t sq_entries = arg1, cq_entries = arg2;
+    auto& task = CurrentTask();
+
+    if (!IsPowerOfTwo(sq_entries) || sq_entries > IoRingContext::kMaxEntries
+        || !IsPowerOfTwo(cq_entries) || cq_entries > IoRingContext::kMaxEntries) {
+      return { 0, EINVAL };
+    } else if (task.Ring()) {
+      return { 0, EBUSY };
+    }
+
+    VirtualMemoryArea vma{ VirtualMemoryArea::kAnonymous };
+    vma.size = (IoRingContext::RingBytes(sq_entries, cq_entries) + 4095)
+      & 0xffff'ffff'ffff'f000;
+    vma.writable = true;
+
+    __asm__("cli");
+    auto [ vaddr_begin, err ] = task.VMAs().InsertAnywhere(vma);
+    __asm__("sti");
+
+    if (err) {
+      return { 0, ENOMEM };
+    }
+
+    auto ring = std::make_unique<IoRingContext>(vaddr_begin, sq_entries, cq_entries);
+
+    if (auto err = ring->InitializeRing()) {
+      return { 0, ENOMEM };
+    }
+
+    task.Ring() = std::move(ring);
+    return { vaddr_begin, 0 };
+  }
+
+  SYSCALL(IoRingEnter) {
+    const uint64_t to_submit = arg1;
+    const uint64_t min_complete = arg2;
+    auto& task = CurrentTask();
+    auto ring = task.Ring().get();
+
+    if (ring == nullptr) {
+      return { 0, EBADF };
+    }
+
+    uint64_t num_submitted = 0;
+
+    for (; num_submitted < to_submit; num_submitted++) {
+      IoRingSubmission sqe;
+      auto [ popped, err ] = ring->Pop(sqe);
+
+      if (err) {
+        return { num_submitted, EFAULT };
+      } else if (!popped) {
+        break;
+      }
+
+      if (auto err = ExecuteIoRingOp(task, *ring, sqe)) {
+        return { num_submitted + 1, EFAULT };
+      }
+    }
+
+    // 完了キューにmin_complete個溜まるまで, タイムアウト操作の完了を待つ
+    while (true) {
+      if (auto err = ring->CompleteTimeouts(timer_manager->CurrentTick())) {
+        return { num_submitted, EFAULT };
+      }
+
+      auto [ unread, err ] = ring->UnreadCompletions();
+
+      if (err) {
+        return { num_submitted, EFAULT };
+      }
+
+      const auto deadline = ring->NextDeadline();
+
+      if (unread >= min_complete || !deadline) {
+        break;
+      }
+
+      __asm__("cli");
+      if (task.Group().killed) {
+        __asm__("sti");
+        break;
+      }
+      if (timer_manager->CurrentTick() < *deadline) {
+        task.Sleep();
+      }
+      __asm__("sti");
+    }
+
+    return { num_submitted, 0 };
+  }
+
+  namespace {
+    const size_t kShmNameLen = 64;
+
+    /** @brief アプリが渡した共有メモリの名前をnameへ読み込む. 失敗したらerrno. */
+    int CopyShmName(char (&name)[kShmNameLen], uint64_t user_name) {
+      const auto [ name_len, err ] = StrncpyFromUser(
+        name, reinterpret_cast<const char*>(user_name), sizeof(name));
+
+      if (err.Cause() == Error::kBufferTooSmall) {
+        return ENAMETOOLONG;
+      } else if (err) {
+        return EFAULT;
+      } else if (name_len == 0) {
+        return EINVAL;
+      }
+      return 0;
+    }
+
+    /** @brief 共有メモリをfdとして開く. */
+    Result OpenShmFD(Task& task, std::shared_ptr<SharedMemory> shm) {
+      return { InstallFD(task, std::make_shared<SharedMemoryDescriptor>(std::move(shm))), 0 };
+    }
+
+    /**
+     * @brief アプリのアドレスを, 待ち合わせの識別子と今の値を読む物理アドレスへ変換する.
+     *
+     * 割り込み禁止で呼ぶ. 共有メモリなら全てのタスクで同じフレームになるので物理アドレスで
+     * 識別する. それ以外のページは書き込みでフォルトしたときと同様に自分専用のフレームを
+     * 確定させておくが, フレームは後で複製されうるので, 識別はアドレス空間と仮想アドレスで行う.
+     *
+     * @return addrが4バイト境界に揃っていないか書き込めない領域ならkInvalidAddress
+     */
+    WithError<FutexKey> ResolveFutexKey(Task& task, uint64_t addr,
+                                        uintptr_t& phys_addr) {
+      if (addr % sizeof(uint32_t) != 0) {
+        return { {}, MAKE_ERROR(Error::kInvalidAddress) };
+      }
+
+      // 書き込めない領域はResolveWritableAddressがフォルトの処理と同様に拒否する
+      auto [ resolved, err ] = ResolveWritableAddress(addr);
+
+      if (err) {
+        return { {}, MAKE_ERROR(Error::kInvalidAddress) };
+      }
+      phys_addr = resolved;
+
+      auto vma = task.VMAs().Find(addr);
+      if (vma && vma->type == VirtualMemoryArea::kSharedMemory) {
+        return { FutexKey{ 0, resolved }, MAKE_ERROR(Error::kSuccess) };
+      }
+      return { FutexKey{ GetCR3(), addr }, MAKE_ERROR(Error::kSuccess) };
+    }
+  } // namespace
+
+  SYSCALL(ShmCreate) {
+    const size_t size = arg2;
+    auto& task = CurrentTask();
+
+    char name[kShmNameLen];
+    if (int err = CopyShmName(name, arg1)) {
+      return { 0, err };
+    }
+
+    auto [ shm, err ] = CreateSharedMemory(name, size);
+
+    switch (err.Cause()) {
+      case Error::kSuccess:
+        return OpenShmFD(task, std::move(shm));
+      case Error::kAlreadyAllocated:
+        return { 0, EEXIST };
+      case Error::kIndexOutOfRange:
+        return { 0, EINVAL };
+      default:
+        return { 0, ENOMEM };
+    }
+  }
+
+  SYSCALL(ShmOpen) {
+    auto& task = CurrentTask();
+
+    char name[kShmNameLen];
+    if (int err = CopyShmName(name, arg1)) {
+      return { 0, err };
+    }
+
+    auto [ shm, err ] = OpenSharedMemory(name);
+
+    if (err) {
+      return { 0, ENOENT };
+    }
+    return OpenShmFD(task, std::move(shm));
+  }
+
+  SYSCALL(ShmMap) {
+    const int fd = arg1;
+    const auto user_size = reinterpret_cast<size_t*>(arg2);
+    auto& task = CurrentTask();
+
+    if (fd < 0 || task.Files().size() <= fd || !task.Files()[fd]) {
+      return { 0, EBADF };
+    }
+
+    auto shm = task.Files()[fd]->SharedMemoryObject();
+
+    if (!shm) {
+      return { 0, EBADF };
+    }
+
+    const size_t size = shm->Bytes();
+
+    if (user_size) {
+      if (auto err = CopyToUser(user_size, &size, sizeof(size))) {
+        return { 0, EFAULT };
+      }
+    }
+
+    VirtualMemoryArea vma{ VirtualMemoryArea::kSharedMemory };
+    vma.size = size;
+    vma.writable = true;
+    vma.shm = std::move(shm);
+
+    __asm__("cli");
+    auto [ vaddr_begin, err ] = task.VMAs().InsertAnywhere(vma);
+    __asm__("sti");
+
+    if (err) {
+      return { 0, ENOMEM };
+    }
+
+    return { vaddr_begin, 0 };
+  }
+
+  SYSCALL(ShmUnmap) {
+    const uint64_t addr = arg1;
+    auto& task = CurrentTask();
+
+    __asm__("cli");
+    auto vma = task.VMAs().Find(addr);
+
+    if (vma == nullptr || vma->type != VirtualMemoryArea::kSharedMemory) {
+      __asm__("sti");
+      return { 0, EINVAL };
+    }
+
+    const uint64_t begin = vma->begin, size = vma->size;
+
+    // 領域を取り除くと共有メモリが破棄されることがあるので, 先にマップを外す
+    auto err = CleanPageMaps(LinearAddress4Level{begin}, size / 4096);
+    task.VMAs().Remove(begin, size);
+    __asm__("sti");
+
+    if (err) {
+      return { 0, EINVAL };
+    }
+
+    return { 0, 0 };
+  }
+
+  SYSCALL(FutexWait) {
+    const uint32_t expected = arg2;
+    const unsigned long timeout_ms = arg3;
+    auto& task = CurrentTask();
+
+    // 値を読むフレームが確認の前に複製されないよう, 解決から待ち始めるまで割り込みを禁止する
+    __asm__("cli");
+    uintptr_t phys_addr;
+    auto [ key, err_key ] = ResolveFutexKey(task, arg1, phys_addr);
+
+    if (err_key) {
+      __asm__("sti");
+      return { 0, EINVAL };
+    }
+
+    std::optional<unsigned long> deadline;
+
+    if (timeout_ms > 0) {
+      deadline = timer_manager->CurrentTick() + timeout_ms * kTimerFreq / 1000;
+      timer_manager->AddTimer(Timer{ *deadline, kWakeupTimerValue, task.ID() });
+    }
+
+    switch (::FutexWait(key, phys_addr, expected, deadline).Cause()) {
+      case Error::kSuccess:
+        return { 0, 0 };
+      case Error::kValueMismatch:
+        return { 0, EAGAIN };
+      default:
+        return { 0, ETIMEDOUT };
+    }
+  }
+
+  SYSCALL(FutexWake) {
+    const size_t count = arg2;
+    auto& task = CurrentTask();
+
+    __asm__("cli");
+    uintptr_t phys_addr;
+    auto [ key, err_key ] = ResolveFutexKey(task, arg1, phys_addr);
+    __asm__("sti");
+
+    if (err_key) {
+      return { 0, EINVAL };
+    }
+
+    return { ::FutexWake(key, count), 0 };
+  }
+
+  SYSCALL(ThreadCreate) {
+    auto [ thread_id, err ] = CreateThread(CurrentTask(), arg1, arg2, arg3);
+
+    switch (err.Cause()) {
+      case Error::kSuccess:
+        return { thread_id, 0 };
+      case Error::kIndexOutOfRange:
+        return { 0, EINVAL };
+      default:
+        return { 0, ENOMEM };
+    }
+  }
+
+  SYSCALL(ThreadExit) {
+    auto& task = CurrentTask();
+    return { task.OSStackPointer(), static_cast<int>(arg1) };
+  }
+
+  SYSCALL(ThreadJoin) {
+    auto [ exit_code, err ] = JoinThread(CurrentTask(), arg1);
+
+    if (err) {
+      return { 0, ESRCH };
+    }
+    return { static_cast<uint64_t>(exit_code), 0 };
+  }
+
+  SYSCALL(ThreadSelf) {
+    return { CurrentTask().ID(), 0 };
+  }
+
+  #undef SYSCALL
+
+} // namespace syscall
+
+using SyscallFuncType = syscall::Result (uint64_t,
+                                         uint64_t,
+                                         uint64_t,
+                                         uint64_t,
+                                         uint64_t,
+                                         uint64_t);
+
+std::array<SyscallStat, kNumSyscalls> syscall_stats;
+uint64_t unknown_syscall_count;
+
+extern "C" syscall::Result SyscallUnknown(uint64_t, uint64_t, uint64_t,
+                                          uint64_t, uint64_t, uint64_t) {
+  ++unknown_syscall_count;
+  return { 0, ENOSYS };
+}
+
+/**
+ * @brief SyscallEntryがアプリへ戻る前に呼ぶ.
+ *
+ * スレッドグループが終了させられていれば, Exitと同じくOS用スタックポインタと
+ * 終了コードを返す. そうでなければ0を返し, アプリへ戻ってよい.
+ */
+extern "C" syscall::Result SyscallCheckKilled() {
+  auto& task = CurrentTask();
+
+  if (!task.Group().killed) {
+    return { 0, 0 };
+  }
+  return { task.OSStackPointer(), task.Group().exit_code };
+}
+
+namespace {
+  template <int N, SyscallFuncType* F>
+  syscall::Result CountedSyscall(uint64_t arg1, uint64_t arg2, uint64_t arg3,
+                                 uint64_t arg4, uint64_t arg5, uint64_t arg6) {
+    const uint64_t start = __builtin_ia32_rdtsc();
+    const auto res = F(arg1, arg2, arg3, arg4, arg5, arg6);
+    const uint64_t cycles = __builtin_ia32_rdtsc() - start;
+
+    auto& stat = syscall_stats[N];
+    ++stat.calls;
+    stat.total_cycles += cycles;
+    const int bucket = 64 - __builtin_clzll(cycles | 1) - kSyscallLatencyShift;
+    ++stat.latency[std::clamp(bucket, 0, kSyscallLatencyBuckets - 1)];
+    return res;
+  }
+
+  constexpr std::array<SyscallFuncType*, kNumSyscalls> MakeSyscallTable() {
+    std::array<SyscallFuncType*, kNumSyscalls> table{};
+    for (auto& f : table) {
+      f = SyscallUnknown;
+    }
+  #define SYSCALL_ENTRY(num, name) \
+    table[num] = CountedSyscall<num, syscall::name>;
+    SYSCALL_LIST(SYSCALL_ENTRY)
+  #undef SYSCALL_ENTRY
+    return table;
+  }
+}
+
+extern "C" std::array<SyscallFuncType*, kNumSyscalls> syscall_table =
+  MakeSyscallTable();
+extern "C" const uint32_t syscall_table_size = kNumSyscalls;
+
+const char* SyscallName(int number) {
+  switch (number) {
+  #define SYSCALL_ENTRY(num, name) case num: return #name;
+    SYSCALL_LIST(SYSCALL_ENTRY)
+  #undef SYSCALL_ENTRY
+  }
+  return nullptr;
+}
 
 void InitializeSyscall() {
   WriteMSR(kIA32_EFER, 0x0501u);
   WriteMSR(kIA32_LSTAR, reinterpret_cast<uint64_t>(SyscallEntry));
   WriteMSR(kIA32_STAR, static_cast<uint64_t>(8) << 32 |
                        static_cast<uint64_t>(16 | 3) << 48);
-  WriteMSR(kIA32_FMASK, 0);
+  // SyscallEntryがOS用スタックへ切り替えるまで割り込みを禁止する（RFLAGS.IF）
+  WriteMSR(kIA32_FMASK, 1u << 9);
 }
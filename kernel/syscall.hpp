@@ -1,3 +1,31 @@
 #pragma once
 
+#include <array>
+#include <cstdint>
+#include "syscall_table.hpp"
+
+/** @brief 処理時間のヒストグラムの最初のバケットの上限（2の指数, サイクル）. */
+const int kSyscallLatencyShift = 10;
+const int kSyscallLatencyBuckets = 16;
+
+/**
+ * @brief システムコール1種類の起動以来の呼び出し統計.
+ *
+ * latency[0] は処理時間が 2^kSyscallLatencyShift サイクル未満だった回数,
+ * latency[i] は 2^(kSyscallLatencyShift+i-1) 以上 2^(kSyscallLatencyShift+i) 未満だった回数.
+ * 最後のバケットはそれ以上をすべて含む. 処理時間にはブロックしていた時間も含む.
+ */
+struct SyscallStat {
+  uint64_t calls;
+  uint64_t total_cycles;
+  std::array<uint64_t, kSyscallLatencyBuckets> latency;
+};
+
+extern std::array<SyscallStat, kNumSyscalls> syscall_stats;
+/** @brief 範囲外あるいは欠番のシステムコール番号で呼ばれた回数. */
+extern uint64_t unknown_syscall_count;
+
+/** @brief システムコール番号から名前を得る. 欠番なら nullptr. */
+const char* SyscallName(int number);
+
 void InitializeSyscall();
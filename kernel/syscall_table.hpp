@@ -0,0 +1,45 @@
+#pragma once
+
+// tools/makesyscall.py が syscalls.txt から生成する. 直接編集しないこと
+
+static const int kSyscallABIVersion = 1;
+static const int kNumSyscalls = 36;
+
+#define SYSCALL_LIST(X) \
+  X(0x00, LogString) \
+  X(0x01, PutString) \
+  X(0x02, Exit) \
+  X(0x03, OpenWindow) \
+  X(0x04, WinWriteString) \
+  X(0x05, WinFillRectangle) \
+  X(0x06, GetCurrentTick) \
+  X(0x07, WinRedraw) \
+  X(0x08, WinDrawLine) \
+  X(0x09, CloseWindow) \
+  X(0x0a, ReadEvent) \
+  X(0x0b, CreateTimer) \
+  X(0x0c, OpenFile) \
+  X(0x0d, ReadFile) \
+  X(0x0e, DemandPages) \
+  X(0x0f, MapFile) \
+  X(0x10, Munmap) \
+  X(0x11, Mprotect) \
+  X(0x12, GetPageFaultCount) \
+  X(0x13, WinDrawBatch) \
+  X(0x14, MapWindowBuffer) \
+  X(0x15, WinDamage) \
+  X(0x16, WinBlit) \
+  X(0x17, IoRingSetup) \
+  X(0x18, IoRingEnter) \
+  X(0x19, ReadEventEx) \
+  X(0x1a, ShmCreate) \
+  X(0x1b, ShmOpen) \
+  X(0x1c, ShmMap) \
+  X(0x1d, ShmUnmap) \
+  X(0x1e, FutexWait) \
+  X(0x1f, FutexWake) \
+  X(0x20, ThreadCreate) \
+  X(0x21, ThreadExit) \
+  X(0x22, ThreadJoin) \
+  X(0x23, ThreadSelf) \
+
@@ -1,4 +1,5 @@
 #include "asmfunc.h"
+#include "cpu_local.hpp"
 #include "segment.hpp"
 #include "task.hpp"
 #include "timer.hpp"
@@ -15,9 +16,16 @@ namespace {
       __asm__("hlt");
     }
   }
+
+  /** @brief GSから参照される実行中タスクの情報を更新する. */
+  void SetCPULocalTask(Task& task) {
+    cpu_local->current_task = &task;
+    cpu_local->os_stack_ptr = &task.OSStackPointer();
+  }
 } // namespace
 
-Task::Task(uint64_t id) : id_{id}, msgs_{} {
+Task::Task(uint64_t id)
+    : id_{id}, msgs_{}, group_{std::make_shared<ThreadGroup>()} {
 }
 
 Task& Task::InitContext(TaskFunc* f, int64_t data) {
@@ -66,50 +74,64 @@ Task& Task::Wakeup() {
 }
 
 void Task::SendMessage(const Message& msg) {
-  msgs_.push_back(msg);
+  const int c = static_cast<int>(ClassOf(msg.type));
+  msgs_[c].push_back(QueuedMessage{ msg, __builtin_ia32_rdtsc() });
+  msg_stats_[c].max_depth = std::max<uint64_t>(msg_stats_[c].max_depth,
+                                               msgs_[c].size());
   Wakeup();
 }
 
 std::optional<Message> Task::ReceiveMessage() {
-  if (msgs_.empty()) {
-    return std::nullopt;
+  for (int c = kNumMessageClasses - 1; c >= 0; --c) {
+    if (msgs_[c].empty()) {
+      continue;
+    }
+
+    const auto q = msgs_[c].front();
+    msgs_[c].pop_front();
+
+    const uint64_t wait = __builtin_ia32_rdtsc() - q.sent_tsc;
+    auto& stat = msg_stats_[c];
+    ++stat.received;
+    stat.total_wait_cycles += wait;
+    stat.max_wait_cycles = std::max(stat.max_wait_cycles, wait);
+    return q.msg;
   }
 
-  auto m = msgs_.front();
-  msgs_.pop_front();
-  return m;
+  return std::nullopt;
 }
 
-std::vector<std::shared_ptr<::FileDescriptor>>& Task::Files() {
-  return files_;
+const std::array<MessageQueueStat, kNumMessageClasses>& Task::MessageStats() const {
+  return msg_stats_;
 }
 
-uint64_t Task::DPagingBegin() const {
-  return dpaging_begin_;
+std::vector<std::shared_ptr<::FileDescriptor>>& Task::Files() {
+  return group_->files;
 }
 
-void Task::SetDPagingBegin(uint64_t v) {
-  dpaging_begin_ = v;
+VMATree& Task::VMAs() {
+  return group_->vmas;
 }
 
-uint64_t Task::DPagingEnd() const {
-  return dpaging_end_;
+PageMapCursor& Task::PageCursor() {
+  return page_cursor_;
 }
 
-void Task::SetDPagingEnd(uint64_t v) {
-  dpaging_end_ = v;
+uint64_t& Task::PageFaultCount() {
+  return page_fault_count_;
 }
 
-uint64_t Task::FileMapEnd() const {
-  return file_map_end_;
+std::unique_ptr<IoRingContext>& Task::Ring() {
+  return ring_;
 }
 
-void Task::SetFileMapEnd(uint64_t v) {
-  file_map_end_ = v;
+ThreadGroup& Task::Group() {
+  return *group_;
 }
 
-std::vector<FileMapping>& Task::FileMaps() {
-  return file_maps_;
+Task& Task::JoinGroup(Task& other) {
+  group_ = other.group_;
+  return *this;
 }
 
 TaskManager::TaskManager() {
@@ -123,6 +145,8 @@ TaskManager::TaskManager() {
     .SetLevel(0)
     .SetRunning(true);
   running_[0].push_back(&idle);
+
+  SetCPULocalTask(task);
 }
 
 Task& TaskManager::NewTask() {
@@ -246,6 +270,26 @@ Task& TaskManager::CurrentTask() {
   return *running_[current_level_].front();
 }
 
+Task* TaskManager::FindTask(uint64_t id) {
+  auto it = std::find_if(
+    tasks_.begin(),
+    tasks_.end(),
+    [id](const auto& t) {
+      return t->ID() == id;
+    }
+  );
+
+  return it == tasks_.end() ? nullptr : it->get();
+}
+
+void TaskManager::WakeupGroup(const ThreadGroup& group) {
+  for (auto& task : tasks_) {
+    if (task->group_.get() == &group) {
+      Wakeup(task.get());
+    }
+  }
+}
+
 void TaskManager::Finish(int exit_code) {
   Task* current_task = RotateCurrentRunQueue(true);
 
@@ -341,11 +385,20 @@ Task* TaskManager::RotateCurrentRunQueue(bool current_sleep) {
     }
   }
 
+  SetCPULocalTask(CurrentTask());
   return current_task;
 }
 
 TaskManager* task_manager;
 
+std::array<uint64_t, kKeyEchoLatencyBuckets> key_echo_latency;
+
+void RecordKeyEcho(uint64_t origin_tsc) {
+  const uint64_t cycles = __builtin_ia32_rdtsc() - origin_tsc;
+  const int bucket = 64 - __builtin_clzll(cycles | 1) - kKeyEchoLatencyShift;
+  ++key_echo_latency[std::clamp(bucket, 0, kKeyEchoLatencyBuckets - 1)];
+}
+
 void InitializeTask() {
 
   task_manager = new TaskManager;
@@ -360,8 +413,3 @@ void InitializeTask() {
   );
   __asm__("sti");
 }
-
-__attribute__((no_caller_saved_registers))
-extern "C" uint64_t GetCurrentTaskOSStackPointer() {
-  return task_manager->CurrentTask().OSStackPointer();
-}
@@ -11,13 +11,16 @@
 #include <cstdint>
 #include <deque>
 #include <map>
+#include <memory>
 #include <optional>
 #include <vector>
 
 #include "error.hpp"
 #include "fat.hpp"
+#include "io_ring.hpp"
 #include "message.hpp"
 #include "paging.hpp"
+#include "vma.hpp"
 
 struct TaskContext {
   uint64_t cr3, rip, rflags, reserved1; // offset 0x00
@@ -29,13 +32,27 @@ struct TaskContext {
 
 using TaskFunc = void (uint64_t, int64_t);
 
-class TaskManager;
-
-struct FileMapping {
-  int fd;
-  uint64_t vaddr_begin, vaddr_end;
+/**
+ * @brief 同じアプリのスレッド（タスク）が共有する資源.
+ *
+ * スレッドでないタスクは自分だけのものを持つ.
+ */
+struct ThreadGroup {
+  std::vector<std::shared_ptr<::FileDescriptor>> files{};
+  VMATree vmas{};
+  /** @brief CreateThreadで作り, まだJoinThreadしていないスレッドのID. */
+  std::vector<uint64_t> thread_ids{};
+  /**
+   * @brief いずれかのスレッドがExitしたかフォルトで強制終了され, 全スレッドを終了させる.
+   *
+   * 各スレッドはアプリへ戻る前や待ちから起きたときにこれを見て, exit_codeで終了する.
+   */
+  bool killed{false};
+  int exit_code{0};
 };
 
+class TaskManager;
+
 class Task {
   public:
     static const int kDefaultLevel = 1;
@@ -49,15 +66,18 @@ class Task {
     Task& Sleep();
     Task& Wakeup();
     void SendMessage(const Message& msg);
+    /** @brief 優先度の最も高い分類の, 最も古いメッセージを取り出す. */
     std::optional<Message> ReceiveMessage();
+    const std::array<MessageQueueStat, kNumMessageClasses>& MessageStats() const;
     std::vector<std::shared_ptr<::FileDescriptor>>& Files();
-    uint64_t DPagingBegin() const;
-    void SetDPagingBegin(uint64_t v);
-    uint64_t DPagingEnd() const;
-    void SetDPagingEnd(uint64_t v);
-    uint64_t FileMapEnd() const;
-    void SetFileMapEnd(uint64_t v);
-    std::vector<FileMapping>& FileMaps();
+    VMATree& VMAs();
+    PageMapCursor& PageCursor();
+    uint64_t& PageFaultCount();
+    std::unique_ptr<IoRingContext>& Ring();
+    ThreadGroup& Group();
+
+    /** @brief otherと同じスレッドグループに入り, ファイルと仮想メモリ領域を共有する. */
+    Task& JoinGroup(Task& other);
 
     int Level() const {
       return level_;
@@ -72,13 +92,18 @@ class Task {
     std::vector<uint64_t> stack_;
     alignas(16) TaskContext context_;
     uint64_t os_stack_pointer_;
-    std::deque<Message> msgs_;
+    struct QueuedMessage {
+      Message msg;
+      uint64_t sent_tsc;
+    };
+    std::array<std::deque<QueuedMessage>, kNumMessageClasses> msgs_;
+    std::array<MessageQueueStat, kNumMessageClasses> msg_stats_{};
     unsigned int level_{kDefaultLevel};
     bool running_{false};
-    std::vector<std::shared_ptr<::FileDescriptor>> files_{};
-    uint64_t dpaging_begin_{0}, dpaging_end_{0};
-    uint64_t file_map_end_{0};
-    std::vector<FileMapping> file_maps_{};
+    std::shared_ptr<ThreadGroup> group_;
+    PageMapCursor page_cursor_{};
+    uint64_t page_fault_count_{0};
+    std::unique_ptr<IoRingContext> ring_{};
 
     Task& SetLevel(int level) {
       level_ = level;
@@ -107,6 +132,10 @@ class TaskManager {
     Error Wakeup(uint64_t id, int level = -1);
     Error SendMessage(uint64_t id, const Message& msg);
     Task& CurrentTask();
+    /** @brief IDがidのタスクを返す. 無ければnullptr. */
+    Task* FindTask(uint64_t id);
+    /** @brief groupに属する全てのタスクを起こす. */
+    void WakeupGroup(const ThreadGroup& group);
     void Finish(int exit_code);
     WithError<int> WaitFinish(uint64_t task_id);
 
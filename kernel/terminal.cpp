@@ -1,6 +1,7 @@
 #include <cstring>
 #include <limits>
 #include "asmfunc.h"
+#include "compositor.hpp"
 #include "elf.hpp"
 #include "fat.hpp"
 #include "font.hpp"
@@ -10,7 +11,9 @@
 #include "memory_manager.hpp"
 #include "paging.hpp"
 #include "pci.hpp"
+#include "syscall.hpp"
 #include "terminal.hpp"
+#include "thread.hpp"
 #include "timer.hpp"
 
 namespace {
@@ -112,8 +115,7 @@ namespace {
       last_addr = std::max(last_addr, phdr[i].p_vaddr + phdr[i].p_memsz);
       const auto num_4kpages = (phdr[i].p_memsz + 4095) / 4096;
 
-      // setup pagemaps as readonly (writable = false)
-      if (auto err = SetupPageMaps(dest_addr, num_4kpages, false)) {
+      if (auto err = SetupPageMaps(dest_addr, num_4kpages)) {
         return { last_addr, err };
       }
 
@@ -121,6 +123,9 @@ namespace {
       const auto dst = reinterpret_cast<uint8_t*>(phdr[i].p_vaddr);
       memcpy(dst, src, phdr[i].p_filesz);
       memset(dst + phdr[i].p_filesz, 0, phdr[i].p_memsz - phdr[i].p_filesz);
+
+      // setup pagemaps as readonly (writable = false) after loading
+      ProtectPageMaps(dest_addr, num_4kpages, false);
     }
 
     return { last_addr, MAKE_ERROR(Error::kSuccess) };
@@ -133,7 +138,7 @@ namespace {
 
     const auto addr_first = GetFirstLoadAddress(ehdr);
 
-    if (addr_first < 0xffff'8000'0000'0000) {
+    if (addr_first < kUserSpaceBegin) {
       return { 0, MAKE_ERROR(Error::kInvalidFormat) };
     }
 
@@ -141,15 +146,12 @@ namespace {
   }
 
   WithError<PageMapEntry*> SetupPML4(Task& current_task) {
-    auto pml4 = NewPageMap();
+    auto pml4 = NewPML4();
 
     if (pml4.error) {
       return pml4;
     }
 
-    const auto current_pml4 = reinterpret_cast<PageMapEntry*>(GetCR3());
-    memcpy(pml4.value, current_pml4, 256 * sizeof(uint64_t));
-
     const auto cr3 = reinterpret_cast<uint64_t>(pml4.value);
     SetCR3(cr3);
     current_task.Context().cr3 = cr3;
@@ -189,6 +191,16 @@ namespace {
     }
   }
 
+  /** @brief LoadAppで使用中にしたアプリイメージを, 回収できる状態に戻す. */
+  void ReleaseApp(fat::DirectoryEntry& file_entry) {
+    __asm__("cli");
+    if (auto it = app_loads->find(&file_entry); it != app_loads->end()) {
+      it->second.num_users--;
+      it->second.last_used = timer_manager->CurrentTick();
+    }
+    __asm__("sti");
+  }
+
   WithError<AppLoadInfo> LoadApp(fat::DirectoryEntry& file_entry, Task& task) {
     PageMapEntry* temp_pml4;
 
@@ -198,18 +210,31 @@ namespace {
       temp_pml4 = pml4;
     }
 
-    if (auto it = app_loads->find(&file_entry); it != app_loads->end()) {
+    __asm__("cli");
+    auto it = app_loads->find(&file_entry);
+
+    if (it != app_loads->end()) {
+      // コピーしたページテーブルが指すフレームを回収されないように, 使用中にする
+      it->second.num_users++;
       AppLoadInfo app_load = it->second;
+      __asm__("sti");
+
       auto err = CopyPageMaps(
         temp_pml4,
         app_load.pml4,
         4,
-        256
+        kUserPML4Index
       );
       app_load.pml4 = temp_pml4;
+
+      if (err) {
+        ReleaseApp(file_entry);
+      }
       return { app_load, err };
     }
 
+    __asm__("sti");
+
     std::vector<uint8_t> file_buf(file_entry.file_size);
     fat::LoadFile(&file_buf[0], file_buf.size(), file_entry);
     auto elf_header = reinterpret_cast<Elf64_Ehdr*>(&file_buf[0]);
@@ -227,11 +252,15 @@ namespace {
     AppLoadInfo app_load {
       last_addr,
       elf_header->e_entry,
-      temp_pml4
+      temp_pml4,
+      1
     };
+    __asm__("cli");
     app_loads->insert(std::make_pair(&file_entry, app_load));
+    __asm__("sti");
 
     if (auto [ pml4, err ] = SetupPML4(task); err) {
+      ReleaseApp(file_entry);
       return { app_load, err };
     } else {
       app_load.pml4 = pml4;
@@ -241,9 +270,12 @@ namespace {
       app_load.pml4,
       temp_pml4,
       4,
-      256
+      kUserPML4Index
     );
 
+    if (err) {
+      ReleaseApp(file_entry);
+    }
     return { app_load, err };
   }
 
@@ -282,6 +314,33 @@ namespace {
 
 std::map<fat::DirectoryEntry*, AppLoadInfo>* app_loads;
 
+size_t EvictAppImages(size_t num_frames) {
+  const size_t free_frames = memory_manager->FreeFrames();
+
+  while (memory_manager->FreeFrames() - free_frames < num_frames) {
+    auto victim = app_loads->end();
+
+    for (auto it = app_loads->begin(); it != app_loads->end(); ++it) {
+      if (it->second.num_users == 0
+          && (victim == app_loads->end()
+              || it->second.last_used < victim->second.last_used)) {
+        victim = it;
+      }
+    }
+
+    if (victim == app_loads->end()) {
+      break;
+    }
+
+    if (auto err = FreeAddressSpace(victim->second.pml4)) {
+      Log(kError, "failed to free app image: %s\n", err.Name());
+    }
+    app_loads->erase(victim);
+  }
+
+  return memory_manager->FreeFrames() - free_frames;
+}
+
 Terminal::Terminal(Task& task, const TerminalDescriptor* term_desc)
     : task_{task} {
   if (term_desc) {
@@ -434,6 +493,18 @@ void Terminal::Scroll1() {
 }
 
 void Terminal::ExecuteLine() {
+  // time <コマンドライン>: パイプを含むコマンドライン全体の実行時間を測る
+  if (strncmp(&linebuf_[0], "time ", 5) == 0) {
+    memmove(&linebuf_[0], &linebuf_[5], linebuf_.size() - 5);
+    const auto tick_start = timer_manager->CurrentTick();
+    ExecuteLine();
+    PrintToFD(
+      *files_[2],
+      "%lu ms\n",
+      (timer_manager->CurrentTick() - tick_start) * 1000 / kTimerFreq
+    );
+    return;
+  }
 
   char* command = &linebuf_[0];
   char* first_arg = strchr(&linebuf_[0], ' ');
@@ -479,43 +550,22 @@ void Terminal::ExecuteLine() {
   }
 
   std::shared_ptr<PipeDescriptor> pipe_fd;
-  uint64_t subtask_id = 0;
+  std::vector<uint64_t> stage_ids;
 
   if (pipe_char) {
     *pipe_char = 0;
-    char* subcommand = &pipe_char[1];
-    while (isspace(*subcommand)) {
-      subcommand++;
-    }
-
-    auto& subtask = task_manager->NewTask();
-    pipe_fd = std::make_shared<PipeDescriptor>(subtask);
-    auto term_desc = new TerminalDescriptor {
-      subcommand,
-      true,
-      false,
-      {
-        pipe_fd,
-        files_[1],
-        files_[2],
-      }
-    };
+    pipe_fd = StartPipeline(&pipe_char[1], stage_ids);
     files_[1] = pipe_fd;
-
-    subtask_id = subtask
-      .InitContext(
-        TaskTerminal,
-        reinterpret_cast<int64_t>(term_desc)
-      )
-      .Wakeup()
-      .ID();
-    (*layer_task_map)[layer_id_] = subtask_id;
   }
 
   if (strcmp(command, "echo") == 0) {
     if (first_arg && first_arg[0] == '$') {
       if (strcmp(&first_arg[1], "?") == 0) {
         PrintToFD(*files_[1], "%d", last_exit_code_);
+      } else if (strcmp(&first_arg[1], "PIPESTATUS") == 0) {
+        for (int i = 0; i < pipe_status_.size(); i++) {
+          PrintToFD(*files_[1], i == 0 ? "%d" : " %d", pipe_status_[i]);
+        }
       }
     } else if (first_arg) {
       PrintToFD(*files_[1], "%s", first_arg);
@@ -650,6 +700,130 @@ void Terminal::ExecuteLine() {
       p_stat.total_frames,
       p_stat.total_frames * kBytesPerFrame / 1024 / 1024
     );
+  } else if (strcmp(command, "sysstat") == 0) {
+    PrintToFD(*files_[1], "syscall ABI version %d\n", kSyscallABIVersion);
+    for (int i = 0; i < kNumSyscalls; ++i) {
+      const char* name = SyscallName(i);
+      const auto& stat = syscall_stats[i];
+      if (stat.calls == 0 || (first_arg && strcmp(first_arg, name) != 0)) {
+        continue;
+      }
+      PrintToFD(
+        *files_[1],
+        "%02x %-18s %8lu calls %10lu cycles/call\n",
+        i,
+        name,
+        stat.calls,
+        stat.total_cycles / stat.calls
+      );
+      if (!first_arg) {
+        continue;
+      }
+      // 名前を指定されたら処理時間のヒストグラムも出す
+      for (int b = 0; b < kSyscallLatencyBuckets; ++b) {
+        const bool last = b == kSyscallLatencyBuckets - 1;
+        PrintToFD(
+          *files_[1],
+          "  %s 2^%-2d cycles %8lu\n",
+          last ? ">=" : "< ",
+          kSyscallLatencyShift + b - last,
+          stat.latency[b]
+        );
+      }
+    }
+    PrintToFD(*files_[1], "unknown %lu calls\n", unknown_syscall_count);
+  } else if (strcmp(command, "msgstat") == 0) {
+    const uint64_t task_id = first_arg ? strtoul(first_arg, nullptr, 0) : 1;
+    static const char* const class_names[kNumMessageClasses] = {
+      "timer", "layer", "interrupt", "input",
+    };
+
+    __asm__("cli");
+    auto task = task_manager->FindTask(task_id);
+    std::array<MessageQueueStat, kNumMessageClasses> stats{};
+    if (task) {
+      stats = task->MessageStats();
+    }
+    __asm__("sti");
+
+    if (!task) {
+      PrintToFD(*files_[2], "no such task: %lu\n", task_id);
+      exit_code = 1;
+    } else {
+      for (int c = kNumMessageClasses - 1; c >= 0; --c) {
+        const auto& stat = stats[c];
+        PrintToFD(
+          *files_[1],
+          "%-9s %8lu msgs  max depth %4lu  wait %10lu avg %10lu max cycles\n",
+          class_names[c],
+          stat.received,
+          stat.max_depth,
+          stat.received ? stat.total_wait_cycles / stat.received : 0,
+          stat.max_wait_cycles
+        );
+      }
+
+      PrintToFD(*files_[1], "key to echo latency:\n");
+      for (int b = 0; b < kKeyEchoLatencyBuckets; ++b) {
+        const bool last = b == kKeyEchoLatencyBuckets - 1;
+        PrintToFD(
+          *files_[1],
+          "  %s 2^%-2d cycles %8lu\n",
+          last ? ">=" : "< ",
+          kKeyEchoLatencyShift + b - last,
+          key_echo_latency[b]
+        );
+      }
+    }
+  } else if (strcmp(command, "fatstat") == 0) {
+    const auto& stat = fat::cluster_stat;
+    PrintToFD(
+      *files_[1],
+      "clusters %lu free / %lu total, %lu bytes each\n",
+      stat.free_clusters,
+      stat.total_clusters,
+      fat::bytes_per_cluster
+    );
+    PrintToFD(
+      *files_[1],
+      "allocations %lu, %lu clusters\n",
+      stat.allocations,
+      stat.allocated_clusters
+    );
+    __asm__("cli");
+    const auto lookup = fat::lookup_stat;
+    __asm__("sti");
+    PrintToFD(
+      *files_[1],
+      "lookups %lu hits, %lu misses\n",
+      lookup.hits,
+      lookup.misses
+    );
+  } else if (strcmp(command, "framestat") == 0) {
+    __asm__("cli");
+    const auto stat = compositor_stat;
+    const auto hist = frame_time;
+    __asm__("sti");
+
+    PrintToFD(*files_[1], "damages %lu, frames %lu\n", stat.damages, stat.frames);
+    PrintToFD(
+      *files_[1],
+      "rects %lu, pixels %lu, max cli %lu cycles\n",
+      stat.rects,
+      stat.pixels,
+      stat.max_cli_cycles
+    );
+    PrintToFD(*files_[1], "frame time:\n");
+    for (int b = 0; b < kFrameTimeBuckets; ++b) {
+      const bool last = b == kFrameTimeBuckets - 1;
+      PrintToFD(
+        *files_[1],
+        "  %s 2^%-2d cycles %8lu\n",
+        last ? ">=" : "< ",
+        kFrameTimeShift + b - last,
+        hist[b]
+      );
+    }
   } else if (command[0] != 0) {
     auto file_entry=  FindCommand(command);
     if (!file_entry) {
@@ -680,24 +854,91 @@ void Terminal::ExecuteLine() {
 
   if (pipe_fd) {
     pipe_fd->FinishWrite();
+    pipe_status_ = { exit_code };
+
+    // 全ての段の終了を待つ. 全体の終了コードは最後の段のもの
+    for (auto stage_id : stage_ids) {
+      __asm__("cli");
+      auto [ ec, err ] = task_manager->WaitFinish(stage_id);
+      __asm__("sti");
+      if (err) {
+        Log(
+          kWarn,
+          "failed to wait finish: %s\n",
+          err.Name()
+        );
+      }
+      pipe_status_.push_back(ec);
+      exit_code = ec;
+    }
+
     __asm__("cli");
-    auto [ ec, err ] = task_manager->WaitFinish(subtask_id);
     (*layer_task_map)[layer_id_] = task_.ID();
     __asm__("sti");
-    if (err) {
-      Log(
-        kWarn,
-        "failed to wait finish: %s\n",
-        err.Name()
-      );
-    }
-    exit_code = ec;
+  } else {
+    pipe_status_ = { exit_code };
   }
 
   last_exit_code_ = exit_code;
   files_[1] = original_stdout;
 }
 
+std::shared_ptr<PipeDescriptor> Terminal::StartPipeline(
+    char* stages, std::vector<uint64_t>& stage_ids) {
+  auto [ first_read, first_write ] = MakePipe();
+  std::shared_ptr<FileDescriptor> stage_in = first_read;
+  char* stage = stages;
+
+  while (stage) {
+    char* next_stage = strchr(stage, '|');
+    if (next_stage) {
+      *next_stage = 0;
+      next_stage++;
+    }
+    while (isspace(*stage)) {
+      stage++;
+    }
+
+    // 最後の段以外は次の段へのパイプに書く
+    std::shared_ptr<FileDescriptor> stage_out = files_[1];
+    std::shared_ptr<FileDescriptor> next_in;
+    if (next_stage) {
+      auto [ pipe_read, pipe_write ] = MakePipe();
+      stage_out = pipe_write;
+      next_in = pipe_read;
+    }
+
+    auto term_desc = new TerminalDescriptor {
+      stage,
+      true,
+      false,
+      {
+        stage_in,
+        stage_out,
+        files_[2],
+      }
+    };
+
+    stage_ids.push_back(task_manager->NewTask()
+      .InitContext(
+        TaskTerminal,
+        reinterpret_cast<int64_t>(term_desc)
+      )
+      .Wakeup()
+      .ID());
+
+    stage_in = next_in;
+    stage = next_stage;
+  }
+
+  // キー入力は最後の段（moreなど）へ送る
+  __asm__("cli");
+  (*layer_task_map)[layer_id_] = stage_ids.back();
+  __asm__("sti");
+
+  return first_write;
+}
+
 WithError<int> Terminal::ExecuteFile(fat::DirectoryEntry& file_entry,
                                      char* command,
                                      char* first_arg) {
@@ -714,6 +955,7 @@ WithError<int> Terminal::ExecuteFile(fat::DirectoryEntry& file_entry,
   LinearAddress4Level args_frame_addr{0xffff'ffff'ffff'f000};
 
   if (auto err = SetupPageMaps(args_frame_addr, 1)) {
+    ReleaseApp(file_entry);
     return { 0, err };
   }
 
@@ -731,6 +973,7 @@ WithError<int> Terminal::ExecuteFile(fat::DirectoryEntry& file_entry,
   );
 
   if (argc.error) {
+    ReleaseApp(file_entry);
     return { 0, argc.error };
   }
 
@@ -738,6 +981,7 @@ WithError<int> Terminal::ExecuteFile(fat::DirectoryEntry& file_entry,
   LinearAddress4Level stack_frame_addr{0xffff'ffff'ffff'f000 - stack_size};
 
   if (auto err = SetupPageMaps(stack_frame_addr, stack_size / 4096)) {
+    ReleaseApp(file_entry);
     return { 0, err };
   }
 
@@ -747,10 +991,22 @@ WithError<int> Terminal::ExecuteFile(fat::DirectoryEntry& file_entry,
 
   const uint64_t elf_next_page = (app_load.vaddr_end + 4095)
     & 0xffff'ffff'ffff'f000;
-  task.SetDPagingBegin(elf_next_page);
-  task.SetDPagingEnd(elf_next_page);
-
-  task.SetFileMapEnd(stack_frame_addr.value);
+  auto& vmas = task.VMAs();
+  vmas.Insert(VirtualMemoryArea{
+    VirtualMemoryArea::kImage,
+    kUserSpaceBegin,
+    elf_next_page - kUserSpaceBegin,
+    true,
+  });
+  vmas.SetHeapBase(elf_next_page);
+
+  // スタックと引数用のページはアドレス空間の末尾まで続く
+  vmas.Insert(VirtualMemoryArea{
+    VirtualMemoryArea::kStack,
+    stack_frame_addr.value,
+    stack_size + 4096,
+    true,
+  });
 
   int ret = CallApp(
     argc.value,
@@ -761,11 +1017,21 @@ WithError<int> Terminal::ExecuteFile(fat::DirectoryEntry& file_entry,
     &task.OSStackPointer()
   );
 
+  // 残っているスレッドを終わらせ, 使い終えるまでアドレス空間を解放しない
+  KillAllThreads(task, ret);
+
+  // 領域を取り除くと共有メモリやウィンドウのページが解放されることがあるので, 先にマップを外す
+  __asm__("cli");
+  auto err_clean = CleanPageMaps(LinearAddress4Level{ kUserSpaceBegin },
+                                 kUserSpaceBytes / 4096);
+  __asm__("sti");
   task.Files().clear();
-  task.FileMaps().clear();
+  task.Ring().reset();
+  task.VMAs().Clear();
+  ReleaseApp(file_entry);
 
-  if (auto err = CleanPageMaps(LinearAddress4Level{ 0xffff'8000'0000'0000 })) {
-    return { ret, err };
+  if (err_clean) {
+    return { ret, err_clean };
   }
 
   return { ret, FreePML4(task) };
@@ -940,6 +1206,8 @@ void TaskTerminal(uint64_t task_id, int64_t data) {
 
   if (term_desc && term_desc->exit_after_command) {
     delete term_desc;
+    // パイプの読み込み側を閉じ, 書き込み側が空きを待ち続けないようにする
+    terminal->CloseFiles();
     __asm__("cli");
     task_manager->Finish(terminal->LastExitCode());
     __asm__("sti");
@@ -992,12 +1260,14 @@ void TaskTerminal(uint64_t task_id, int64_t data) {
             msg->arg.keyboard.ascii
           );
           if (show_window) {
+            const auto origin_tsc = msg->origin_tsc;
             Message msg = MakeLayerMessage(
               task_id,
               terminal->LayerID(),
               LayerOperation::DrawArea,
               area
             );
+            msg.origin_tsc = origin_tsc;
             __asm__("cli");
             task_manager->SendMessage(1, msg);
             __asm__("sti");
@@ -1028,6 +1298,10 @@ size_t TerminalFileDescriptor::Read(void* buf,
   while (true) {
     __asm__("cli");
     auto msg = term_.UnderlyingTask().ReceiveMessage();
+    if (!msg && task_manager->CurrentTask().Group().killed) {
+      __asm__("sti");
+      return 0;
+    }
     if (!msg) {
       term_.UnderlyingTask().Sleep();
       continue;
@@ -1067,75 +1341,3 @@ size_t TerminalFileDescriptor::Load(void* buf,
                                     size_t offset) {
   return 0;
 }
-
-PipeDescriptor::PipeDescriptor(Task& task) : task_{task} {
-}
-
-size_t PipeDescriptor::Read(void* buf, size_t len) {
-  if (len_ > 0) {
-    const size_t copy_bytes = std::min(len_, len);
-    memcpy(buf, data_, copy_bytes);
-    len_ -= copy_bytes;
-    memmove(data_, &data_[copy_bytes], len_);
-    return copy_bytes;
-  }
-
-  if (closed_) {
-    return 0;
-  }
-
-  while (true) {
-    __asm__("cli");
-    auto msg = task_.ReceiveMessage();
-    if (!msg) {
-      task_.Sleep();
-      continue;
-    }
-    __asm__("sti");
-
-    if (msg->type != Message::kPipe) {
-      continue;
-    }
-
-    if (msg->arg.pipe.len == 0) {
-      closed_ = true;
-      return 0;
-    }
-
-    const size_t copy_bytes = std::min<size_t>(msg->arg.pipe.len, len);
-    memcpy(buf, msg->arg.pipe.data, copy_bytes);
-    len_ = msg->arg.pipe.len - copy_bytes;
-    memcpy(data_, &msg->arg.pipe.data[copy_bytes], len_);
-    return copy_bytes;
-  }
-}
-
-size_t PipeDescriptor::Write(const void* buf,
-                             size_t len) {
-  auto bufc = reinterpret_cast<const char*>(buf);
-  Message msg { Message::kPipe };
-  size_t sent_bytes = 0;
-
-  while (sent_bytes < len) {
-    msg.arg.pipe.len = std::min(len - sent_bytes, sizeof(msg.arg.pipe.data));
-    memcpy(
-      msg.arg.pipe.data,
-       &bufc[sent_bytes],
-       msg.arg.pipe.len
-    );
-    sent_bytes += msg.arg.pipe.len;
-    __asm__("cli");
-    task_.SendMessage(msg);
-    __asm__("sti");
-  }
-
-  return len;
-}
-
-void PipeDescriptor::FinishWrite() {
-  Message msg { Message::kPipe };
-  msg.arg.pipe.len = 0;
-  __asm__("cli");
-  task_.SendMessage(msg);
-  __asm__("sti");
-}
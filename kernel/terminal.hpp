@@ -11,18 +11,34 @@
 #include <map>
 #include <memory>
 #include <optional>
+#include <vector>
 #include "fat.hpp"
 #include "layer.hpp"
+#include "pipe.hpp"
 #include "task.hpp"
 #include "window.hpp"
 
 struct AppLoadInfo {
   uint64_t vaddr_end, entry;
   PageMapEntry* pml4;
+  /** @brief このイメージを実行中のタスク数. 0でなければ回収しない. */
+  int num_users{0};
+  /** @brief 最後に実行を終えた時刻（タイマ割り込みの回数）. */
+  unsigned long last_used{0};
 };
 
 extern std::map<fat::DirectoryEntry*, AppLoadInfo>* app_loads;
 
+/**
+ * @brief 実行中のタスクが使っていないアプリイメージを古い順に破棄する.
+ *
+ * 割り込み禁止状態で呼ぶこと.
+ *
+ * @param num_frames 回収したいフレーム数
+ * @return 回収したフレーム数
+ */
+size_t EvictAppImages(size_t num_frames);
+
 struct TerminalDescriptor {
   std::string command_line;
   bool exit_after_command;
@@ -58,6 +74,13 @@ class Terminal {
       return last_exit_code_;
     }
 
+    /** @brief 標準入出力を手放す. パイプなら相手側に閉じたことが伝わる. */
+    void CloseFiles() {
+      for (auto& f : files_) {
+        f.reset();
+      }
+    }
+
     void Redraw();
 
   private:
@@ -79,6 +102,19 @@ class Terminal {
 
     void ExecuteLine();
 
+    /**
+     * @brief パイプの2段目以降をそれぞれ別のタスクで起動する.
+     *
+     * 段同士はパイプでつなぎ, 最後の段の標準出力は現在の標準出力とする.
+     * 1段目はこのターミナル自身が実行する.
+     *
+     * @param stages 最初の '|' より後ろのコマンドライン
+     * @param stage_ids 起動したタスクのIDを段の順に追加する
+     * @return 1段目の標準出力にするパイプの書き込み側
+     */
+    std::shared_ptr<PipeDescriptor> StartPipeline(char* stages,
+                                                  std::vector<uint64_t>& stage_ids);
+
     WithError<int> ExecuteFile(fat::DirectoryEntry& file_entry,
                                char* command,
                                char* first_arg);
@@ -92,6 +128,7 @@ class Terminal {
     bool show_window_;
     std::array<std::shared_ptr<FileDescriptor>, 3> files_;
     int last_exit_code_{0};
+    std::vector<int> pipe_status_{}; // 直前のコマンドの各段の終了コード. パイプでなければ1つ
 };
 
 void TaskTerminal(uint64_t task_id, int64_t data);
@@ -113,28 +150,3 @@ class TerminalFileDescriptor : public FileDescriptor {
   private:
     Terminal& term_;
 };
-
-class PipeDescriptor : public FileDescriptor {
-  public:
-    explicit PipeDescriptor(Task& task);
-    size_t Read(void* buf, size_t len) override;
-    size_t Write(const void* buf, size_t len) override;
-
-    size_t Size() const override {
-      return 0;
-    }
-
-    size_t Load(void* buf, 
-                size_t len,
-                size_t offset) override {
-      return 0;
-    }
-
-    void FinishWrite();
-
-  private:
-    Task& task_;
-    char data_[16];
-    size_t len_{0};
-    bool closed_{false};
-};
@@ -0,0 +1,128 @@
+#include "thread.hpp"
+
+#include <algorithm>
+#include "asmfunc.h"
+#include "cpu_local.hpp"
+#include "paging.hpp"
+
+namespace {
+  struct ThreadStart {
+    uint64_t entry;
+    uint64_t arg;
+    uint64_t stack_begin;
+    size_t stack_bytes;
+  };
+
+  /** @brief スレッドのタスク. アプリのentryを呼び, 終わったらスタックを解放して終了する. */
+  void TaskThread(uint64_t task_id, int64_t data) {
+    const auto start = *reinterpret_cast<ThreadStart*>(data);
+    delete reinterpret_cast<ThreadStart*>(data);
+    auto& task = CurrentTask();
+
+    const int ret = CallApp(
+      0,
+      reinterpret_cast<char**>(start.arg),
+      3 << 3 | 3,
+      start.entry,
+      start.stack_begin + start.stack_bytes - 8,
+      &task.OSStackPointer()
+    );
+
+    __asm__("cli");
+    task.VMAs().Remove(start.stack_begin, start.stack_bytes);
+    CleanPageMaps(LinearAddress4Level{start.stack_begin},
+                  start.stack_bytes / 4096);
+    task_manager->Finish(ret);
+  }
+} // namespace
+
+WithError<uint64_t> CreateThread(Task& parent,
+                                 uint64_t entry,
+                                 uint64_t arg,
+                                 size_t stack_bytes) {
+  if (stack_bytes == 0) {
+    stack_bytes = kDefaultThreadStackBytes;
+  }
+  if (stack_bytes > kMaxThreadStackBytes) {
+    return { 0, MAKE_ERROR(Error::kIndexOutOfRange) };
+  }
+  stack_bytes = (stack_bytes + 4095) & 0xffff'ffff'ffff'f000;
+
+  // 下端の1ページはどの領域にも含めず, スタックのあふれをページフォルトにする
+  VirtualMemoryArea vma{ VirtualMemoryArea::kStack };
+  vma.size = stack_bytes + 4096;
+  vma.writable = true;
+
+  __asm__("cli");
+  auto [ area_begin, err ] = parent.VMAs().FindFreeArea(vma.size);
+  if (!err) {
+    vma.begin = area_begin + 4096;
+    vma.size = stack_bytes;
+    err = parent.VMAs().Insert(vma);
+  }
+  __asm__("sti");
+
+  if (err) {
+    return { 0, err };
+  }
+
+  auto start = new ThreadStart{ entry, arg, vma.begin, stack_bytes };
+
+  // InitContextは現在のCR3, つまり親のアドレス空間を引き継ぐ
+  __asm__("cli");
+  Task& thread = task_manager->NewTask()
+    .InitContext(TaskThread, reinterpret_cast<int64_t>(start))
+    .JoinGroup(parent);
+  const uint64_t thread_id = thread.ID();
+  parent.Group().thread_ids.push_back(thread_id);
+  task_manager->Wakeup(&thread, parent.Level());
+  __asm__("sti");
+
+  return { thread_id, MAKE_ERROR(Error::kSuccess) };
+}
+
+WithError<int> JoinThread(Task& task, uint64_t thread_id) {
+  __asm__("cli");
+  auto& ids = task.Group().thread_ids;
+  auto it = std::find(ids.begin(), ids.end(), thread_id);
+
+  if (it == ids.end()) {
+    __asm__("sti");
+    return { 0, MAKE_ERROR(Error::kNoSuchTask) };
+  }
+
+  ids.erase(it);
+  auto res = task_manager->WaitFinish(thread_id);
+  __asm__("sti");
+
+  return res;
+}
+
+void KillThreadGroup(Task& task, int exit_code) {
+  __asm__("cli");
+  auto& group = task.Group();
+  if (!group.killed) {
+    group.killed = true;
+    group.exit_code = exit_code;
+    task_manager->WakeupGroup(group);
+  }
+  __asm__("sti");
+}
+
+void KillAllThreads(Task& task, int exit_code) {
+  KillThreadGroup(task, exit_code);
+
+  while (true) {
+    __asm__("cli");
+    auto& ids = task.Group().thread_ids;
+    if (ids.empty()) {
+      task.Group().killed = false;
+      __asm__("sti");
+      return;
+    }
+    const uint64_t thread_id = ids.back();
+    __asm__("sti");
+
+    JoinThread(task, thread_id);
+  }
+}
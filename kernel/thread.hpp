@@ -0,0 +1,55 @@
+/**
+ * @file thread.hpp
+ *
+ * アプリのスレッド. 同じアドレス空間（CR3）, ファイル, 仮想メモリ領域を共有するタスク.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "error.hpp"
+#include "task.hpp"
+
+/** @brief スレッドのユーザースタックの既定の大きさ. */
+const size_t kDefaultThreadStackBytes = 64 * 1024;
+/** @brief スレッドのユーザースタックの最大の大きさ. */
+const size_t kMaxThreadStackBytes = 16 * 1024 * 1024;
+
+/**
+ * @brief 実行中のアプリに新しいスレッドを作り, 実行可能にする.
+ *
+ * スレッドはparentと同じレベルのタスクとして動き, ユーザースタックは
+ * 下端にガードページを空けた新しい領域に取る. スタックのページはフォルト時に割り当てる.
+ * entryは第1引数を0, 第2引数をargとしてアプリのモードで呼ばれる.
+ * entryから戻ってはならず, ThreadExitで終わる. どのスレッドからのExitもアプリ全体を終わらせる.
+ *
+ * @return スレッドのタスクID
+ */
+WithError<uint64_t> CreateThread(Task& parent,
+                                 uint64_t entry,
+                                 uint64_t arg,
+                                 size_t stack_bytes);
+
+/**
+ * @brief taskと同じアプリのスレッドthread_idの終了を待ち, 終了コードを返す.
+ *
+ * 同じアプリのスレッドでないか, 既にJoinThreadされていればkNoSuchTask.
+ */
+WithError<int> JoinThread(Task& task, uint64_t thread_id);
+
+/**
+ * @brief taskのアプリの全スレッドをexit_codeで終了させる.
+ *
+ * 各スレッドを起こし, アプリへ戻る前や待ちから起きたところで終わらせる.
+ * 既に終了させられていれば, 最初のexit_codeのまま何もしない.
+ */
+void KillThreadGroup(Task& task, int exit_code);
+
+/**
+ * @brief アプリの終了時に, 残っているスレッドを全て終了させ, その終了を待つ.
+ *
+ * アプリのアドレス空間を解放する前に, アプリから戻ったtask自身が呼ぶこと.
+ * 戻ったときにはスレッドグループは次のアプリを実行できる状態になっている.
+ */
+void KillAllThreads(Task& task, int exit_code);
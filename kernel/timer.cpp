@@ -1,4 +1,5 @@
 #include "acpi.hpp"
+#include "asmfunc.h"
 #include "interrupt.hpp"
 #include "task.hpp"
 #include "timer.hpp"
@@ -108,6 +109,13 @@ extern "C" void LAPICTimerOnInterrupt(const TaskContext& ctx_stack) {
   const bool task_timer_timeout = timer_manager->Tick();
   NotifyEndOfInterrupt();
 
+  auto& task = task_manager->CurrentTask();
+  if ((ctx_stack.cs & 0x3) == 3 && task.Group().killed) {
+    // システムコールを呼ばずに動き続けるスレッドも, ここでアプリへ戻さずに終わらせる
+    __asm__("sti");
+    ExitApp(task.OSStackPointer(), task.Group().exit_code);
+  }
+
   if (task_timer_timeout) {
     task_manager->SwitchTask(ctx_stack);
   }
@@ -0,0 +1,83 @@
+#include "uaccess.hpp"
+
+#include <algorithm>
+#include "asmfunc.h"
+#include "paging.hpp"
+
+namespace {
+  struct UserAccessFixup {
+    uint64_t fault_rip, fixup_rip;
+  };
+
+  bool IsUserRange(uint64_t addr, size_t n) {
+    // 0 - addr はアドレス空間の末尾までのバイト数
+    return addr >= kUserSpaceBegin && n <= 0 - addr;
+  }
+}
+
+// asmfunc.asm から参照される
+extern "C" uint8_t user_copy_erms = 0;
+extern "C" const UserAccessFixup user_access_fixups[];
+
+Error CopyFromUser(void* dst, const void* user_src, size_t n) {
+  if (!IsUserRange(reinterpret_cast<uint64_t>(user_src), n)
+      || CopyUserBytes(dst, user_src, n) != 0) {
+    return MAKE_ERROR(Error::kInvalidAddress);
+  }
+
+  return MAKE_ERROR(Error::kSuccess);
+}
+
+Error CopyToUser(void* user_dst, const void* src, size_t n) {
+  if (!IsUserRange(reinterpret_cast<uint64_t>(user_dst), n)
+      || CopyUserBytes(user_dst, src, n) != 0) {
+    return MAKE_ERROR(Error::kInvalidAddress);
+  }
+
+  return MAKE_ERROR(Error::kSuccess);
+}
+
+WithError<size_t> StrncpyFromUser(char* dst, const char* user_src, size_t n) {
+  const auto src_addr = reinterpret_cast<uint64_t>(user_src);
+
+  if (n == 0 || src_addr < kUserSpaceBegin) {
+    return { 0, MAKE_ERROR(Error::kInvalidAddress) };
+  }
+
+  const size_t max_len = std::min<uint64_t>(n, 0 - src_addr);
+  const int64_t len = StrncpyUserBytes(dst, user_src, max_len);
+
+  if (len < 0) {
+    return { 0, MAKE_ERROR(Error::kInvalidAddress) };
+  } else if (dst[len - 1] != '\0') {
+    dst[len - 1] = '\0';
+    // dstが足りないのか, 文字列がアドレス空間の末尾で途切れたのか
+    return {
+      static_cast<size_t>(len - 1),
+      len == n ? MAKE_ERROR(Error::kBufferTooSmall)
+               : MAKE_ERROR(Error::kInvalidAddress)
+    };
+  }
+
+  return { static_cast<size_t>(len - 1), MAKE_ERROR(Error::kSuccess) };
+}
+
+uint64_t SearchUserAccessFixup(uint64_t rip) {
+  for (auto f = user_access_fixups; f->fault_rip != 0; f++) {
+    if (f->fault_rip == rip) {
+      return f->fixup_rip;
+    }
+  }
+
+  return 0;
+}
+
+void InitializeUserAccess() {
+  uint32_t regs[4];
+  GetCPUID(0, 0, regs);
+
+  if (regs[0] >= 7) {
+    GetCPUID(7, 0, regs);
+    user_copy_erms = (regs[1] >> 9) & 1; // EBX bit 9: Enhanced REP MOVSB/STOSB
+  }
+}
@@ -0,0 +1,38 @@
+/**
+ * @file uaccess.hpp
+ *
+ * カーネルからアプリのメモリを安全に読み書きする関数群.
+ *
+ * アプリから渡されたポインタは必ずこれらの関数を介して参照する.
+ * 不正なアドレスを渡されてもカーネルは停止せず, kInvalidAddressを返す.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "error.hpp"
+
+/** @brief アプリのメモリuser_srcからnバイトをdstへコピーする. */
+Error CopyFromUser(void* dst, const void* user_src, size_t n);
+
+/** @brief srcからnバイトをアプリのメモリuser_dstへコピーする. */
+Error CopyToUser(void* user_dst, const void* src, size_t n);
+
+/**
+ * @brief アプリのメモリにあるNUL終端文字列をdstへコピーする.
+ *
+ * @param n dstの大きさ（NULを含む）
+ * @return 文字列の長さ（NULを含まない）. n - 1文字に収まらなければkBufferTooSmall
+ */
+WithError<size_t> StrncpyFromUser(char* dst, const char* user_src, size_t n);
+
+/**
+ * @brief アプリのメモリへのアクセス中にフォルトした命令の, 復帰先を探す.
+ *
+ * @param rip フォルトした命令のアドレス
+ * @return 復帰先のアドレス. アプリのメモリへのアクセスでなければ0
+ */
+uint64_t SearchUserAccessFixup(uint64_t rip);
+
+void InitializeUserAccess();
@@ -0,0 +1,198 @@
+#include <algorithm>
+#include "paging.hpp"
+#include "vma.hpp"
+
+Error VMATree::Insert(const VirtualMemoryArea& area) {
+  if (area.size == 0 || Overlaps(area.begin, area.size)) {
+    return MAKE_ERROR(Error::kAlreadyAllocated);
+  }
+
+  areas_.insert(std::make_pair(area.begin, area));
+  return MAKE_ERROR(Error::kSuccess);
+}
+
+VirtualMemoryArea* VMATree::Find(uint64_t addr) {
+  auto it = areas_.upper_bound(addr);
+
+  if (it == areas_.begin()) {
+    return nullptr;
+  }
+
+  --it;
+
+  if (!it->second.Contains(addr)) {
+    return nullptr;
+  }
+
+  return &it->second;
+}
+
+void VMATree::Remove(uint64_t begin, uint64_t size) {
+  if (size == 0) {
+    return;
+  }
+
+  SplitAt(begin);
+  SplitAt(begin + size);
+
+  auto it = areas_.lower_bound(begin);
+
+  while (it != areas_.end() && it->first - begin < size) {
+    it = areas_.erase(it);
+  }
+
+  if (heap_begin_ <= begin && begin < heap_end_
+      && heap_end_ - begin <= size) {
+    heap_end_ = begin;
+  }
+}
+
+Error VMATree::Protect(uint64_t begin, uint64_t size, bool writable) {
+  if (!Covers(begin, size)) {
+    return MAKE_ERROR(Error::kNoSuchEntry);
+  }
+
+  SplitAt(begin);
+  SplitAt(begin + size);
+
+  for (auto it = areas_.lower_bound(begin);
+       it != areas_.end() && it->first - begin < size;
+       ++it) {
+    it->second.writable = writable;
+  }
+
+  return MAKE_ERROR(Error::kSuccess);
+}
+
+WithError<uint64_t> VMATree::FindFreeArea(uint64_t size) const {
+  if (size == 0) {
+    return { 0, MAKE_ERROR(Error::kIndexOutOfRange) };
+  }
+
+  // 空き範囲の末尾（範囲に含む）. アドレス空間の末尾から下へ向かって探す
+  uint64_t free_last = 0xffff'ffff'ffff'ffff;
+
+  for (auto it = areas_.rbegin(); it != areas_.rend(); ++it) {
+    const auto& area = it->second;
+
+    if (area.Last() < free_last && free_last - area.Last() >= size) {
+      return { free_last - size + 1, MAKE_ERROR(Error::kSuccess) };
+    }
+
+    if (area.begin <= kUserSpaceBegin) {
+      return { 0, MAKE_ERROR(Error::kNoEnoughMemory) };
+    }
+
+    free_last = std::min(free_last, area.begin - 1);
+  }
+
+  if (free_last - kUserSpaceBegin + 1 >= size) {
+    return { free_last - size + 1, MAKE_ERROR(Error::kSuccess) };
+  }
+
+  return { 0, MAKE_ERROR(Error::kNoEnoughMemory) };
+}
+
+WithError<uint64_t> VMATree::InsertAnywhere(VirtualMemoryArea area) {
+  auto [ begin, err ] = FindFreeArea(area.size);
+
+  if (err) {
+    return { 0, err };
+  }
+
+  area.begin = begin;
+  return { begin, Insert(area) };
+}
+
+void VMATree::SetHeapBase(uint64_t addr) {
+  heap_begin_ = addr;
+  heap_end_ = addr;
+}
+
+WithError<uint64_t> VMATree::ExtendHeap(uint64_t bytes) {
+  const uint64_t prev_end = heap_end_;
+
+  if (bytes == 0) {
+    return { prev_end, MAKE_ERROR(Error::kSuccess) };
+  }
+
+  if (prev_end + bytes < prev_end || Overlaps(prev_end, bytes)) {
+    return { prev_end, MAKE_ERROR(Error::kNoEnoughMemory) };
+  }
+
+  auto top = prev_end > heap_begin_ ? Find(prev_end - 1) : nullptr;
+
+  if (top && top->type == VirtualMemoryArea::kHeap) {
+    top->size += bytes;
+  } else {
+    areas_.insert(std::make_pair(prev_end, VirtualMemoryArea{
+      VirtualMemoryArea::kHeap,
+      prev_end,
+      bytes,
+      true,
+    }));
+  }
+
+  heap_end_ = prev_end + bytes;
+  return { prev_end, MAKE_ERROR(Error::kSuccess) };
+}
+
+void VMATree::Clear() {
+  areas_.clear();
+  heap_begin_ = heap_end_ = 0;
+}
+
+bool VMATree::Overlaps(uint64_t begin, uint64_t size) const {
+  auto it = areas_.upper_bound(begin);
+
+  if (it != areas_.end() && it->first - begin < size) {
+    return true;
+  }
+
+  if (it == areas_.begin()) {
+    return false;
+  }
+
+  --it;
+  return it->second.Contains(begin);
+}
+
+bool VMATree::Covers(uint64_t begin, uint64_t size) {
+  uint64_t addr = begin;
+  uint64_t remain = size;
+
+  while (remain > 0) {
+    auto area = Find(addr);
+
+    if (area == nullptr) {
+      return false;
+    }
+
+    const uint64_t covered = area->Last() - addr + 1;
+
+    if (covered == 0 || covered >= remain) {
+      // covered == 0 はアドレス空間の末尾まで覆われていることを表す
+      return true;
+    }
+
+    addr += covered;
+    remain -= covered;
+  }
+
+  return true;
+}
+
+void VMATree::SplitAt(uint64_t addr) {
+  auto area = Find(addr);
+
+  if (area == nullptr || area->begin == addr) {
+    return;
+  }
+
+  VirtualMemoryArea upper = *area;
+  upper.begin = addr;
+  upper.size = area->size - (addr - area->begin);
+  upper.file_offset += addr - area->begin;
+  area->size = addr - area->begin;
+  areas_.insert(std::make_pair(addr, upper));
+}
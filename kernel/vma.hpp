@@ -0,0 +1,132 @@
+/**
+ * @file vma.hpp
+ *
+ * アプリケーションの仮想メモリ領域 (VMA: Virtual Memory Area) 関連.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include "error.hpp"
+#include "file.hpp"
+
+class SharedMemory;
+class Window;
+
+/**
+ * @brief アプリケーションのアドレス空間内の連続した1つの領域.
+ *
+ * 先頭アドレスと大きさはいずれも4KiBの倍数.
+ * アドレス空間の末尾に接する領域も表せるように, 終端ではなく大きさを保持する.
+ */
+struct VirtualMemoryArea {
+  enum Type {
+    kImage,        // ELFのロード領域
+    kHeap,         // DemandPagesで伸長されるヒープ
+    kStack,        // スタックとコマンドライン引数
+    kFileMap,      // MapFileでマップされたファイル
+    kAnonymous,    // MapFileでマップされた無名メモリ
+    kWindowBuffer, // MapWindowBufferでマップされたウィンドウの影バッファ
+    kSharedMemory, // ShmMapでマップされた共有メモリ
+  } type;
+
+  uint64_t begin;
+  uint64_t size;
+  bool writable;
+
+  /** @brief kFileMapの場合のマップ元ファイル. */
+  std::shared_ptr<FileDescriptor> file{};
+  /** @brief kWindowBufferの場合のマップ元ウィンドウ. マップ中は解放されない. */
+  std::shared_ptr<Window> window{};
+  /** @brief kSharedMemoryの場合のマップ元共有メモリ. マップ中は解放されない. */
+  std::shared_ptr<SharedMemory> shm{};
+  /** @brief beginに対応するファイル内（kWindowBufferなら影バッファ内）オフセット. */
+  uint64_t file_offset{0};
+
+  /** @brief MapFileのflagsで指定されたアクセスパターンのヒント. */
+  enum Advice {
+    kNormal,
+    kSequential,
+    kRandom,
+  } advice{kNormal};
+
+  /** @brief 順次アクセスなら次にフォルトすると予想されるページ（beginからのページ数）. */
+  uint64_t next_fault_page{0};
+  /** @brief 現在の先読みページ数. 順次アクセスが続くと倍々に増える. */
+  size_t read_ahead_pages{0};
+
+  bool Contains(uint64_t addr) const {
+    return addr - begin < size;
+  }
+
+  /** @brief 領域の最後のバイトのアドレス. */
+  uint64_t Last() const {
+    return begin + (size - 1);
+  }
+};
+
+/**
+ * @brief タスクの仮想メモリ領域の集合.
+ *
+ * 先頭アドレスをキーとする平衡二分木で保持し, ページフォルト時の検索をO(log n)で行う.
+ * 領域同士は重ならない.
+ *
+ * 同じアプリのスレッドが共有し, ページフォルトの処理からも参照するので, 割り込み禁止で操作する.
+ */
+class VMATree {
+  public:
+    /** @brief 領域を追加する. 既存の領域と重なる場合はkAlreadyAllocated. */
+    Error Insert(const VirtualMemoryArea& area);
+
+    /** @brief 指定されたアドレスを含む領域を返す. 無ければnullptr. */
+    VirtualMemoryArea* Find(uint64_t addr);
+
+    /**
+     * @brief [begin, begin + size) を領域から取り除く.
+     *
+     * 範囲と部分的に重なる領域は分割され, 範囲外の部分は残る.
+     */
+    void Remove(uint64_t begin, uint64_t size);
+
+    /**
+     * @brief [begin, begin + size) の書き込み可否を変更する.
+     *
+     * 範囲の全体が領域で覆われていなければkNoSuchEntryを返し, 何も変更しない.
+     */
+    Error Protect(uint64_t begin, uint64_t size, bool writable);
+
+    /** @brief アドレス空間の上位から, 指定された大きさの空き範囲を探す. */
+    WithError<uint64_t> FindFreeArea(uint64_t size) const;
+
+    /**
+     * @brief area.beginを無視し, FindFreeAreaで見つけた空き範囲へ領域を追加する.
+     *
+     * @return 追加した領域の先頭アドレス
+     */
+    WithError<uint64_t> InsertAnywhere(VirtualMemoryArea area);
+
+    /** @brief ヒープの開始位置を設定する. ヒープは空の状態になる. */
+    void SetHeapBase(uint64_t addr);
+
+    /**
+     * @brief ヒープを指定バイト伸長する.
+     *
+     * @return 伸長前のヒープ終端. 伸長先が他の領域と重なる場合はkNoEnoughMemory
+     */
+    WithError<uint64_t> ExtendHeap(uint64_t bytes);
+
+    /** @brief 全ての領域を取り除く. */
+    void Clear();
+
+  private:
+    std::map<uint64_t, VirtualMemoryArea> areas_{};
+    uint64_t heap_begin_{0}, heap_end_{0};
+
+    bool Overlaps(uint64_t begin, uint64_t size) const;
+    bool Covers(uint64_t begin, uint64_t size);
+
+    /** @brief addrが領域の内部にあれば, その領域をaddrの位置で2つに分割する. */
+    void SplitAt(uint64_t addr);
+};
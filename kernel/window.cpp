@@ -1,5 +1,6 @@
 #include "font.hpp"
 #include "logger.hpp"
+#include "memory_manager.hpp"
 #include "window.hpp"
 
 namespace {
@@ -93,6 +94,13 @@ Window::Window(int width, int height, PixelFormat shadow_format)
   }
 }
 
+Window::~Window() {
+  if (pinned_buffer_) {
+    const FrameID frame{ reinterpret_cast<uintptr_t>(pinned_buffer_) / kBytesPerFrame };
+    memory_manager->Free(frame, pinned_frames_);
+  }
+}
+
 void Window::DrawTo(FrameBuffer& dst,
                 Vector2D<int> pos,
                 const Rectangle<int>& area) {
@@ -141,6 +149,17 @@ void Window::Write(Vector2D<int> pos, PixelColor c) {
   data_[pos.y][pos.x] = c;
   shadow_buffer_.Writer().Write(pos, c);
 }
+
+void Window::WriteRow(Vector2D<int> pos, const uint32_t* colors, int n) {
+  auto row = &data_[pos.y][pos.x];
+
+  for (int i = 0; i < n; i++) {
+    row[i] = ToColor(colors[i]);
+  }
+
+  shadow_buffer_.WriteRow(pos, colors, n);
+}
+
 int Window::Width() const {
   return width_;
 }
@@ -161,6 +180,39 @@ WindowRegion Window::GetWindowRegion(Vector2D<int> pos) {
   return WindowRegion::kOther;
 }
 
+Error Window::PinShadowBuffer() {
+  if (pinned_buffer_) {
+    return MAKE_ERROR(Error::kSuccess);
+  } else if (transparent_color_) {
+    return MAKE_ERROR(Error::kNotImplemented);
+  }
+
+  auto config = shadow_buffer_.Config();
+  const size_t bytes = 4 * config.pixels_per_scan_line * config.vertical_resolution;
+  const size_t num_frames = (bytes + kBytesPerFrame - 1) / kBytesPerFrame;
+  auto frame = memory_manager->Allocate(num_frames);
+
+  if (frame.error) {
+    return frame.error;
+  }
+
+  // フレームの残りにはカーネルのデータが無いので, そのままアプリへ見せてよい
+  auto buffer = reinterpret_cast<uint8_t*>(frame.value.Frame());
+  memset(buffer, 0, num_frames * kBytesPerFrame);
+  memcpy(buffer, config.frame_buffer, bytes);
+
+  config.frame_buffer = buffer;
+
+  if (auto err = shadow_buffer_.Initialize(config)) {
+    memory_manager->Free(frame.value, num_frames);
+    return err;
+  }
+
+  pinned_buffer_ = buffer;
+  pinned_frames_ = num_frames;
+  return MAKE_ERROR(Error::kSuccess);
+}
+
 ToplevelWindow::ToplevelWindow(int width,
                                int height,
                                PixelFormat shadow_format,
@@ -64,7 +64,7 @@ class Window {
      */
     Window(int width, int height, PixelFormat shadow_format);
 
-    virtual ~Window() = default;
+    virtual ~Window();
 
     Window(const Window& rhs) = delete;
 
@@ -111,6 +111,13 @@ class Window {
      */
     int Height() const;
 
+    /**
+     * @brief 0xRRGGBB形式のn個の色を, posから右へ向かって書き込む.
+     *
+     * 1ピクセルずつWriteするより速い. 範囲はウィンドウ内に収まっていること.
+     */
+    void WriteRow(Vector2D<int> pos, const uint32_t* colors, int n);
+
     /**
      * @brief 平面描画領域のサイズをピクセル単位で返す.
      */
@@ -125,6 +132,28 @@ class Window {
      */
     void Move(Vector2D<int> dst_pos, const Rectangle<int>& src);
 
+    /**
+     * @brief アプリのアドレス空間へマップできるよう, 影バッファを専用の物理フレームへ移す.
+     *
+     * 移した後は影バッファの内容をアプリが直接書き換えるため, At()の返す値とは一致しなくなる.
+     * 透過色を持つウィンドウには使えない. 2回目以降の呼び出しは何もしない.
+     */
+    Error PinShadowBuffer();
+
+    /** @brief PinShadowBufferで移した影バッファの先頭. 移していなければnullptr. */
+    uint8_t* PinnedBuffer() const {
+      return pinned_buffer_;
+    }
+
+    /** @brief PinnedBufferのバイト数（4KiBの倍数）. */
+    size_t PinnedBufferBytes() const {
+      return pinned_frames_ * 4096;
+    }
+
+    const FrameBufferConfig& ShadowBufferConfig() const {
+      return shadow_buffer_.Config();
+    }
+
     virtual void Activate() {}
 
     virtual void Deactivate() {}
@@ -138,6 +167,8 @@ class Window {
     WindowWriter writer_{*this};
     std::optional<PixelColor> transparent_color_{std::nullopt};
     FrameBuffer shadow_buffer_{};
+    uint8_t* pinned_buffer_{nullptr};
+    size_t pinned_frames_{0};
 };
 
 class ToplevelWindow : public Window {
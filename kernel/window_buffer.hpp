@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief MapWindowBufferでアプリへマップしたウィンドウの画素の配置.
+ *
+ * 画素 (x, y) は pixels + 4 * (pixels_per_scan_line * y + x) にあり,
+ * 座標はウィンドウの左上（タイトルバーを含む）を原点とする.
+ */
+struct WindowBufferInfo {
+  uint8_t* pixels;
+  int width, height;
+  int pixels_per_scan_line;
+
+  enum WindowBufferPixelLayout {
+    kRGBResv8BitPerColor, // メモリ上でR, G, B, 予約の順
+    kBGRResv8BitPerColor, // メモリ上でB, G, R, 予約の順
+  } pixel_layout;
+};
+
+/**
+ * @brief WinBlitでウィンドウへ転送する画像.
+ *
+ * 画素 (x, y) は pixels + bytes_per_line * y + format * x にある.
+ */
+struct BlitImage {
+  const uint8_t* pixels;
+  int width, height;
+  int bytes_per_line;
+
+  enum BlitImageFormat { // 値は1画素のバイト数
+    kGray = 1,
+    kGrayAlpha = 2, // アルファは無視する
+    kRGB = 3,
+    kRGBA = 4,      // アルファは無視する
+  } format;
+};
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,165 @@
+#!/usr/bin/python3
+
+import argparse
+import re
+import sys
+
+
+VERSION_PATTERN = re.compile(r'version\s+(\d+)$')
+SYSCALL_PATTERN = re.compile(r'(0x[0-9a-fA-F]+|\d+)\s+(\w+)\s+(void\s+)?\((.*)\)$')
+NUMBER_BASE = 0x80000000
+
+
+class Syscall:
+    def __init__(self, number: int, name: str, returns_void: bool,
+                 params: list, doc: list):
+        self.number = number
+        self.name = name
+        self.returns_void = returns_void
+        self.params = params
+        self.doc = doc
+
+
+def split_params(params: str) -> list:
+    """関数ポインタの引数リストの中では区切らない"""
+    result = ['']
+    depth = 0
+    for c in params:
+        if c == ',' and depth == 0:
+            result.append('')
+            continue
+        depth += {'(': 1, ')': -1}.get(c, 0)
+        result[-1] += c
+    return result
+
+
+def parse(src: str):
+    version = None
+    syscalls = []
+    doc = []
+
+    for lineno, line in enumerate(src.splitlines(), 1):
+        line = line.strip()
+        if line.startswith('##'):
+            doc.append(line[2:].strip())
+            continue
+        if not line or line.startswith('#'):
+            doc = []
+            continue
+
+        m = VERSION_PATTERN.match(line)
+        if m:
+            version = int(m.group(1))
+            continue
+
+        m = SYSCALL_PATTERN.match(line)
+        if not m:
+            sys.exit(f'{lineno}: syntax error: {line}')
+
+        params = [p.strip() for p in split_params(m.group(4)) if p.strip()]
+        if len(params) > 6:
+            sys.exit(f'{lineno}: {m.group(2)} has more than 6 parameters')
+
+        syscalls.append(Syscall(int(m.group(1), 0), m.group(2),
+                                m.group(3) is not None, params, doc))
+        doc = []
+
+    if version is None:
+        sys.exit('version is not defined')
+
+    numbers = [s.number for s in syscalls]
+    names = [s.name for s in syscalls]
+    if len(set(numbers)) != len(numbers) or len(set(names)) != len(names):
+        sys.exit('duplicated syscall number or name')
+    if numbers != sorted(numbers):
+        sys.exit('syscalls must be sorted by number')
+
+    return version, syscalls
+
+
+def generate_table(version: int, syscalls: list) -> str:
+    lines = [
+        '#pragma once',
+        '',
+        '// tools/makesyscall.py が syscalls.txt から生成する. 直接編集しないこと',
+        '',
+        f'static const int kSyscallABIVersion = {version};',
+        f'static const int kNumSyscalls = {syscalls[-1].number + 1};',
+        '',
+        '#define SYSCALL_LIST(X) \\',
+    ]
+    lines += [f'  X(0x{s.number:02x}, {s.name}) \\' for s in syscalls]
+    lines += ['']
+    return '\n'.join(lines) + '\n'
+
+
+def generate_asm(version: int, syscalls: list) -> str:
+    lines = [
+        '; tools/makesyscall.py が kernel/syscalls.txt から生成する. 直接編集しないこと',
+        '',
+        'bits 64',
+        'section .text',
+        '',
+        '%macro define_syscall 2',
+        'global Syscall%1',
+        'Syscall%1:',
+        '    mov rax, %2',
+        '    mov r10, rcx',
+        '    syscall',
+        '    ret',
+        '%endmacro',
+        '',
+    ]
+    lines += [f'define_syscall {s.name + ",":<21}0x{NUMBER_BASE + s.number:08x}'
+              for s in syscalls]
+    return '\n'.join(lines) + '\n'
+
+
+def generate_proto(version: int, syscalls: list) -> str:
+    lines = [
+        '// tools/makesyscall.py が kernel/syscalls.txt から生成する. 直接編集しないこと',
+        '// syscall.h の extern "C" の中から読み込まれる',
+        '',
+        f'#define SYSCALL_ABI_VERSION {version}',
+    ]
+
+    for s in syscalls:
+        lines.append('')
+        lines += [f'  // {d}' for d in s.doc]
+        ret = 'void' if s.returns_void else 'struct SyscallResult'
+        head = f'  {ret} Syscall{s.name}('
+        if not s.params:
+            lines.append(head + ');')
+            continue
+        indent = ' ' * len(head)
+        for i, p in enumerate(s.params):
+            sep = ');' if i == len(s.params) - 1 else ','
+            lines.append((head if i == 0 else indent) + p + sep)
+
+    return '\n'.join(lines) + '\n'
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('syscalls', help='path to a syscall definition file')
+    parser.add_argument('--table', help='path to an output kernel table header')
+    parser.add_argument('--asm', help='path to an output stub file')
+    parser.add_argument('--proto', help='path to an output prototype header')
+    ns = parser.parse_args()
+
+    with open(ns.syscalls) as f:
+        version, syscalls = parse(f.read())
+
+    outputs = [
+        (ns.table, generate_table),
+        (ns.asm, generate_asm),
+        (ns.proto, generate_proto),
+    ]
+    for path, generate in outputs:
+        if path:
+            with open(path, 'w') as out:
+                out.write(generate(version, syscalls))
+
+
+if __name__ == '__main__':
+    main()